@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+#include "audio.h"
+#include "log.h"
+
+/* @brief: SDL audio callback, on SDL's audio thread. Reads every queued buzzer state, then fills the
+ * buffer with the tone or silence
+ * @arg userdata: audio_t
+ * @arg stream: Buffer to fill, signed 16-bit mono
+ * @arg length: Size of stream in bytes */
+static void fill_audio(void* userdata, Uint8* stream, int length)
+{
+	audio_t* audio = userdata;
+	int16_t* samples = (int16_t*)stream;
+	uint32_t count = length / sizeof(int16_t);
+	uint_fast32_t tail = atomic_load_explicit(&audio->tail, memory_order_relaxed);
+	uint_fast32_t head = atomic_load_explicit(&audio->head, memory_order_acquire);
+	bool sound = audio->on;
+
+	// A beep that came and went since the last buffer still gets this one
+	for(; tail != head; tail++)
+	{
+		audio->on = audio->ring[tail & (AUDIO_RING_SIZE - 1)];
+		sound |= audio->on;
+	}
+	atomic_store_explicit(&audio->tail, tail, memory_order_release);
+
+	if(!sound)
+	{
+		// Start the next beep at the beginning of a wave, so it doesn't click
+		audio->phase = 0;
+		memset(samples, 0, count * sizeof(int16_t));
+		return;
+	}
+	for(uint32_t n = 0; n < count; n++)
+	{
+		samples[n] = audio->phase < audio->half_period ? AUDIO_VOLUME : -AUDIO_VOLUME;
+		audio->phase = audio->phase + 1 < 2 * audio->half_period ? audio->phase + 1 : 0;
+	}
+}
+
+int audio_open(audio_t* audio, uint16_t samples)
+{
+	SDL_AudioSpec wanted;
+	SDL_AudioSpec obtained;
+
+	atomic_init(&audio->head, 0);
+	atomic_init(&audio->tail, 0);
+	audio->queued = false;
+	audio->on = false;
+	audio->phase = 0;
+
+	memset(&wanted, 0, sizeof(wanted));
+	wanted.freq = AUDIO_FREQUENCY;
+	wanted.format = AUDIO_S16SYS;
+	wanted.channels = 1;
+	wanted.samples = samples;
+	wanted.callback = fill_audio;
+	wanted.userdata = audio;
+	// SDL converts anything the device wants differently, so the callback only ever sees this format
+	audio->device = SDL_OpenAudioDevice(NULL, 0, &wanted, &obtained, 0);
+	if(audio->device == 0)
+	{
+		printf("Could not open audio: %s\n", SDL_GetError());
+		return -1;
+	}
+	audio->half_period = AUDIO_FREQUENCY / AUDIO_TONE_HZ / 2;
+	LOG_INFO("Audio buffer %d samples, %d us", obtained.samples, obtained.samples * 1000000 / AUDIO_FREQUENCY);
+	// Devices start paused
+	SDL_PauseAudioDevice(audio->device, 0);
+	return 0;
+}
+
+void audio_buzzer(audio_t* audio, bool on)
+{
+	uint_fast32_t head;
+
+	if(audio->device == 0 || on == audio->queued)
+	{
+		return;
+	}
+	head = atomic_load_explicit(&audio->head, memory_order_relaxed);
+	if(head - atomic_load_explicit(&audio->tail, memory_order_acquire) == AUDIO_RING_SIZE)
+	{
+		return;
+	}
+	audio->ring[head & (AUDIO_RING_SIZE - 1)] = on;
+	atomic_store_explicit(&audio->head, head + 1, memory_order_release);
+	audio->queued = on;
+}
+
+void audio_close(audio_t* audio)
+{
+	if(audio->device != 0)
+	{
+		SDL_CloseAudioDevice(audio->device);
+		audio->device = 0;
+	}
+}
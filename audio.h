@@ -0,0 +1,48 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+/* Buzzer. While the sound timer is above zero the machine beeps, played here as a square wave
+ * generated in SDL's audio callback. The emulation thread reports the buzzer state once per displayed
+ * frame with audio_buzzer(), which only queues it: the states go through a single-producer,
+ * single-consumer ring to the callback, so neither side ever waits on the other. A full ring
+ * (the device stopped pulling) drops the newest state.
+ *
+ * The callback plays a whole buffer at a time, so latency is about one buffer. The default
+ * AUDIO_DEFAULT_SAMPLES at AUDIO_FREQUENCY is under 12 ms, less than a frame. A beep that starts
+ * and stops between two callbacks still sounds for one buffer rather than being lost */
+
+#define AUDIO_FREQUENCY 44100
+#define AUDIO_DEFAULT_SAMPLES 512
+#define AUDIO_TONE_HZ 440
+// Peak amplitude of the signed 16-bit square wave
+#define AUDIO_VOLUME 3000
+// Queued buzzer states. A power of two
+#define AUDIO_RING_SIZE 64
+
+typedef struct audio_t
+{
+	SDL_AudioDeviceID device;
+	// Buzzer states, written at head by the emulation thread and read from tail by the callback
+	uint8_t ring[AUDIO_RING_SIZE];
+	atomic_uint_fast32_t head;
+	atomic_uint_fast32_t tail;
+	// Emulation thread only: the last state queued, so unchanged frames queue nothing
+	bool queued;
+	// Callback only: the state after the last one read, position in the wave and samples per half wave
+	bool on;
+	uint32_t phase;
+	uint32_t half_period;
+} audio_t;
+
+// Open the default output device with buffers of samples (a power of two). Returns 0 on success
+int audio_open(audio_t* audio, uint16_t samples);
+// Queue the buzzer state for the callback. Never blocks
+void audio_buzzer(audio_t* audio, bool on);
+void audio_close(audio_t* audio);
+
+#endif
@@ -0,0 +1,613 @@
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BATCH_HAVE_AVX2 1
+#endif
+
+// Bytes of lane arrays per lane: V0-VF, I, PC, opcode, timers, masks
+#define BATCH_BYTES_PER_LANE (NUM_GENERAL_PURPOSE_REGISTERS + 2 * 3 + 2 + 4)
+
+batch_t* batch_create(const chip8_t* chip, uint32_t count)
+{
+	batch_t* batch = calloc(1, sizeof(batch_t));
+	uint8_t* arrays;
+
+	if(batch == NULL || count == 0)
+	{
+		free(batch);
+		return NULL;
+	}
+	batch->count = count;
+	batch->lanes = (count + BATCH_LANE_ALIGN - 1) / BATCH_LANE_ALIGN * BATCH_LANE_ALIGN;
+	arrays = aligned_alloc(BATCH_LANE_ALIGN, (size_t)batch->lanes * BATCH_BYTES_PER_LANE);
+	batch->chips = malloc(count * sizeof(chip8_t));
+	if(arrays == NULL || batch->chips == NULL)
+	{
+		free(arrays);
+		free(batch->chips);
+		free(batch);
+		return NULL;
+	}
+	memset(arrays, 0, (size_t)batch->lanes * BATCH_BYTES_PER_LANE);
+
+	// Every array starts on a multiple of lanes bytes, so all of them are 32-byte aligned
+	for(uint8_t reg = 0; reg < NUM_GENERAL_PURPOSE_REGISTERS; reg++)
+	{
+		batch->v[reg] = arrays;
+		arrays += batch->lanes;
+	}
+	batch->i = (uint16_t*)arrays;
+	batch->pc = batch->i + batch->lanes;
+	batch->opcode = batch->pc + batch->lanes;
+	arrays = (uint8_t*)(batch->opcode + batch->lanes);
+	batch->delay_timer = arrays;
+	batch->sound_timer = arrays + batch->lanes;
+	batch->all = arrays + 2 * batch->lanes;
+	batch->pending = arrays + 3 * batch->lanes;
+	batch->group = arrays + 4 * batch->lanes;
+	batch->skip = arrays + 5 * batch->lanes;
+
+	for(uint32_t lane = 0; lane < count; lane++)
+	{
+		chip8_t* copy = &batch->chips[lane];
+
+		*copy = *chip;
+		// Lanes are always stepped by emulate_cycle(), they have no caches of their own
+		copy->cache = NULL;
+		copy->jit = NULL;
+		copy->trace = NULL;
+		copy->dirty_pages = 0;
+		for(uint8_t reg = 0; reg < NUM_GENERAL_PURPOSE_REGISTERS; reg++)
+		{
+			batch->v[reg][lane] = chip->v[reg];
+		}
+		batch->i[lane] = chip->i;
+		batch->pc[lane] = chip->pc;
+		batch->opcode[lane] = chip->opcode;
+		batch->delay_timer[lane] = chip->delay_timer;
+		batch->sound_timer[lane] = chip->sound_timer;
+		batch->all[lane] = 0xFF;
+	}
+
+#ifdef BATCH_HAVE_AVX2
+	batch->avx2 = __builtin_cpu_supports("avx2");
+#endif
+	return batch;
+}
+
+void batch_destroy(batch_t* batch)
+{
+	if(batch == NULL)
+	{
+		return;
+	}
+	free(batch->v[0]);
+	free(batch->chips);
+	free(batch);
+}
+
+static void load_lane(const batch_t* batch, uint32_t lane, chip8_t* chip)
+{
+	for(uint8_t reg = 0; reg < NUM_GENERAL_PURPOSE_REGISTERS; reg++)
+	{
+		chip->v[reg] = batch->v[reg][lane];
+	}
+	chip->i = batch->i[lane];
+	chip->pc = batch->pc[lane];
+	chip->opcode = batch->opcode[lane];
+	chip->delay_timer = batch->delay_timer[lane];
+	chip->sound_timer = batch->sound_timer[lane];
+}
+
+static void store_lane(batch_t* batch, uint32_t lane, const chip8_t* chip)
+{
+	for(uint8_t reg = 0; reg < NUM_GENERAL_PURPOSE_REGISTERS; reg++)
+	{
+		batch->v[reg][lane] = chip->v[reg];
+	}
+	batch->i[lane] = chip->i;
+	batch->pc[lane] = chip->pc;
+	batch->opcode[lane] = chip->opcode;
+	batch->delay_timer[lane] = chip->delay_timer;
+	batch->sound_timer[lane] = chip->sound_timer;
+}
+
+void batch_sync(batch_t* batch)
+{
+	for(uint32_t lane = 0; lane < batch->count; lane++)
+	{
+		load_lane(batch, lane, &batch->chips[lane]);
+	}
+}
+
+/* @brief: Remember which bytes some lane has written. Code at those addresses may differ between lanes */
+static void mark_written(batch_t* batch, uint32_t address, uint32_t length)
+{
+	// Like the stores themselves, wraps at the end of memory
+	for(uint32_t n = address; n < address + length; n++)
+	{
+		batch->written[(n & 0xFFF) / 64] |= 1ULL << (n % 64);
+	}
+}
+
+static bool was_written(const batch_t* batch, uint16_t pc)
+{
+	uint16_t next = (pc + 1) & 0xFFF;
+
+	pc &= 0xFFF;
+	return ((batch->written[pc / 64] >> (pc % 64)) | (batch->written[next / 64] >> (next % 64))) & 1;
+}
+
+/* @brief: Run one instruction of one lane through the interpreter */
+static void step_lane(batch_t* batch, uint32_t lane)
+{
+	chip8_t* chip = &batch->chips[lane];
+
+	const decoded_opcode_t* op = &decode_table[(chip->memory[batch->pc[lane] & 0xFFF] << 8) | chip->memory[(batch->pc[lane] + 1) & 0xFFF]];
+
+	if(op->op_class == OP_FX33 || op->op_class == OP_FX55)
+	{
+		mark_written(batch, batch->i[lane] & 0xFFF, op->op_class == OP_FX33 ? 3 : op->x + 1);
+	}
+	load_lane(batch, lane, chip);
+	emulate_cycle(chip);
+	store_lane(batch, lane, chip);
+}
+
+/* @brief: Execute an instruction that only needs a lane's registers, stack and memory, without
+ * copying the lane in and out of its chip8_t. The PC is advanced by 2 afterwards for all of them,
+ * so jumps store their target minus 2. Same semantics as the matching execute_opcode_* handler */
+static void run_lane(batch_t* batch, uint32_t lane, const decoded_opcode_t* op)
+{
+	chip8_t* chip = &batch->chips[lane];
+	uint16_t i = batch->i[lane];
+
+	switch(op->op_class)
+	{
+		case OP_00EE:
+			chip->sp = (chip->sp - 1) & (SIZE_STACK - 1);
+			batch->pc[lane] = chip->stack[chip->sp];
+			break;
+		case OP_1NNN:
+			batch->pc[lane] = op->nnn - 2;
+			break;
+		case OP_2NNN:
+			chip->stack[chip->sp] = batch->pc[lane];
+			chip->sp = (chip->sp + 1) & (SIZE_STACK - 1);
+			batch->pc[lane] = op->nnn - 2;
+			break;
+		case OP_ANNN:
+			batch->i[lane] = op->nnn;
+			break;
+		case OP_FX07:
+			batch->v[op->x][lane] = batch->delay_timer[lane];
+			break;
+		case OP_FX15:
+			batch->delay_timer[lane] = batch->v[op->x][lane];
+			break;
+		case OP_FX18:
+			batch->sound_timer[lane] = batch->v[op->x][lane];
+			break;
+		case OP_FX1E:
+			batch->i[lane] += batch->v[op->x][lane];
+			break;
+		case OP_FX29:
+			batch->i[lane] = batch->v[op->x][lane] * SIZE_FONT_CHAR + OFFSET_FONT;
+			break;
+		case OP_FX33:
+		{
+			uint8_t value = batch->v[op->x][lane];
+			chip->memory[i & 0xFFF] = value / 100;
+			chip->memory[(i + 1) & 0xFFF] = (value / 10) % 10;
+			chip->memory[(i + 2) & 0xFFF] = value % 10;
+			invalidate_code(chip, i & 0xFFF, 3);
+			mark_written(batch, i & 0xFFF, 3);
+			break;
+		}
+		case OP_FX55:
+			for(uint8_t reg = 0; reg <= op->x; reg++)
+			{
+				chip->memory[(i + reg) & 0xFFF] = batch->v[reg][lane];
+			}
+			invalidate_code(chip, i & 0xFFF, op->x + 1);
+			mark_written(batch, i & 0xFFF, op->x + 1);
+			break;
+		case OP_FX65:
+			for(uint8_t reg = 0; reg <= op->x; reg++)
+			{
+				batch->v[reg][lane] = chip->memory[(i + reg) & 0xFFF];
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/* @brief: PC += 2 (4 where skip is set, if given) and record the fetched opcode for the lanes in
+ * the mask */
+static void advance_lanes(batch_t* batch, const uint8_t* mask, const uint8_t* skip, uint16_t opcode)
+{
+	for(uint32_t lane = 0; lane < batch->count; lane++)
+	{
+		if(mask[lane])
+		{
+			batch->pc[lane] += skip != NULL && skip[lane] ? 4 : 2;
+			batch->opcode[lane] = opcode;
+		}
+	}
+}
+
+/* @brief: Set skip[] for the lanes where a 3XKK, 4XKK, 5XY0 or 9XY0 skips */
+static void test_skips(batch_t* batch, const decoded_opcode_t* op)
+{
+	const uint8_t* vx = batch->v[op->x];
+	const uint8_t* vy = batch->v[op->y];
+	bool compare_vy = op->op_class == OP_5XY0 || op->op_class == OP_9XY0;
+	bool skip_if_equal = op->op_class == OP_3XKK || op->op_class == OP_5XY0;
+
+	for(uint32_t lane = 0; lane < batch->count; lane++)
+	{
+		batch->skip[lane] = (vx[lane] == (compare_vy ? vy[lane] : op->kk)) == skip_if_equal ? 0xFF : 0;
+	}
+}
+
+static bool same_pc(const batch_t* batch, uint16_t pc)
+{
+	for(uint32_t lane = 0; lane < batch->count; lane++)
+	{
+		if(batch->pc[lane] != pc)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+#ifdef BATCH_HAVE_AVX2
+// Vx = RESULT for the lanes in the mask. x, y and the mask register m are in scope
+#define ALU_AVX2(RESULT) \
+	for(uint32_t lane = 0; lane < batch->lanes; lane += 32) \
+	{ \
+		__m256i m = _mm256_load_si256((const __m256i*)(mask + lane)); \
+		__m256i x = _mm256_load_si256((const __m256i*)(vx + lane)); \
+		__m256i y = _mm256_load_si256((const __m256i*)(vy + lane)); \
+		(void)y; \
+		_mm256_store_si256((__m256i*)(vx + lane), _mm256_blendv_epi8(x, (RESULT), m)); \
+	}
+
+// As ALU_AVX2, then VF = FLAG (0 or 1). VF is written last, like the handlers do, so it wins when x is F
+#define ALU_FLAG_AVX2(RESULT, FLAG) \
+	for(uint32_t lane = 0; lane < batch->lanes; lane += 32) \
+	{ \
+		__m256i m = _mm256_load_si256((const __m256i*)(mask + lane)); \
+		__m256i x = _mm256_load_si256((const __m256i*)(vx + lane)); \
+		__m256i y = _mm256_load_si256((const __m256i*)(vy + lane)); \
+		__m256i flag = (FLAG); \
+		(void)y; \
+		_mm256_store_si256((__m256i*)(vx + lane), _mm256_blendv_epi8(x, (RESULT), m)); \
+		__m256i f = _mm256_load_si256((const __m256i*)(vf + lane)); \
+		_mm256_store_si256((__m256i*)(vf + lane), _mm256_blendv_epi8(f, flag, m)); \
+	}
+
+/* @brief: advance_lanes() 16 lanes at a time, with the byte masks widened to words */
+__attribute__((target("avx2")))
+static void advance_avx2(batch_t* batch, const uint8_t* mask, const uint8_t* skip, uint16_t opcode)
+{
+	const __m256i two = _mm256_set1_epi16(2);
+	const __m256i fetched = _mm256_set1_epi16((short)opcode);
+
+	for(uint32_t lane = 0; lane < batch->lanes; lane += 16)
+	{
+		__m256i m = _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i*)(mask + lane)));
+		__m256i pc = _mm256_load_si256((const __m256i*)(batch->pc + lane));
+		__m256i last = _mm256_load_si256((const __m256i*)(batch->opcode + lane));
+		__m256i step = two;
+
+		if(skip != NULL)
+		{
+			__m256i s = _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i*)(skip + lane)));
+			step = _mm256_add_epi16(two, _mm256_and_si256(s, two));
+		}
+		_mm256_store_si256((__m256i*)(batch->pc + lane), _mm256_add_epi16(pc, _mm256_and_si256(m, step)));
+		_mm256_store_si256((__m256i*)(batch->opcode + lane), _mm256_blendv_epi8(last, fetched, m));
+	}
+}
+
+/* @brief: test_skips() 32 lanes at a time */
+__attribute__((target("avx2")))
+static void test_skips_avx2(batch_t* batch, const decoded_opcode_t* op)
+{
+	const uint8_t* vx = batch->v[op->x];
+	const uint8_t* vy = batch->v[op->y];
+	bool compare_vy = op->op_class == OP_5XY0 || op->op_class == OP_9XY0;
+	// XOR with all ones turns "equal" into "not equal"
+	__m256i invert = op->op_class == OP_3XKK || op->op_class == OP_5XY0 ? _mm256_setzero_si256() : _mm256_set1_epi8(-1);
+	__m256i kk = _mm256_set1_epi8((char)op->kk);
+
+	for(uint32_t lane = 0; lane < batch->lanes; lane += 32)
+	{
+		__m256i x = _mm256_load_si256((const __m256i*)(vx + lane));
+		__m256i other = compare_vy ? _mm256_load_si256((const __m256i*)(vy + lane)) : kk;
+
+		_mm256_store_si256((__m256i*)(batch->skip + lane), _mm256_xor_si256(_mm256_cmpeq_epi8(x, other), invert));
+	}
+}
+
+/* @brief: same_pc() 16 lanes at a time. Padding lanes don't count */
+__attribute__((target("avx2")))
+static bool same_pc_avx2(const batch_t* batch, uint16_t pc)
+{
+	const __m256i target = _mm256_set1_epi16((short)pc);
+	__m256i differ = _mm256_setzero_si256();
+
+	for(uint32_t lane = 0; lane < batch->lanes; lane += 16)
+	{
+		__m256i m = _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i*)(batch->all + lane)));
+		__m256i equal = _mm256_cmpeq_epi16(_mm256_load_si256((const __m256i*)(batch->pc + lane)), target);
+
+		differ = _mm256_or_si256(differ, _mm256_andnot_si256(equal, m));
+	}
+	return _mm256_testz_si256(differ, differ);
+}
+
+/* @brief: Execute a 6XKK, 7XKK or 8XYn for the lanes in the mask, 32 at a time */
+__attribute__((target("avx2")))
+static void alu_avx2(batch_t* batch, const decoded_opcode_t* op, const uint8_t* mask)
+{
+	uint8_t* vx = batch->v[op->x];
+	const uint8_t* vy = batch->v[op->y];
+	uint8_t* vf = batch->v[0xF];
+	const __m256i kk = _mm256_set1_epi8((char)op->kk);
+	const __m256i one = _mm256_set1_epi8(1);
+	const __m256i zero = _mm256_setzero_si256();
+
+	switch(op->op_class)
+	{
+		case OP_6XKK:
+			ALU_AVX2(kk);
+			break;
+		case OP_7XKK:
+			ALU_AVX2(_mm256_add_epi8(x, kk));
+			break;
+		case OP_8XY0:
+			ALU_AVX2(y);
+			break;
+		case OP_8XY1:
+			ALU_FLAG_AVX2(_mm256_or_si256(x, y), zero);
+			break;
+		case OP_8XY2:
+			ALU_FLAG_AVX2(_mm256_and_si256(x, y), zero);
+			break;
+		case OP_8XY3:
+			ALU_FLAG_AVX2(_mm256_xor_si256(x, y), zero);
+			break;
+		case OP_8XY4:
+			// Carry out when the wrapped sum is below Vx
+			ALU_FLAG_AVX2(_mm256_add_epi8(x, y),
+				_mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(_mm256_add_epi8(x, y), x), _mm256_add_epi8(x, y)), one));
+			break;
+		case OP_8XY5:
+			ALU_FLAG_AVX2(_mm256_sub_epi8(x, y), _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(x, y), x), one));
+			break;
+		case OP_8XY6:
+			// No byte shifts in AVX2. Shift 16-bit lanes and drop the bit that crossed over
+			ALU_FLAG_AVX2(_mm256_and_si256(_mm256_srli_epi16(x, 1), _mm256_set1_epi8(0x7F)), _mm256_and_si256(x, one));
+			break;
+		case OP_8XY7:
+			ALU_FLAG_AVX2(_mm256_sub_epi8(y, x), _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(y, x), y), one));
+			break;
+		case OP_8XYE:
+			ALU_FLAG_AVX2(_mm256_add_epi8(x, x), _mm256_and_si256(_mm256_srli_epi16(x, 7), one));
+			break;
+		default:
+			break;
+	}
+	advance_avx2(batch, mask, NULL, op->opcode);
+}
+#endif
+
+/* @brief: Execute the instruction at the leader's PC for every lane in the mask. Lanes that have
+ * different code at that address are removed from the mask and left for a later group
+ * @return: true if every lane in the mask is waiting in FX0A with its keys unchanged */
+static bool run_group(batch_t* batch, uint32_t leader, uint8_t* mask)
+{
+	uint16_t pc = batch->pc[leader] & 0xFFF;
+	const uint8_t* memory = batch->chips[leader].memory;
+	uint16_t opcode = (memory[pc] << 8) | memory[(pc + 1) & 0xFFF];
+	const decoded_opcode_t* op = &decode_table[opcode];
+
+	if(was_written(batch, pc))
+	{
+		for(uint32_t lane = 0; lane < batch->count; lane++)
+		{
+			const uint8_t* code = batch->chips[lane].memory;
+			if(mask[lane] && ((code[pc] << 8) | code[(pc + 1) & 0xFFF]) != opcode)
+			{
+				mask[lane] = 0;
+			}
+		}
+	}
+
+	switch(op->op_class)
+	{
+		case OP_6XKK:
+		case OP_7XKK:
+		case OP_8XY0:
+		case OP_8XY1:
+		case OP_8XY2:
+		case OP_8XY3:
+		case OP_8XY4:
+		case OP_8XY5:
+		case OP_8XY6:
+		case OP_8XY7:
+		case OP_8XYE:
+#ifdef BATCH_HAVE_AVX2
+			if(batch->avx2)
+			{
+				alu_avx2(batch, op, mask);
+				return false;
+			}
+#endif
+			break;
+		case OP_3XKK:
+		case OP_4XKK:
+		case OP_5XY0:
+		case OP_9XY0:
+#ifdef BATCH_HAVE_AVX2
+			if(batch->avx2)
+			{
+				test_skips_avx2(batch, op);
+				advance_avx2(batch, mask, batch->skip, opcode);
+				return false;
+			}
+#endif
+			test_skips(batch, op);
+			advance_lanes(batch, mask, batch->skip, opcode);
+			return false;
+		case OP_00EE:
+		case OP_1NNN:
+		case OP_2NNN:
+		case OP_ANNN:
+		case OP_FX07:
+		case OP_FX15:
+		case OP_FX18:
+		case OP_FX1E:
+		case OP_FX29:
+		case OP_FX33:
+		case OP_FX55:
+		case OP_FX65:
+			for(uint32_t lane = 0; lane < batch->count; lane++)
+			{
+				if(mask[lane])
+				{
+					run_lane(batch, lane, op);
+				}
+			}
+#ifdef BATCH_HAVE_AVX2
+			if(batch->avx2)
+			{
+				advance_avx2(batch, mask, NULL, opcode);
+				return false;
+			}
+#endif
+			advance_lanes(batch, mask, NULL, opcode);
+			return false;
+		case OP_FX0A:
+		{
+			bool waiting = true;
+
+			// Lanes whose keys haven't changed just fetch FX0A again. Only the others need the handler
+			for(uint32_t lane = 0; lane < batch->count; lane++)
+			{
+				if(!mask[lane])
+				{
+					continue;
+				}
+				if(!key_wait_idle(&batch->chips[lane]))
+				{
+					step_lane(batch, lane);
+					waiting = false;
+				}
+				else
+				{
+					batch->opcode[lane] = opcode;
+				}
+			}
+			return waiting;
+		}
+		default:
+			break;
+	}
+
+	for(uint32_t lane = 0; lane < batch->count; lane++)
+	{
+		if(mask[lane])
+		{
+			step_lane(batch, lane);
+		}
+	}
+	return false;
+}
+
+/* @brief: One instruction in every lane
+ * @return: true if all lanes are waiting for a key. Keys don't change during batch_run(), so the
+ * remaining steps would change nothing */
+static bool batch_step(batch_t* batch)
+{
+	uint16_t pc = batch->pc[0];
+	uint32_t groups = 0;
+	bool together;
+
+#ifdef BATCH_HAVE_AVX2
+	together = batch->avx2 ? same_pc_avx2(batch, pc) : same_pc(batch, pc);
+#else
+	together = same_pc(batch, pc);
+#endif
+	// Usual case: all lanes together on code nobody has written to
+	if(together && !was_written(batch, pc))
+	{
+		return run_group(batch, 0, batch->all);
+	}
+
+	memcpy(batch->pending, batch->all, batch->lanes);
+	for(uint32_t leader = 0; leader < batch->count; leader++)
+	{
+		if(!batch->pending[leader])
+		{
+			continue;
+		}
+		// Too scattered for groups to pay off
+		if(++groups > BATCH_MAX_GROUPS)
+		{
+			for(uint32_t lane = leader; lane < batch->count; lane++)
+			{
+				if(batch->pending[lane])
+				{
+					step_lane(batch, lane);
+				}
+			}
+			return false;
+		}
+
+		pc = batch->pc[leader];
+		for(uint32_t lane = 0; lane < batch->lanes; lane++)
+		{
+			batch->group[lane] = batch->pending[lane] & (batch->pc[lane] == pc ? 0xFF : 0);
+		}
+		run_group(batch, leader, batch->group);
+		for(uint32_t lane = 0; lane < batch->lanes; lane++)
+		{
+			batch->pending[lane] &= ~batch->group[lane];
+		}
+	}
+	return false;
+}
+
+void batch_run(batch_t* batch, uint32_t cycles)
+{
+	for(uint32_t cycle = 0; cycle < cycles; cycle++)
+	{
+		if(batch_step(batch))
+		{
+			return;
+		}
+	}
+}
+
+void batch_tick_timers(batch_t* batch)
+{
+	for(uint32_t lane = 0; lane < batch->count; lane++)
+	{
+		if(batch->delay_timer[lane] > 0)
+		{
+			batch->delay_timer[lane]--;
+		}
+		if(batch->sound_timer[lane] > 0)
+		{
+			batch->sound_timer[lane]--;
+		}
+	}
+}
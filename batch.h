@@ -0,0 +1,60 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "chip8.h"
+
+/* Lockstep batch engine for many machines running the same ROM. Registers, I, PC, opcode and the
+ * timers are stored as lane arrays (one entry per machine), so an instruction that every machine
+ * is about to execute is run once for all of them. Each step groups the lanes by PC:
+ *
+ *   6XKK, 7XKK, 8XY0-8XYE  AVX2, 32 lanes per instruction (checked at run time)
+ *   skips                   one pass over the lane arrays
+ *   jumps, calls, returns, ANNN, timers, FX1E, FX29, FX33, FX55, FX65
+ *                           per lane, straight on the lane arrays
+ *   everything else         each lane in the group is copied into its chip8_t and stepped by
+ *                           emulate_cycle(), so the semantics are the handlers' own
+ *
+ * Lanes that take a different branch simply land in a different group on the next step. Past
+ * BATCH_MAX_GROUPS groups in one step the remaining lanes are stepped one by one. Memory, display,
+ * stack, keys and RND state stay in each lane's chip8_t. After batch_run() every lane is in exactly
+ * the state the interpreter would have left it in */
+
+// Lane arrays are padded to a whole number of AVX2 registers
+#define BATCH_LANE_ALIGN 32
+#define BATCH_MAX_GROUPS 8
+
+typedef struct batch_t
+{
+	// Machines, and lanes allocated (count rounded up to BATCH_LANE_ALIGN)
+	uint32_t count;
+	uint32_t lanes;
+	uint8_t* v[NUM_GENERAL_PURPOSE_REGISTERS];
+	uint16_t* i;
+	uint16_t* pc;
+	uint16_t* opcode;
+	uint8_t* delay_timer;
+	uint8_t* sound_timer;
+	// The rest of each machine. Its registers are only current after batch_sync()
+	chip8_t* chips;
+	// Lane masks, 0xFF where the lane takes part. all covers every machine and none of the padding
+	uint8_t* all;
+	uint8_t* pending;
+	uint8_t* group;
+	// Per-lane result of a skip instruction
+	uint8_t* skip;
+	// Bit per memory address any lane has written to. Code there may differ between lanes
+	uint64_t written[SIZE_MEMORY / 64];
+	bool avx2;
+} batch_t;
+
+// count copies of chip. Returns NULL if out of memory
+batch_t* batch_create(const chip8_t* chip, uint32_t count);
+void batch_destroy(batch_t* batch);
+// Every lane executes exactly the given number of instructions
+void batch_run(batch_t* batch, uint32_t cycles);
+// 60Hz timer tick for every lane
+void batch_tick_timers(batch_t* batch);
+// Copy the lane arrays into each lane's chip8_t
+void batch_sync(batch_t* batch);
+
+#endif
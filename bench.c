@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "chip8.h"
+#include "jit.h"
+
+/* Benchmarks for the emulator core, printed as JSON so results can be compared between builds.
+ * Two sets:
+ *   handlers: every execute_opcode_* handler called directly through the decode table, with extra
+ *             cases for the expensive ones (DXYN, FX33, FX55, FX65)
+ *   roms:     whole-machine instructions per second on the synthetic ROMs below, once per engine
+ * Build: make chip8_bench
+ * Usage: ./chip8_bench [--calls (n)] [--cycles (n)] > results.json */
+
+// Handler calls per case and instructions per ROM run, unless given on the command line
+#define BENCH_DEFAULT_CALLS 20000000
+#define BENCH_DEFAULT_CYCLES 50000000
+// Handlers are called in bursts this long, then PC, I and SP are put back so they stay in range
+#define BENCH_BURST SIZE_STACK
+// Where I points during handler benchmarks. Filled with sprite-like data
+#define BENCH_DATA_ADDRESS 0x300
+
+typedef struct handler_case_t
+{
+	const char* name;
+	uint16_t opcode;
+	// Values loaded into V0 and V1 (sprite coordinates for DXYN)
+	uint8_t v0;
+	uint8_t v1;
+} handler_case_t;
+
+typedef struct rom_t
+{
+	const char* name;
+	const uint8_t* code;
+	size_t size;
+} rom_t;
+
+// One case per handler, plus the variants that take different paths through DXYN, FX33, FX55 and FX65
+static const handler_case_t handler_cases[] =
+{
+	{"00E0", 0x00E0, 0, 0},
+	{"00EE", 0x00EE, 0, 0},
+	{"1NNN", 0x1200, 0, 0},
+	{"2NNN", 0x2200, 0, 0},
+	{"3XKK", 0x3012, 0x12, 0},
+	{"4XKK", 0x4012, 0x12, 0},
+	{"5XY0", 0x5010, 1, 2},
+	{"6XKK", 0x6A55, 0, 0},
+	{"7XKK", 0x7A01, 0, 0},
+	{"8XY0", 0x8010, 1, 2},
+	{"8XY1", 0x8011, 1, 2},
+	{"8XY2", 0x8012, 1, 2},
+	{"8XY3", 0x8013, 1, 2},
+	{"8XY4", 0x8014, 1, 2},
+	{"8XY5", 0x8015, 1, 2},
+	{"8XY6", 0x8016, 1, 2},
+	{"8XY7", 0x8017, 1, 2},
+	{"8XYE", 0x801E, 1, 2},
+	{"9XY0", 0x9010, 1, 2},
+	{"ANNN", 0xA300, 0, 0},
+	{"BNNN", 0xB200, 0, 0},
+	{"CXKK", 0xC0FF, 0, 0},
+	{"DXYN aligned 8 rows", 0xD018, 8, 4},
+	{"DXYN unaligned 15 rows", 0xD01F, 13, 4},
+	{"DXYN clipped at the edges", 0xD01F, 60, 28},
+	{"DXYN 1 row", 0xD011, 13, 4},
+	{"EX9E", 0xE09E, 5, 0},
+	{"EXA1", 0xE0A1, 5, 0},
+	{"FX07", 0xF007, 0, 0},
+	{"FX0A waiting", 0xF00A, 0, 0},
+	{"FX15", 0xF015, 0, 0},
+	{"FX18", 0xF018, 0, 0},
+	{"FX1E", 0xF01E, 1, 0},
+	{"FX29", 0xF029, 7, 0},
+	{"FX33 1 digit", 0xF033, 7, 0},
+	{"FX33 3 digits", 0xF033, 255, 0},
+	{"FX55 V0", 0xF055, 1, 2},
+	{"FX55 V0-VF", 0xFF55, 1, 2},
+	{"FX65 V0", 0xF065, 0, 0},
+	{"FX65 V0-VF", 0xFF65, 0, 0},
+};
+
+/* Synthetic ROMs. Each one loops forever on a single kind of work */
+
+// Register arithmetic and a counted inner loop: 6XKK, 7XKK, 8XYn, 3XKK, 1NNN
+static const uint8_t rom_alu_loop[] =
+{
+	0x60, 0x01,	// 200: V0 = 1
+	0x61, 0x03,	// 202: V1 = 3
+	0x62, 0x00,	// 204: V2 = 0
+	0x80, 0x14,	// 206: V0 += V1
+	0x81, 0x03,	// 208: V1 ^= V0
+	0x83, 0x06,	// 20A: V3 = V0 >> 1
+	0x84, 0x35,	// 20C: V4 -= V3
+	0x85, 0x42,	// 20E: V5 &= V4
+	0x85, 0x0E,	// 210: V5 <<= 1
+	0x72, 0x01,	// 212: V2 += 1
+	0x32, 0x40,	// 214: skip if V2 == 0x40
+	0x12, 0x06,	// 216: jump 206
+	0x12, 0x04,	// 218: jump 204
+};
+
+// Random sprites all over the screen with periodic clears: CXKK, FX29, DXYN, 00E0
+static const uint8_t rom_draw_storm[] =
+{
+	0x63, 0x00,	// 200: V3 = 0
+	0xC0, 0x3F,	// 202: V0 = rnd & 63
+	0xC1, 0x1F,	// 204: V1 = rnd & 31
+	0xC2, 0x0F,	// 206: V2 = rnd & 15
+	0xF2, 0x29,	// 208: I = font digit V2
+	0xD0, 0x15,	// 20A: draw 5 rows at V0, V1
+	0xA2, 0x1C,	// 20C: I = 21C
+	0xD1, 0x08,	// 20E: draw 8 rows at V1, V0
+	0x73, 0x01,	// 210: V3 += 1
+	0x33, 0x00,	// 212: skip if V3 == 0
+	0x12, 0x02,	// 214: jump 202
+	0x00, 0xE0,	// 216: clear
+	0x12, 0x02,	// 218: jump 202
+	0x00, 0x00,	// 21A: padding
+	0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF,	// 21C: sprite
+};
+
+// Nested subroutine calls with a little work in each: 2NNN, 00EE, FX33, FX65
+static const uint8_t rom_call_churn[] =
+{
+	0x22, 0x06,	// 200: call 206
+	0x70, 0x01,	// 202: V0 += 1
+	0x12, 0x00,	// 204: jump 200
+	0x22, 0x0E,	// 206: call 20E
+	0x22, 0x0E,	// 208: call 20E
+	0x71, 0x01,	// 20A: V1 += 1
+	0x00, 0xEE,	// 20C: return
+	0x22, 0x16,	// 20E: call 216
+	0x72, 0x01,	// 210: V2 += 1
+	0x00, 0xEE,	// 212: return
+	0x00, 0x00,	// 214: padding
+	0xA3, 0x00,	// 216: I = 300
+	0xF0, 0x33,	// 218: BCD of V0 at I
+	0xF2, 0x65,	// 21A: V0-V2 = [I]
+	0x00, 0xEE,	// 21C: return
+};
+
+static const rom_t roms[] =
+{
+	{"alu_loop", rom_alu_loop, sizeof(rom_alu_loop)},
+	{"draw_storm", rom_draw_storm, sizeof(rom_draw_storm)},
+	{"call_churn", rom_call_churn, sizeof(rom_call_churn)},
+};
+
+static const struct
+{
+	const char* name;
+	engine_t engine;
+} engines[] =
+{
+	{"step", ENGINE_STEP},
+	{"block", ENGINE_BLOCK},
+	{"threaded", ENGINE_THREADED},
+	{"jit", ENGINE_JIT},
+};
+
+static double seconds_since(const struct timespec* start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* @brief: Put back everything a burst of handler calls may have moved out of range
+ * @arg chip:
+ * @arg test: */
+static void reset_burst(chip8_t* chip, const handler_case_t* test)
+{
+	chip->pc = GAME_START_ADDRESS;
+	chip->i = BENCH_DATA_ADDRESS;
+	// 00EE needs a full stack to return from, 2NNN an empty one to call into
+	chip->sp = test->opcode == 0x00EE ? SIZE_STACK : 0;
+	chip->v[0] = test->v0;
+	chip->v[1] = test->v1;
+}
+
+/* @brief: Call one handler repeatedly
+ * @arg chip: A freshly initialised machine
+ * @arg test:
+ * @arg calls: Number of handler calls, rounded up to a whole burst
+ * @return: Nanoseconds per call */
+static double bench_handler(chip8_t* chip, const handler_case_t* test, uint64_t calls)
+{
+	const decoded_opcode_t* op = &decode_table[test->opcode];
+	struct timespec start;
+
+	for(uint32_t n = 0; n < SIZE_STACK; n++)
+	{
+		chip->stack[n] = GAME_START_ADDRESS;
+	}
+	for(uint32_t n = 0; n < 0x100; n++)
+	{
+		chip->memory[BENCH_DATA_ADDRESS + n] = (uint8_t)(n * 0x9D + 0x3C);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(uint64_t call = 0; call < calls; call += BENCH_BURST)
+	{
+		reset_burst(chip, test);
+		for(uint32_t n = 0; n < BENCH_BURST; n++)
+		{
+			op->handler(chip, op);
+		}
+	}
+	return seconds_since(&start) * 1e9 / ((calls + BENCH_BURST - 1) / BENCH_BURST * BENCH_BURST);
+}
+
+/* @brief: Run a ROM for a fixed number of instructions
+ * @arg rom:
+ * @arg engine: Falls back to the block engine if the JIT isn't available
+ * @arg cycles:
+ * @arg used: Engine actually used
+ * @return: Instructions per second */
+static double bench_rom(const rom_t* rom, engine_t engine, uint64_t cycles, engine_t* used)
+{
+	static chip8_t chip;
+	struct timespec start;
+	double seconds;
+
+	initialize_chip(&chip);
+	memcpy(chip.memory + GAME_START_ADDRESS, rom->code, rom->size);
+	if(engine == ENGINE_JIT)
+	{
+		chip.jit = jit_create();
+		if(chip.jit == NULL)
+		{
+			engine = ENGINE_BLOCK;
+		}
+	}
+	if(engine == ENGINE_BLOCK)
+	{
+		chip.cache = create_block_cache();
+	}
+	*used = engine;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(uint64_t done = 0; done < cycles; )
+	{
+		// One 60Hz frame's worth at a fast clock, with the timers ticked in between like a real run
+		uint32_t batch = cycles - done < 100000 ? (uint32_t)(cycles - done) : 100000;
+		run_cycles(&chip, engine, batch);
+		handle_delay_timer(&chip);
+		handle_sound_timer(&chip);
+		done += batch;
+	}
+	seconds = seconds_since(&start);
+
+	if(chip.jit != NULL)
+	{
+		jit_destroy(chip.jit);
+	}
+	if(chip.cache != NULL)
+	{
+		destroy_block_cache(chip.cache);
+	}
+	return cycles / seconds;
+}
+
+int main(int argc, char** argv)
+{
+	static chip8_t chip;
+	uint64_t calls = BENCH_DEFAULT_CALLS;
+	uint64_t cycles = BENCH_DEFAULT_CYCLES;
+
+	for(int arg = 1; arg < argc; arg++)
+	{
+		if(strcmp(argv[arg], "--calls") == 0 && arg + 1 < argc)
+		{
+			calls = strtoull(argv[++arg], NULL, 0);
+		}
+		else if(strcmp(argv[arg], "--cycles") == 0 && arg + 1 < argc)
+		{
+			cycles = strtoull(argv[++arg], NULL, 0);
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [--calls (n)] [--cycles (n)]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(calls == 0 || cycles == 0)
+	{
+		fprintf(stderr, "--calls and --cycles must be above 0\n");
+		return 1;
+	}
+	build_decode_table();
+
+	printf("{\n  \"calls\": %llu,\n  \"cycles\": %llu,\n  \"handlers\": [\n", (unsigned long long)calls,
+		(unsigned long long)cycles);
+	for(size_t n = 0; n < sizeof(handler_cases) / sizeof(handler_cases[0]); n++)
+	{
+		initialize_chip(&chip);
+		double ns = bench_handler(&chip, &handler_cases[n], calls);
+		printf("    {\"name\": \"%s\", \"opcode\": \"0x%04X\", \"ns_per_call\": %.3f, \"calls_per_sec\": %.0f}%s\n",
+			handler_cases[n].name, handler_cases[n].opcode, ns, 1e9 / ns,
+			n + 1 < sizeof(handler_cases) / sizeof(handler_cases[0]) ? "," : "");
+	}
+
+	printf("  ],\n  \"roms\": [\n");
+	for(size_t r = 0; r < sizeof(roms) / sizeof(roms[0]); r++)
+	{
+		for(size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++)
+		{
+			engine_t used;
+			double ips = bench_rom(&roms[r], engines[e].engine, cycles, &used);
+			bool last = r + 1 == sizeof(roms) / sizeof(roms[0]) && e + 1 == sizeof(engines) / sizeof(engines[0]);
+
+			printf("    {\"rom\": \"%s\", \"engine\": \"%s\", \"fallback\": %s, \"ips\": %.0f}%s\n", roms[r].name,
+				engines[e].name, used != engines[e].engine ? "true" : "false", ips, last ? "" : ",");
+		}
+	}
+	printf("  ]\n}\n");
+	return 0;
+}
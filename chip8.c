@@ -0,0 +1,1582 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "chip8.h"
+#include "jit.h"
+#include "log.h"
+#include "trace.h"
+#include "profile.h"
+
+const uint8_t chip8_fontset[FONTSET_SIZE] =
+{
+	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+	0x20, 0x60, 0x20, 0x20, 0x70, // 1
+	0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+	0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+	0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+	0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+	0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+	0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+	0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+	0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+	0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+	0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+	0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+	0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+	0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+decoded_opcode_t decode_table[SIZE_DECODE_TABLE];
+
+const opcode_handler_t opcode_handlers[NUM_OPCODE_CLASSES] =
+{
+	[OP_UNKNOWN] = execute_opcode_unknown,
+	[OP_00E0] = execute_opcode_0x00E0,
+	[OP_00EE] = execute_opcode_0x00EE,
+	[OP_1NNN] = execute_opcode_0x1NNN,
+	[OP_2NNN] = execute_opcode_0x2NNN,
+	[OP_3XKK] = execute_opcode_0x3XKK,
+	[OP_4XKK] = execute_opcode_0x4XKK,
+	[OP_5XY0] = execute_opcode_0x5XY0,
+	[OP_6XKK] = execute_opcode_0x6XKK,
+	[OP_7XKK] = execute_opcode_0x7XKK,
+	[OP_8XY0] = execute_opcode_0x8XY0,
+	[OP_8XY1] = execute_opcode_0x8XY1,
+	[OP_8XY2] = execute_opcode_0x8XY2,
+	[OP_8XY3] = execute_opcode_0x8XY3,
+	[OP_8XY4] = execute_opcode_0x8XY4,
+	[OP_8XY5] = execute_opcode_0x8XY5,
+	[OP_8XY6] = execute_opcode_0x8XY6,
+	[OP_8XY7] = execute_opcode_0x8XY7,
+	[OP_8XYE] = execute_opcode_0x8XYE,
+	[OP_9XY0] = execute_opcode_0x9XY0,
+	[OP_ANNN] = execute_opcode_0xANNN,
+	[OP_BNNN] = execute_opcode_0xBNNN,
+	[OP_CXKK] = execute_opcode_0xCXKK,
+	[OP_DXYN] = execute_opcode_0xDXYN,
+	[OP_EX9E] = execute_opcode_0xEX9E,
+	[OP_EXA1] = execute_opcode_0xEXA1,
+	[OP_FX07] = execute_opcode_0xFX07,
+	[OP_FX0A] = execute_opcode_0xFX0A,
+	[OP_FX15] = execute_opcode_0xFX15,
+	[OP_FX18] = execute_opcode_0xFX18,
+	[OP_FX1E] = execute_opcode_0xFX1E,
+	[OP_FX29] = execute_opcode_0xFX29,
+	[OP_FX33] = execute_opcode_0xFX33,
+	[OP_FX55] = execute_opcode_0xFX55,
+	[OP_FX65] = execute_opcode_0xFX65,
+};
+
+/* @brief: 64-bit FNV-1a hash
+ * @arg data:
+ * @arg length: Size of data in bytes
+ * @return: Hash of the bytes */
+uint64_t hash_bytes(const void* data, size_t length)
+{
+	const uint8_t* bytes = data;
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	for(size_t n = 0; n < length; n++)
+	{
+		hash ^= bytes[n];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+/* @brief: Hash of the display, used to compare runs
+ * @arg chip:
+ * @return: Hash of gfx[] */
+uint64_t hash_gfx(const chip8_t* chip)
+{
+	return hash_bytes(chip->gfx, sizeof(chip->gfx));
+}
+
+/* @brief: Seed the RND generator. Every seed, including 0, gives a usable sequence
+ * @arg chip:
+ * @arg seed: */
+void chip8_seed(chip8_t* chip, uint64_t seed)
+{
+	// splitmix64 spreads similar seeds apart and only maps one input to the all-zero state, which
+	// xorshift can't leave
+	seed += 0x9E3779B97F4A7C15ULL;
+	seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+	seed ^= seed >> 31;
+	chip->rng_state = seed != 0 ? seed : 1;
+}
+
+void initialize_chip(chip8_t* chip)
+{
+	// Program counter begins @ 0x200
+	chip->pc = 0x200; 
+	// Reset opcode
+	chip->opcode = 0;
+	// Reset index register
+	chip->i = 0;
+	// Reset stack pointer
+	chip->sp = 0;
+	// Clear draw flag 
+	chip->draw_flag = false;
+	// Clear display
+	memset(chip->gfx, 0, sizeof(chip->gfx));	
+	// Clear stack
+	memset(chip->stack, 0, sizeof(chip->stack));	
+	// Clear registers V0 - VF 
+	memset(chip->v, 0, sizeof(chip->v));	
+	// Release all keys
+	chip->keys = 0;
+	chip->key_wait = 0;
+	// Clear memory 
+	memset(chip->memory, 0, sizeof(chip->memory));	
+
+	// Load fontset. Should be loaded into memory address 0x50
+	for(int i = 0; i < FONTSET_SIZE; ++i)
+	{
+		chip->memory[i + OFFSET_FONT] = chip8_fontset[i];	
+	}
+
+	// Reset timers
+	chip->delay_timer = 0;
+	chip->sound_timer = 0;
+	// Same RND sequence every run unless the caller seeds it
+	chip8_seed(chip, DEFAULT_SEED);
+	// No engine state until one is attached
+	chip->cache = NULL;
+	chip->jit = NULL;
+	chip->trace = NULL;
+	chip->profile = NULL;
+	chip->rom_hash = 0;
+	chip->dirty_pages = 0;
+	chip->dirty_rows = 0;
+	chip->unknown_pc = -1;
+	chip8_set_speed(chip, DEFAULT_IPS);
+	chip->cycles = 0;
+}
+
+/* @brief: Load a ROM image into a freshly initialized machine and remember its hash
+ * @arg chip:
+ * @arg rom: ROM contents
+ * @arg size: ROM size in bytes
+ * @return: 0 on success, -1 if the ROM is larger than program memory */
+int chip8_load_rom(chip8_t* chip, const uint8_t* rom, size_t size)
+{
+	if(size > SIZE_MEMORY - GAME_START_ADDRESS)
+	{
+		return -1;
+	}
+	memcpy(chip->memory + GAME_START_ADDRESS, rom, size);
+	chip->rom_hash = hash_bytes(rom, size);
+	return 0;
+}
+
+/* @brief: Set the speed chip8_run() emulates and start a new frame
+ * @arg chip:
+ * @arg ips: Instructions per second */
+void chip8_set_speed(chip8_t* chip, uint32_t ips)
+{
+	chip->ips = ips;
+	chip->frame_remainder = 0;
+	chip->frame_cycles_left = chip8_frame_cycles(ips, &chip->frame_remainder);
+}
+
+uint32_t chip8_frame_cycles(uint32_t ips, uint32_t* remainder)
+{
+	// ips * PERIOD_60HZ / USEC_PER_SEC is rarely a whole number (700 IPS = 11.67 per frame). 
+	// Carry the fraction forward so the long-run rate is exact
+	uint64_t budget = (uint64_t)ips * PERIOD_60HZ + *remainder;
+	*remainder = budget % USEC_PER_SEC;
+	return budget / USEC_PER_SEC;
+}
+
+void emulate_cycle(chip8_t* chip)
+{
+	// Felix: Fetch
+	// Fetch opcode from memory pointed to by PC
+	// Note: Each address has only 1 byte of an opcode, but opcodes are 2 bytes long. Fetch 2 successive bytes and merge them
+	// Skips and BNNN can take the PC past the end of memory, where fetches wrap around to 0
+	chip->opcode = (chip->memory[chip->pc & (SIZE_MEMORY - 1)] << 8) | chip->memory[(chip->pc + 1) & (SIZE_MEMORY - 1)];
+	LOG_TRACE("Fetched opcode 0x%04X at program counter 0x%03X", chip->opcode, chip->pc);
+	
+	// Felix: Decode & Execute
+	// The decode table already knows which handler runs this opcode and its operand fields
+	const decoded_opcode_t* op = &decode_table[chip->opcode];
+	op->handler(chip, op);
+}
+
+/* @brief: Classify an opcode. Only used to build the decode table, never in the hot loop
+ * @arg opcode: Any 16-bit value
+ * @return: Instruction class of the opcode, or OP_UNKNOWN */
+opcode_class_t decode_opcode(uint16_t opcode)
+{
+	// Look at the most significant nibble
+	switch(opcode & 0xF000)
+	{
+		case 0x0000:
+			switch(opcode & 0x000F)
+			{
+				// 0x00E0: Clear screen
+				case 0x0000:
+					return OP_00E0;
+				// 0x00EE: Return from subroutine
+				case 0x000E:
+					return OP_00EE;
+				default:
+					return OP_UNKNOWN;
+			}
+		// 0x1NNN (JP): Jump to subroutine @ NNN 
+		case 0x1000:
+			return OP_1NNN;
+		// 0x2NNN: Call subroutine @ NNN 
+		case 0x2000:
+			return OP_2NNN;
+		// 0x3XKK (SE): Skip next instruction if Vx = KK
+		case 0x3000:
+			return OP_3XKK;
+		// 0x4XKK (SNE): Skip next instruction if Vx != KK
+		case 0x4000:
+			return OP_4XKK;
+		// 0x5XY0 (SE): Skip next instruction if Vx = Vy
+		case 0x5000:
+			return OP_5XY0;
+		// 0x6XKK (LD): Places the value KK into register Vx
+		case 0x6000:
+			return OP_6XKK;
+		// 0x7XKK (ADD): Adds the value kk to the value of register Vx
+		case 0x7000:
+			return OP_7XKK;
+		case 0x8000:
+			switch(opcode & 0x000F)
+			{
+				// 0x8XY0 (LD): Stores the value of register Vy in register Vx
+				case 0x0000:
+					return OP_8XY0;
+				// 0x8XY1 (OR): OR operation with Vx and Vy. Result stored in Vx
+				case 0x0001:
+					return OP_8XY1;
+				// 0x8XY2 (AND): AND operation with Vx and Vy. Result stored in Vx
+				case 0x0002:
+					return OP_8XY2;
+				// 0x8XY3 (XOR): XOR operation with Vx and Vy. Result stored in Vx
+				case 0x0003:
+					return OP_8XY3;
+				// 0x8XY4 (ADD): Vx = Vx + Vy 
+				case 0x0004:
+					return OP_8XY4;
+				// 0x8XY5 (SUB): Vx = Vx - Vy 
+				case 0x0005:
+					return OP_8XY5;
+				// 0x8XY6 (SHR): If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2.
+				case 0x0006:
+					return OP_8XY6;
+				// 0x8XY7 (SUBN): If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
+				case 0x0007:
+					return OP_8XY7;
+				// 0x8XYE (SHL): If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2.
+				case 0x000E:
+					return OP_8XYE;
+				default:
+					return OP_UNKNOWN;
+			}
+		// 0x9XY0 (SNE): The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.
+		case 0x9000:
+			return OP_9XY0;
+		// 0xANNN (LD): The value of register I is set to NNN
+		case 0xA000:
+			return OP_ANNN;
+		// 0xBNNN (JMP): The program counter is set to nnn plus the value of V0
+		case 0xB000:
+			return OP_BNNN;
+		// 0xCXKK (RND): Set Vx = random byte AND kk. 
+		case 0xC000:
+			return OP_CXKK;
+		// 0xDXYN (DRW): Draw a sprite at coordinate (value @ Vx, value @ Vy) with a height of n pixels
+		case 0xD000:
+			return OP_DXYN;
+		case 0xE000:
+			switch(opcode & 0x00FF)
+			{
+				// 0xEX9E (SKP): Skip next instruction if key with the value of Vx is pressed
+				case 0x009E:
+					return OP_EX9E;
+				// 0xEXA1 (SKNP): Skip next instruction if key with the value of Vx is not pressed
+				case 0x00A1:
+					return OP_EXA1;
+				default:
+					return OP_UNKNOWN;
+			}
+		case 0xF000:
+			switch(opcode & 0x00FF)
+			{
+				// 0xFX07 (LD): The value of DT is placed into Vx.
+				case 0x0007:
+					return OP_FX07;
+				// 0xFX0A (LD): Wait for a key press, store the value of the key in Vx.
+				case 0x000A:
+					return OP_FX0A;
+				// 0xFX15 (LD): DT is set equal to the value of Vx.
+				case 0x0015:
+					return OP_FX15;
+				// 0xFX18 (LD): ST is set equal to the value of Vx.
+				case 0x0018:
+					return OP_FX18;
+				// 0xFX1E (ADD): The values of I and Vx are added, and the results are stored in I.
+				case 0x001E:
+					return OP_FX1E;
+				// 0xFX29 (LD): Set I = location of sprite for digit Vx.
+				case 0x0029:
+					return OP_FX29;
+				// 0xFX33 (LD): Store BCD representation of Vx in memory locations I, I+1, and I+2
+				case 0x0033:
+					return OP_FX33;
+				// 0xFX55 (LD): Store registers V0 through Vx in memory starting at location I.
+				case 0x0055:
+					return OP_FX55;
+				// 0xFX65 (LD): Read registers V0 through Vx from memory starting at location I.
+				case 0x0065:
+					return OP_FX65;
+				default:
+					return OP_UNKNOWN;
+			}
+	}
+
+	return OP_UNKNOWN;
+}
+
+/* @brief: Decode all 65,536 possible opcodes once at startup so emulate_cycle() is a single table lookup */
+void build_decode_table(void)
+{
+	for(uint32_t opcode = 0; opcode < SIZE_DECODE_TABLE; opcode++)
+	{
+		decoded_opcode_t* op = &decode_table[opcode];
+
+		op->op_class = decode_opcode(opcode);
+		op->handler = opcode_handlers[op->op_class];
+		op->opcode = opcode;
+		op->nnn = opcode & 0x0FFF;
+		op->x = (opcode & 0x0F00) >> 8;
+		op->y = (opcode & 0x00F0) >> 4;
+		op->n = opcode & 0x000F;
+		op->kk = opcode & 0x00FF;
+	}
+}
+
+static const decoded_opcode_t* fetch(const chip8_t* chip, uint16_t address)
+{
+	return &decode_table[(chip->memory[address & (SIZE_MEMORY - 1)] << 8) | chip->memory[(address + 1) & (SIZE_MEMORY - 1)]];
+}
+
+/* @brief: Length of the idle loop starting at head, if there is one. Recognised loops are
+ *   head: 1NNN to head                                  (spins for good)
+ *   head: EX9E/EXA1, 1NNN to head                       (spins until the key changes)
+ *   head: FX07, 3XKK/4XKK on the same Vx, 1NNN to head  (spins until the delay timer ticks)
+ * @arg chip:
+ * @arg head: Address of the loop's first instruction
+ * @return: Loop length in instructions, 0 if head doesn't start one */
+static uint32_t idle_loop_length(const chip8_t* chip, uint32_t head)
+{
+	const decoded_opcode_t* first;
+	const decoded_opcode_t* second;
+
+	if(head + 1 >= SIZE_MEMORY)
+	{
+		return 0;
+	}
+	first = fetch(chip, head);
+	if(first->op_class == OP_1NNN)
+	{
+		return first->nnn == head ? 1 : 0;
+	}
+	if(head + 3 >= SIZE_MEMORY)
+	{
+		return 0;
+	}
+	second = fetch(chip, head + 2);
+	if(first->op_class == OP_EX9E || first->op_class == OP_EXA1)
+	{
+		return second->op_class == OP_1NNN && second->nnn == head ? 2 : 0;
+	}
+	if(first->op_class == OP_FX07 && head + 5 < SIZE_MEMORY &&
+		(second->op_class == OP_3XKK || second->op_class == OP_4XKK) && second->x == first->x)
+	{
+		const decoded_opcode_t* third = fetch(chip, head + 4);
+		return third->op_class == OP_1NNN && third->nnn == head ? 3 : 0;
+	}
+	return 0;
+}
+
+/* @brief: Whether the skip in an idle loop would be taken, ending the loop
+ * @arg skip: The loop's EX9E/EXA1/3XKK/4XKK
+ * @arg value: Vx as the skip would see it */
+static bool idle_loop_exits(const chip8_t* chip, const decoded_opcode_t* skip, uint8_t value)
+{
+	switch(skip->op_class)
+	{
+		case OP_EX9E:
+			return (chip->keys >> (value & 0xF)) & 1;
+		case OP_EXA1:
+			return !((chip->keys >> (value & 0xF)) & 1);
+		case OP_3XKK:
+			return value == skip->kk;
+		case OP_4XKK:
+			return value != skip->kk;
+		default:
+			return false;
+	}
+}
+
+/* @brief: Find the idle loop the machine is spinning in. The PC can be anywhere in it, as long as
+ * nothing on the way back to the head leaves the loop and the loop won't exit on the next pass with
+ * the timers and keys as they are now. Until one of those changes, every pass leaves the machine
+ * exactly as it was
+ * @arg chip:
+ * @arg head: Set to the address of the loop's first instruction
+ * @arg lead: Set to the instructions executed before the PC is back at head
+ * @return: Loop length in instructions, 0 if the machine isn't idle */
+static uint32_t find_idle_loop(const chip8_t* chip, uint16_t* head, uint32_t* lead)
+{
+	for(uint32_t position = 0; position < 3 && position * 2 <= chip->pc; position++)
+	{
+		uint32_t start = chip->pc - position * 2;
+		uint32_t length = idle_loop_length(chip, start);
+		const decoded_opcode_t* skip;
+
+		if(length <= position)
+		{
+			continue;
+		}
+		*head = start;
+		*lead = position == 0 ? 0 : length - position;
+		if(length == 1)
+		{
+			return length;
+		}
+		skip = fetch(chip, start + (length - 2) * 2);
+		// A PC sitting on the timer loop's skip still tests the value loaded before the last tick
+		if(length == 3 && position == 1 && idle_loop_exits(chip, skip, chip->v[skip->x]))
+		{
+			return 0;
+		}
+		return idle_loop_exits(chip, skip, length == 3 ? chip->delay_timer : chip->v[skip->x]) ? 0 : length;
+	}
+	return 0;
+}
+
+bool in_idle_loop(const chip8_t* chip)
+{
+	uint16_t head;
+	uint32_t lead;
+
+	return find_idle_loop(chip, &head, &lead) != 0;
+}
+
+/* @brief: Fast-forward through instructions spent in an idle loop. The registers, PC and opcode end
+ * up exactly where executing them would have left them
+ * @arg chip:
+ * @arg cycles: Instructions to account for
+ * @return: true if all of them were skipped, false if the machine isn't idle and they must be run */
+static bool skip_idle_loop(chip8_t* chip, uint32_t cycles)
+{
+	uint16_t head;
+	uint32_t lead;
+	uint32_t length = find_idle_loop(chip, &head, &lead);
+	uint32_t passed;
+
+	if(length == 0 || cycles <= lead)
+	{
+		return false;
+	}
+	passed = cycles - lead;
+	// The timer loop's FX07 has run at least once by the time the PC is back at head
+	if(length == 3)
+	{
+		chip->v[fetch(chip, head)->x] = chip->delay_timer;
+	}
+	chip->opcode = fetch(chip, head + (passed - 1) % length * 2)->opcode;
+	chip->pc = head + passed % length * 2;
+	return true;
+}
+
+/* @brief: Account for instructions run (or skipped) by chip8_run()
+ * @arg chip:
+ * @arg cycles:
+ * @arg max_cycles: Budget left in the call, reduced by cycles */
+static void spend_cycles(chip8_t* chip, uint32_t cycles, uint64_t* max_cycles)
+{
+	chip->frame_cycles_left -= cycles;
+	chip->cycles += cycles;
+	*max_cycles -= cycles;
+}
+
+/* @brief: Embedding entry point. Runs instructions through the decode table in one tight loop, 
+ * checking after each one whether the host needs control back. Frames are counted against 
+ * chip->ips, and the timers tick whenever one completes. A machine parked in FX0A or spinning in an 
+ * idle loop has the rest of its frame skipped rather than run, so a single call can cover millions 
+ * of cycles
+ * @arg chip:
+ * @arg max_cycles: Most instructions to account for in this call
+ * @return: Why it stopped. chip->cycles counts the instructions accounted for */
+chip8_stop_t chip8_run(chip8_t* chip, uint64_t max_cycles)
+{
+	const decoded_opcode_t* op;
+	uint16_t pc;
+	uint32_t slice;
+
+	for(;;)
+	{
+		if(chip->frame_cycles_left == 0)
+		{
+			// Timers count down at 60Hz regardless of CPU speed
+			handle_delay_timer(chip);
+			handle_sound_timer(chip);
+			chip->frame_cycles_left = chip8_frame_cycles(chip->ips, &chip->frame_remainder);
+			return CHIP8_STOP_FRAME;
+		}
+		if(max_cycles == 0)
+		{
+			return CHIP8_STOP_BUDGET;
+		}
+		slice = max_cycles < chip->frame_cycles_left ? max_cycles : chip->frame_cycles_left;
+
+		// Until a key or timer changes, every instruction left in the frame would be FX0A finding 
+		// nothing new or another trip round the idle loop
+		if((fetch(chip, chip->pc)->op_class == OP_FX0A && key_wait_idle(chip)) || skip_idle_loop(chip, slice))
+		{
+			spend_cycles(chip, slice, &max_cycles);
+			continue;
+		}
+		for(uint32_t ran = 1; ran <= slice; ran++)
+		{
+			pc = chip->pc;
+			chip->opcode = (chip->memory[pc & (SIZE_MEMORY - 1)] << 8) | chip->memory[(pc + 1) & (SIZE_MEMORY - 1)];
+			op = &decode_table[chip->opcode];
+			op->handler(chip, op);
+			if(op->op_class == OP_DXYN || op->op_class == OP_00E0)
+			{
+				spend_cycles(chip, ran, &max_cycles);
+				return CHIP8_STOP_DRAW;
+			}
+			// FX0A only stays put while nothing has changed
+			if(op->op_class == OP_FX0A && chip->pc == pc)
+			{
+				spend_cycles(chip, ran, &max_cycles);
+				return CHIP8_STOP_KEY_WAIT;
+			}
+		}
+		spend_cycles(chip, slice, &max_cycles);
+	}
+}
+
+/* @brief: Execute exactly the given number of instructions with the selected engine
+ * @arg chip:
+ * @arg engine: ENGINE_BLOCK requires chip->cache, ENGINE_JIT requires chip->jit
+ * @arg cycles: Instructions to execute */
+void run_cycles(chip8_t* chip, engine_t engine, uint32_t cycles)
+{
+	// Traces and profiles record every instruction. Other engines skip loops that can't end this frame
+	if(engine != ENGINE_TRACE && engine != ENGINE_PROFILE && skip_idle_loop(chip, cycles))
+	{
+		return;
+	}
+	if(engine == ENGINE_STEP)
+	{
+		for(uint32_t cycle = 0; cycle < cycles; cycle++)
+		{
+			emulate_cycle(chip);
+		}
+		return;
+	}
+	if(engine == ENGINE_JIT)
+	{
+		jit_run(chip, cycles);
+		return;
+	}
+	if(engine == ENGINE_THREADED)
+	{
+		run_threaded(chip, cycles);
+		return;
+	}
+	if(engine == ENGINE_TRACE)
+	{
+		run_traced(chip, cycles);
+		return;
+	}
+	if(engine == ENGINE_PROFILE)
+	{
+		run_profiled(chip, cycles);
+		return;
+	}
+
+	while(cycles > 0)
+	{
+		code_block_t* block = NULL;
+
+		// Only program memory is cached. Anything else falls back to the stepping interpreter
+		if(chip->pc >= GAME_START_ADDRESS && chip->pc < SIZE_MEMORY - 1)
+		{
+			block = chip->cache->blocks[chip->pc];
+			if(block == NULL)
+			{
+				block = build_block(chip, chip->pc);
+			}
+		}
+
+		if(block == NULL)
+		{
+			emulate_cycle(chip);
+			cycles--;
+			continue;
+		}
+
+		// A block may be cut short by the cycle budget. Only its last instruction can change 
+		// control flow or write memory, so the block can't be freed or modified while it runs
+		uint32_t count = block->length < cycles ? block->length : cycles;
+		for(uint32_t k = 0; k < count; k++)
+		{
+			const decoded_opcode_t* op = block->ops[k];
+			chip->opcode = op->opcode;
+			LOG_TRACE("Fetched opcode 0x%04X at program counter 0x%03X", chip->opcode, chip->pc);
+			op->handler(chip, op);
+		}
+		cycles -= count;
+	}
+}
+
+#if defined(__GNUC__)
+/* @brief: Threaded interpreter. Every handler is inlined into this one function (flatten) and ends 
+ * in its own indirect jump to the next handler, so the branch predictor sees one jump per opcode 
+ * class instead of a single shared dispatch point
+ * @arg chip:
+ * @arg cycles: Instructions to execute */
+__attribute__((flatten)) void run_threaded(chip8_t* chip, uint32_t cycles)
+{
+	static const void* const labels[NUM_OPCODE_CLASSES] =
+	{
+		[OP_UNKNOWN] = &&op_UNKNOWN,
+		[OP_00E0] = &&op_00E0,
+		[OP_00EE] = &&op_00EE,
+		[OP_1NNN] = &&op_1NNN,
+		[OP_2NNN] = &&op_2NNN,
+		[OP_3XKK] = &&op_3XKK,
+		[OP_4XKK] = &&op_4XKK,
+		[OP_5XY0] = &&op_5XY0,
+		[OP_6XKK] = &&op_6XKK,
+		[OP_7XKK] = &&op_7XKK,
+		[OP_8XY0] = &&op_8XY0,
+		[OP_8XY1] = &&op_8XY1,
+		[OP_8XY2] = &&op_8XY2,
+		[OP_8XY3] = &&op_8XY3,
+		[OP_8XY4] = &&op_8XY4,
+		[OP_8XY5] = &&op_8XY5,
+		[OP_8XY6] = &&op_8XY6,
+		[OP_8XY7] = &&op_8XY7,
+		[OP_8XYE] = &&op_8XYE,
+		[OP_9XY0] = &&op_9XY0,
+		[OP_ANNN] = &&op_ANNN,
+		[OP_BNNN] = &&op_BNNN,
+		[OP_CXKK] = &&op_CXKK,
+		[OP_DXYN] = &&op_DXYN,
+		[OP_EX9E] = &&op_EX9E,
+		[OP_EXA1] = &&op_EXA1,
+		[OP_FX07] = &&op_FX07,
+		[OP_FX0A] = &&op_FX0A,
+		[OP_FX15] = &&op_FX15,
+		[OP_FX18] = &&op_FX18,
+		[OP_FX1E] = &&op_FX1E,
+		[OP_FX29] = &&op_FX29,
+		[OP_FX33] = &&op_FX33,
+		[OP_FX55] = &&op_FX55,
+		[OP_FX65] = &&op_FX65,
+	};
+	const decoded_opcode_t* op;
+
+	// Fetch, decode and jump straight to the next handler
+#define DISPATCH() \
+	do \
+	{ \
+		if(cycles-- == 0) \
+		{ \
+			return; \
+		} \
+		chip->opcode = (chip->memory[chip->pc & (SIZE_MEMORY - 1)] << 8) | chip->memory[(chip->pc + 1) & (SIZE_MEMORY - 1)]; \
+		LOG_TRACE("Fetched opcode 0x%04X at program counter 0x%03X", chip->opcode, chip->pc); \
+		op = &decode_table[chip->opcode]; \
+		goto *labels[op->op_class]; \
+	} while(0)
+
+	DISPATCH();
+
+op_UNKNOWN:
+	execute_opcode_unknown(chip, op);
+	DISPATCH();
+op_00E0:
+	execute_opcode_0x00E0(chip, op);
+	DISPATCH();
+op_00EE:
+	execute_opcode_0x00EE(chip, op);
+	DISPATCH();
+op_1NNN:
+	execute_opcode_0x1NNN(chip, op);
+	DISPATCH();
+op_2NNN:
+	execute_opcode_0x2NNN(chip, op);
+	DISPATCH();
+op_3XKK:
+	execute_opcode_0x3XKK(chip, op);
+	DISPATCH();
+op_4XKK:
+	execute_opcode_0x4XKK(chip, op);
+	DISPATCH();
+op_5XY0:
+	execute_opcode_0x5XY0(chip, op);
+	DISPATCH();
+op_6XKK:
+	execute_opcode_0x6XKK(chip, op);
+	DISPATCH();
+op_7XKK:
+	execute_opcode_0x7XKK(chip, op);
+	DISPATCH();
+op_8XY0:
+	execute_opcode_0x8XY0(chip, op);
+	DISPATCH();
+op_8XY1:
+	execute_opcode_0x8XY1(chip, op);
+	DISPATCH();
+op_8XY2:
+	execute_opcode_0x8XY2(chip, op);
+	DISPATCH();
+op_8XY3:
+	execute_opcode_0x8XY3(chip, op);
+	DISPATCH();
+op_8XY4:
+	execute_opcode_0x8XY4(chip, op);
+	DISPATCH();
+op_8XY5:
+	execute_opcode_0x8XY5(chip, op);
+	DISPATCH();
+op_8XY6:
+	execute_opcode_0x8XY6(chip, op);
+	DISPATCH();
+op_8XY7:
+	execute_opcode_0x8XY7(chip, op);
+	DISPATCH();
+op_8XYE:
+	execute_opcode_0x8XYE(chip, op);
+	DISPATCH();
+op_9XY0:
+	execute_opcode_0x9XY0(chip, op);
+	DISPATCH();
+op_ANNN:
+	execute_opcode_0xANNN(chip, op);
+	DISPATCH();
+op_BNNN:
+	execute_opcode_0xBNNN(chip, op);
+	DISPATCH();
+op_CXKK:
+	execute_opcode_0xCXKK(chip, op);
+	DISPATCH();
+op_DXYN:
+	execute_opcode_0xDXYN(chip, op);
+	DISPATCH();
+op_EX9E:
+	execute_opcode_0xEX9E(chip, op);
+	DISPATCH();
+op_EXA1:
+	execute_opcode_0xEXA1(chip, op);
+	DISPATCH();
+op_FX07:
+	execute_opcode_0xFX07(chip, op);
+	DISPATCH();
+op_FX0A:
+	execute_opcode_0xFX0A(chip, op);
+	DISPATCH();
+op_FX15:
+	execute_opcode_0xFX15(chip, op);
+	DISPATCH();
+op_FX18:
+	execute_opcode_0xFX18(chip, op);
+	DISPATCH();
+op_FX1E:
+	execute_opcode_0xFX1E(chip, op);
+	DISPATCH();
+op_FX29:
+	execute_opcode_0xFX29(chip, op);
+	DISPATCH();
+op_FX33:
+	execute_opcode_0xFX33(chip, op);
+	DISPATCH();
+op_FX55:
+	execute_opcode_0xFX55(chip, op);
+	DISPATCH();
+op_FX65:
+	execute_opcode_0xFX65(chip, op);
+	DISPATCH();
+#undef DISPATCH
+}
+#else
+// Computed goto is a GCC/Clang extension. Other compilers get the stepping interpreter
+void run_threaded(chip8_t* chip, uint32_t cycles)
+{
+	run_cycles(chip, ENGINE_STEP, cycles);
+}
+#endif
+
+/* @brief: Stepping interpreter that records every instruction to chip->trace. Kept apart from the 
+ * other engines so they pay nothing for tracing
+ * @arg chip: chip->trace must be open
+ * @arg cycles: Instructions to execute */
+void run_traced(chip8_t* chip, uint32_t cycles)
+{
+	trace_writer_t* trace = chip->trace;
+	trace_record_t record;
+	uint8_t v[NUM_GENERAL_PURPOSE_REGISTERS];
+
+	for(uint32_t cycle = 0; cycle < cycles; cycle++)
+	{
+		uint16_t i = chip->i;
+		uint8_t delay_timer = chip->delay_timer;
+		uint8_t sound_timer = chip->sound_timer;
+
+		memcpy(v, chip->v, sizeof(v));
+		record.cycle = trace->cycle++;
+		record.pc = chip->pc;
+		chip->opcode = (chip->memory[chip->pc & (SIZE_MEMORY - 1)] << 8) | chip->memory[(chip->pc + 1) & (SIZE_MEMORY - 1)];
+		record.opcode = chip->opcode;
+
+		const decoded_opcode_t* op = &decode_table[chip->opcode];
+		op->handler(chip, op);
+
+		record.v_mask = 0;
+		record.flags = 0;
+		for(uint8_t n = 0; n < NUM_GENERAL_PURPOSE_REGISTERS; n++)
+		{
+			if(chip->v[n] != v[n])
+			{
+				record.v_mask |= 1 << n;
+				record.v[n] = chip->v[n];
+			}
+		}
+		if(chip->i != i)
+		{
+			record.flags |= TRACE_I;
+			record.i = chip->i;
+		}
+		if(chip->delay_timer != delay_timer)
+		{
+			record.flags |= TRACE_DELAY_TIMER;
+			record.delay_timer = chip->delay_timer;
+		}
+		if(chip->sound_timer != sound_timer)
+		{
+			record.flags |= TRACE_SOUND_TIMER;
+			record.sound_timer = chip->sound_timer;
+		}
+		// FX33 and FX55 are the only instructions that store to memory, always starting at I
+		if(op->op_class == OP_FX33 || op->op_class == OP_FX55)
+		{
+			record.flags |= TRACE_MEMORY;
+			// Where the handler actually stored, see execute_opcode_0xFX33()
+			record.write_address = i & (SIZE_MEMORY - 1);
+			record.write_length = op->op_class == OP_FX33 ? 3 : op->x + 1;
+			for(uint8_t n = 0; n < record.write_length; n++)
+			{
+				record.write[n] = chip->memory[(i + n) & (SIZE_MEMORY - 1)];
+			}
+		}
+		trace_write(trace, &record);
+	}
+}
+
+/* @brief: Stepping interpreter that counts every instruction in chip->profile. Like run_traced(), 
+ * kept apart so the other engines pay nothing for profiling
+ * @arg chip: chip->profile must be open
+ * @arg cycles: Instructions to execute */
+void run_profiled(chip8_t* chip, uint32_t cycles)
+{
+	profile_t* profile = chip->profile;
+
+	for(uint32_t cycle = 0; cycle < cycles; cycle++)
+	{
+		chip->opcode = (chip->memory[chip->pc & (SIZE_MEMORY - 1)] << 8) | chip->memory[(chip->pc + 1) & (SIZE_MEMORY - 1)];
+		const decoded_opcode_t* op = &decode_table[chip->opcode];
+
+		profile_count(profile, chip->pc, op->op_class);
+		op->handler(chip, op);
+		// Following the guest's own calls and returns gives the call path each instruction runs in
+		if(op->op_class == OP_2NNN)
+		{
+			profile_call(profile, op->nnn);
+		}
+		else if(op->op_class == OP_00EE)
+		{
+			profile_return(profile);
+		}
+	}
+}
+
+block_cache_t* create_block_cache(void)
+{
+	// calloc leaves every entry NULL, i.e. nothing decoded yet
+	return calloc(1, sizeof(block_cache_t));
+}
+
+void destroy_block_cache(block_cache_t* cache)
+{
+	for(uint32_t address = 0; address < SIZE_MEMORY; address++)
+	{
+		free(cache->blocks[address]);
+	}
+	free(cache);
+}
+
+/* @brief: Whether an instruction must be the last one in a block
+ * Control flow (jumps, skips, calls, returns), FX0A (may not advance PC), unknown opcodes (never 
+ * advance PC) and memory writes (may rewrite the instructions that follow) all end a block
+ * @arg op_class: Decoded instruction class
+ * @return: true if the block ends here */
+bool ends_block(opcode_class_t op_class)
+{
+	switch(op_class)
+	{
+		case OP_00EE:
+		case OP_1NNN:
+		case OP_2NNN:
+		case OP_3XKK:
+		case OP_4XKK:
+		case OP_5XY0:
+		case OP_9XY0:
+		case OP_BNNN:
+		case OP_EX9E:
+		case OP_EXA1:
+		case OP_FX0A:
+		case OP_FX33:
+		case OP_FX55:
+		case OP_UNKNOWN:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* @brief: Predecode the basic block starting at an address and add it to the cache
+ * @arg chip: chip->cache receives the block
+ * @arg start: Address of the first instruction. Must be in program memory
+ * @return: The new block */
+code_block_t* build_block(chip8_t* chip, uint16_t start)
+{
+	code_block_t* block = malloc(sizeof(code_block_t));
+	uint16_t address = start;
+
+	block->start = start;
+	block->length = 0;
+
+	// Stop at a terminator, at the length limit, or when the next opcode would run off the end of memory
+	while(block->length < MAX_BLOCK_LENGTH && address < SIZE_MEMORY - 1)
+	{
+		uint16_t opcode = (chip->memory[address] << 8) | chip->memory[address + 1];
+		const decoded_opcode_t* op = &decode_table[opcode];
+
+		block->ops[block->length++] = op;
+		chip->cache->code_map[address] = true;
+		chip->cache->code_map[address + 1] = true;
+		address += 2;
+		if(ends_block(op->op_class))
+		{
+			break;
+		}
+	}
+
+	chip->cache->blocks[start] = block;
+	return block;
+}
+
+/* @brief: Whether any cached block was decoded from the written bytes. Most writes are to data, which 
+ * this answers without scanning the blocks that could start before the write
+ * @arg cache:
+ * @arg address: First byte written
+ * @arg length: Number of bytes written, not past the end of memory */
+static bool covers_code(const block_cache_t* cache, uint16_t address, uint16_t length)
+{
+	for(uint32_t byte = address; byte < (uint32_t)address + length; byte++)
+	{
+		if(cache->code_map[byte])
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/* @brief: Called after every write to memory. Marks the pages dirty and drops every cached block or 
+ * translation that overlaps the written bytes
+ * @arg chip:
+ * @arg address: First byte written, below SIZE_MEMORY. Writes that run off the end wrap to 0
+ * @arg length: Number of bytes written */
+void invalidate_code(chip8_t* chip, uint16_t address, uint16_t length)
+{
+	uint32_t first_page;
+	uint32_t last_page;
+
+	// A write that runs off the end of memory carries on at 0
+	if((uint32_t)address + length > SIZE_MEMORY)
+	{
+		invalidate_code(chip, 0, address + length - SIZE_MEMORY);
+		length = SIZE_MEMORY - address;
+	}
+	first_page = address / DIRTY_PAGE_SIZE;
+	last_page = (address + length - 1) / DIRTY_PAGE_SIZE;
+
+	// Pages past the end of memory don't exist
+	if(last_page >= SIZE_MEMORY / DIRTY_PAGE_SIZE)
+	{
+		last_page = SIZE_MEMORY / DIRTY_PAGE_SIZE - 1;
+	}
+	for(uint32_t page = first_page; page <= last_page; page++)
+	{
+		chip->dirty_pages |= 1ULL << page;
+	}
+
+	if(chip->jit != NULL)
+	{
+		jit_invalidate(chip->jit, address, length);
+	}
+	if(chip->cache == NULL || !covers_code(chip->cache, address, length))
+	{
+		return;
+	}
+
+	// A block covering the write must start at most (MAX_BLOCK_LENGTH * 2 - 1) bytes before it
+	int32_t first = (int32_t)address - (MAX_BLOCK_LENGTH * 2 - 1);
+	int32_t last = (int32_t)address + length - 1;
+
+	if(first < 0)
+	{
+		first = 0;
+	}
+	if(last >= SIZE_MEMORY)
+	{
+		last = SIZE_MEMORY - 1;
+	}
+
+	for(int32_t start = first; start <= last; start++)
+	{
+		code_block_t* block = chip->cache->blocks[start];
+		if(block != NULL && start + block->length * 2 > address)
+		{
+			free(block);
+			chip->cache->blocks[start] = NULL;
+		}
+	}
+}
+
+/* @brief: Whether FX0A, run now, would change nothing. True until a key goes down or a key seen down
+ * goes up, so a machine sitting on FX0A can sleep until the keys change
+ * @arg chip:
+ * @return: true if every key seen by the wait is still in the same state */
+bool key_wait_idle(const chip8_t* chip)
+{
+	return chip->key_wait == chip->keys;
+}
+
+void handle_delay_timer(chip8_t* chip)
+{
+	if(chip->delay_timer == 0)
+	{
+		return;
+	}
+	--chip->delay_timer;
+}
+
+void handle_sound_timer(chip8_t* chip)
+{
+	// The front end plays the buzzer while this is above zero
+	if(chip->sound_timer == 0)
+	{
+		return;
+	}
+	--chip->sound_timer;
+}
+
+// Trap for opcodes the CHIP-8 doesn't define. The PC is left alone, so the machine stays parked here
+void execute_opcode_unknown(chip8_t* chip, const decoded_opcode_t* op)
+{
+	// It runs again every cycle, so only say so once
+	if(chip->unknown_pc != chip->pc)
+	{
+		LOG_WARN("Unknown opcode: 0x%04X at 0x%03X", op->opcode, chip->pc);
+		chip->unknown_pc = chip->pc;
+	}
+}
+
+// 0x0000 (CLS): Clear screen
+void execute_opcode_0x00E0(chip8_t* chip, const decoded_opcode_t* op)
+{
+	memset(chip->gfx, 0, sizeof(chip->gfx));
+	chip->dirty_rows = UINT32_MAX;
+	chip->pc += 2;
+}
+
+//Felix
+// 0x00EE (RET): Return from subroutine. The interpreter sets the program counter to the address at the top of the stack, 
+// then subtracts 1 from the stack pointer.
+void execute_opcode_0x00EE(chip8_t* chip, const decoded_opcode_t* op)
+{
+	// The stack pointer wraps rather than under- or overflowing the stack
+	chip->sp = (chip->sp - 1) & (SIZE_STACK - 1);
+	chip->pc = chip->stack[chip->sp];
+	chip->pc += 2;
+}
+
+// 0x1NNN (JP): Jump to subroutine @ NNN 
+// Note: Unlike CALL, this only changes PC without updating the stack
+void execute_opcode_0x1NNN(chip8_t* chip, const decoded_opcode_t* op)
+{
+	chip->pc = op->nnn;
+}
+
+// Felix: 
+// 0x2NNN (CALL): Call subroutine @ NNN 
+// Place current address of PC on stack, jump to subroutine, increment SP, and update PC
+void execute_opcode_0x2NNN(chip8_t* chip, const decoded_opcode_t* op)
+{
+	chip->stack[chip->sp] = chip->pc;
+	chip->sp = (chip->sp + 1) & (SIZE_STACK - 1);
+	chip->pc = op->nnn;
+}
+
+// 0x3XKK (SE): Skip next instruction if Vx = KK
+void execute_opcode_0x3XKK(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t vx = chip->v[op->x];
+	uint8_t byte = op->kk;
+
+	if(vx == byte)
+	{
+		chip->pc += 2;
+	}
+	chip->pc += 2;
+}
+
+// 0x4XKK (SNE): Skip next instruction if Vx != KK
+void execute_opcode_0x4XKK(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t vx = chip->v[op->x];
+	uint8_t byte = op->kk;
+
+	if(vx != byte)
+	{
+		chip->pc += 2;
+	}
+	chip->pc += 2;
+}
+
+// 0x5XY0 (SE): Skip next instruction if Vx = Vy
+void execute_opcode_0x5XY0(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t vx = chip->v[op->x];
+	uint8_t vy = chip->v[op->y];
+	if(vx == vy)
+	{
+		chip->pc += 2;
+	}
+	chip->pc += 2;
+}
+
+// 0x6XKK (LD): Places the value KK into register Vx
+void execute_opcode_0x6XKK(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t byte = op->kk;
+	chip->v[op->x] = byte;
+	chip->pc += 2;
+}
+
+// 0x7XKK (ADD): Adds the value kk to the value of register Vx, then stores the result in Vx. (Vx = Vx + kk)
+void execute_opcode_0x7XKK(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t byte = op->kk;
+	chip->v[op->x] += byte;
+	chip->pc += 2;
+}
+
+// 0x8XY0 (LD): Stores the value of register Vy in register Vx (Vx = Vy)
+void execute_opcode_0x8XY0(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+	uint8_t vy = chip->v[op->y];
+
+	// Load Vy into Vx 
+	chip->v[x] = vy;
+	chip->pc += 2;
+}
+
+// 0x8XY1 (OR): OR operation with Vx and Vy. Result stored in Vx (Vx = Vx OR Vy)
+void execute_opcode_0x8XY1(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+	uint8_t vx = chip->v[x];
+	uint8_t vy = chip->v[op->y];
+
+	// Perform OR operation and store in Vx
+	chip->v[x] = vx|vy;
+	// VF must be set to 0, or game quirks may occur 
+	chip->v[0xF] = 0;
+	chip->pc += 2;
+}
+
+// 0x8XY2 (AND): AND operation with Vx and Vy. Result stored in Vx (Vx = Vx AND Vy)
+void execute_opcode_0x8XY2(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+	uint8_t vx = chip->v[x];
+	uint8_t vy = chip->v[op->y];
+
+	// Perform AND operation and store in Vx
+	chip->v[x] = vx&vy;
+	// VF must be set to 0, or game quirks may occur 
+	chip->v[0xF] = 0;
+	chip->pc += 2;
+}
+
+// 0x8XY3 (XOR): XOR operation with Vx and Vy. Result stored in Vx (Vx = Vx XOR Vy)
+void execute_opcode_0x8XY3(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+	uint8_t vx = chip->v[x];
+	uint8_t vy = chip->v[op->y];
+
+	// Perform XOR operation and store in Vx
+	chip->v[x] = vx^vy;
+	// VF must be set to 0, or game quirks may occur 
+	chip->v[0xF] = 0;
+	chip->pc += 2;
+}
+
+// 0x8XY4 (ADD): Add Vy to Vx. If sum is greater than 255, VF is set 1 (0 otherwise). Sum stored in Vx 
+void execute_opcode_0x8XY4(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+	uint8_t vx = chip->v[x];
+	uint8_t y = op->y;
+	uint8_t vy = chip->v[y];
+	uint16_t sum = vx + vy;
+
+	// Perform mathemtical operation first, THEN set value v[0xF]
+	chip->v[x] = sum & 0xFF;
+
+	// Check if sum is greater than 255
+	if(sum > 255) 
+	{
+		chip->v[0xF] = 1;	
+	} 
+	else
+	{
+		chip->v[0xF] = 0;	
+	}
+
+	chip->pc += 2;
+}
+
+// 0x8XY5 (SUB): If Vx >= Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx.
+// Set Vx = Vx - Vy, set VF = NOT borrow.
+void execute_opcode_0x8XY5(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+	uint8_t vx = chip->v[x];
+	uint8_t y = op->y;
+	uint8_t vy = chip->v[y];
+
+	chip->v[x] = vx - vy;
+
+	// Check if Vx is greater than Vy
+	if(vx >= vy) 
+	{
+		chip->v[0xF] = 1;	
+	} 
+	else
+	{
+		chip->v[0xF] = 0;	
+	}
+
+	chip->pc += 2;
+}
+
+// 0x8XY6 (SHR): If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2.
+void execute_opcode_0x8XY6(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+	uint8_t vx = chip->v[x];
+
+	// Divide Vx by 2
+	chip->v[x] /= 2;
+
+	// Set VF if appropriate 
+	chip->v[0xF] = (vx & 0x1) ? 1 : 0;
+	chip->pc += 2;
+}
+
+// 0x8XY7 (SUBN): If Vy >= Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
+// Set Vx = Vy - Vx, set VF = NOT borrow.
+void execute_opcode_0x8XY7(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+	uint8_t vx = chip->v[x];
+	uint8_t vy = chip->v[op->y];
+
+	// Subtract Vy from Vx
+	chip->v[x] = vy - vx;
+
+	// Set VF if appropriate 
+	chip->v[0xF] = (vy >= vx) ? 1 : 0;
+	chip->pc += 2;
+}
+
+// 0x8XYE (SHL): If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2.
+// Set Vx = Vx SHL 1.
+void execute_opcode_0x8XYE(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+	uint8_t vx = chip->v[x];
+
+	// Multiply Vx by 2 by shifting left
+	chip->v[x] <<= 1;
+
+	// Set VF if MSB is set
+	chip->v[0xF] = (vx & 0x80) >> 7;
+	chip->pc += 2;
+}
+
+// 0x9XY0 (SNE): The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.
+// Skip next instruction if Vx != Vy.
+void execute_opcode_0x9XY0(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t vx = chip->v[op->x];
+	uint8_t vy = chip->v[op->y];
+
+	// Skip next instruction if Vx and Vy are not equal
+	if(vx != vy)
+	{
+		chip->pc += 2;
+	}
+	chip->pc += 2;
+}
+
+// 0xANNN (LD): The value of register I is set to NNN
+// Set I = nnn.
+void execute_opcode_0xANNN(chip8_t* chip, const decoded_opcode_t* op)
+{
+	chip->i = op->nnn;
+	chip->pc += 2;
+}
+
+// 0xBNNN (JP): The program counter is set to nnn plus the value of V0
+// Jump to location nnn + V0
+void execute_opcode_0xBNNN(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint16_t nibbles = op->nnn;
+	chip->pc = nibbles + chip->v[0];
+}
+
+// 0xCXKK (RND): The interpreter generates a random number from 0 to 255, which is then ANDed with the value kk. The results are stored in Vx. 
+// Set Vx = random byte AND kk.
+void execute_opcode_0xCXKK(chip8_t* chip, const decoded_opcode_t* op)
+{
+	// xorshift64*. The top byte of the product is the best mixed
+	chip->rng_state ^= chip->rng_state >> 12;
+	chip->rng_state ^= chip->rng_state << 25;
+	chip->rng_state ^= chip->rng_state >> 27;
+	uint8_t random = (chip->rng_state * 0x2545F4914F6CDD1DULL) >> 56;
+	uint8_t byte = op->kk;	
+	uint8_t x = op->x;
+
+	// AND random number w/ kk
+	chip->v[x] = random & byte;
+	chip->pc += 2;
+}
+
+// 0xDXYN (DRW): Draw a sprite at coordinate (value @ Vx, value @ Vy) with a height of n pixels (rows). Width locked at 8 pixels. 
+// Each row of 8 pixels read as bit coded starting from memory location I 
+// This function does not change value of I. Current state of pixel XOR'd with current value in memory. 
+// If pixels changed from 1 to 0, VF = 1 (collision detection)
+// In other words, set VF if a new sprite collides with what's already on screen
+void execute_opcode_0xDXYN(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t height = op->n;	
+
+	uint64_t sprite_row;
+	// Wrap around if attempting to draw off-screen per specification. Only the starting position 
+	// wraps, the sprite itself is clipped at the right and bottom edges
+	uint8_t x_coor = chip->v[op->x] % GFX_XAXIS;
+	uint8_t y_coor = chip->v[op->y] % GFX_YAXIS;
+
+	// Reset VF
+	chip->v[0xF] = 0;
+
+	// Rows past the bottom of the screen are clipped
+	if(height > GFX_YAXIS - y_coor)
+	{
+		height = GFX_YAXIS - y_coor;
+	}
+	chip->dirty_rows |= (uint32_t)(((1ULL << height) - 1) << y_coor);
+
+	// Loop over each row
+	for(uint8_t row = 0; row < height; row++)
+	{
+		// Line up the 8 sprite pixels with the screen row (bit 63 is x = 0). Pixels shifted out 
+		// past x = 63 are clipped
+		sprite_row = (uint64_t)chip->memory[(chip->i + row) & (SIZE_MEMORY - 1)] << (GFX_XAXIS - SPRITE_MAX_WIDTH);
+		sprite_row >>= x_coor;
+
+		// A collision occurs if any sprite pixel lands on a pixel that's already on
+		if(chip->gfx[y_coor + row] & sprite_row)
+		{
+			chip->v[0xF] = 1;
+		}
+		// Toggle every sprite pixel in the row at once
+		chip->gfx[y_coor + row] ^= sprite_row;
+	}
+
+	// We changed our gfx[] array and thus need to update the screen
+	chip->draw_flag = true;
+	chip->pc += 2;
+}
+
+// 0xEX9E (SKP): Skip next instruction if key with the value of Vx is pressed.
+// Checks the keyboard, and if the key corresponding to the value of Vx is currently in the down position, PC is increased by 2
+void execute_opcode_0xEX9E(chip8_t* chip, const decoded_opcode_t* op)
+{	
+	chip->pc += 2;
+	// Only the low nibble names a key
+	if(chip->keys & (1 << (chip->v[op->x] & 0xF)))
+	{
+		chip->pc += 2;
+	}
+}
+
+// 0xEXA1 (SKNP): Skip next instruction if key with the value of Vx is not pressed.
+// Checks the keyboard, and if the key corresponding to the value of Vx is currently in the up position, PC is increased by 2.
+void execute_opcode_0xEXA1(chip8_t* chip, const decoded_opcode_t* op)
+{
+	chip->pc += 2;
+	if(!(chip->keys & (1 << (chip->v[op->x] & 0xF))))
+	{
+		chip->pc += 2;
+	}
+}
+
+// 0xFX07 (LD): The value of DT is placed into Vx.
+// Set Vx = delay timer value.
+void execute_opcode_0xFX07(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+
+	chip->v[x] = chip->delay_timer;
+	chip->pc += 2;
+}
+
+// 0xFX0A (LD): Wait for a key press and release, store the value of the key in Vx.
+// All execution stops until a key is pressed and let go again, then the value of that key is stored in Vx.
+// As on the original interpreter, a key already held when the wait starts counts once it's released
+void execute_opcode_0xFX0A(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint16_t released;
+
+	chip->key_wait |= chip->keys;
+	released = chip->key_wait & ~chip->keys;
+	// Only advance once a key has gone up, so this instruction runs again until then
+	if(released != 0)
+	{
+		chip->v[op->x] = __builtin_ctz(released);
+		chip->key_wait = 0;
+		chip->pc += 2;
+	}
+}
+
+// 0xFX15 (LD): DT is set equal to the value of Vx.
+// Set delay timer = Vx.
+void execute_opcode_0xFX15(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+
+	chip->delay_timer = chip->v[x];
+	chip->pc += 2;
+}
+
+// 0xFX18 (LD): ST is set equal to the value of Vx.
+// Set sound timer = Vx.
+void execute_opcode_0xFX18(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+
+	chip->sound_timer = chip->v[x];
+	chip->pc += 2;
+}
+
+// 0xFX1E (ADD): The values of I and Vx are added, and the results are stored in I.
+// Set I = I + Vx.
+void execute_opcode_0xFX1E(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+
+	chip->i += chip->v[x];
+	chip->pc += 2;
+}
+
+// 0xFX29 (LD): The value of I is set to the location for the hexadecimal sprite corresponding to the value of Vx. See section 2.4, Display, for more information on the Chip-8 hexadecimal font.
+// Set I = location of sprite for digit Vx.
+void execute_opcode_0xFX29(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+	uint8_t digit = chip->v[x];
+
+	// Fontset begins @ Memory address 0x50, starting with 0. Each individual digit is 5 bytes in size
+	chip->i = (digit * SIZE_FONT_CHAR) + OFFSET_FONT;
+	chip->pc += 2;
+}
+
+// 0xFX33 (LD): Store BCD representation of Vx in memory locations I, I+1, and I+2
+// Example: Integer = 143.  memory[i] = 1, memory[i+1] = 4, memory[i+2] = 3
+// I can be anywhere up to 0xFFFF (FX1E), so addresses wrap at the end of memory
+void execute_opcode_0xFX33(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint16_t address = chip->i & (SIZE_MEMORY - 1);
+
+	chip->memory[address] = chip->v[op->x] / 100;
+	chip->memory[(address + 1) & (SIZE_MEMORY - 1)] = (chip->v[op->x] / 10) % 10;
+	chip->memory[(address + 2) & (SIZE_MEMORY - 1)] = chip->v[op->x] % 10;
+	// Self-modifying ROMs may have just overwritten cached code
+	invalidate_code(chip, address, 3);
+	chip->pc += 2;
+}
+
+// 0xFX55 (LD): Store registers V0 through Vx in memory starting at location I.
+// The interpreter copies the values of registers V0 through Vx into memory, starting at the address in I.
+// Wraps at the end of memory like FX33
+void execute_opcode_0xFX55(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+	uint16_t address = chip->i & (SIZE_MEMORY - 1);
+
+	for(uint8_t j = 0; j <= x; j++)
+	{
+		chip->memory[(address + j) & (SIZE_MEMORY - 1)] = chip->v[j];
+	}
+	// Self-modifying ROMs may have just overwritten cached code
+	invalidate_code(chip, address, x + 1);
+	chip->pc += 2;
+}
+
+// 0xFX65 (LD): Read registers V0 through Vx from memory starting at location I.
+// The interpreter reads values from memory starting at location I into registers V0 through Vx.
+void execute_opcode_0xFX65(chip8_t* chip, const decoded_opcode_t* op)
+{
+	uint8_t x = op->x;
+
+	for(uint8_t j = 0; j <= x; j++)
+	{
+		chip->v[j] = chip->memory[(chip->i + j) & (SIZE_MEMORY - 1)];
+	}
+	chip->pc += 2;
+}
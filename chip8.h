@@ -0,0 +1,318 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIZE_MEMORY 4096
+#define SIZE_STACK 16
+#define SIZE_FONT_CHAR 5
+#define NUM_GENERAL_PURPOSE_REGISTERS 16
+#define NUM_KEYS 16
+#define GFX_XAXIS 64
+#define GFX_YAXIS 32
+#define OFFSET_FONT 50
+#define FONTSET_SIZE 80
+#define SPRITE_MAX_WIDTH 8
+// Nonzero if the pixel at (x, y) is on
+#define GFX_PIXEL(chip, x, y) (((chip)->gfx[(y)] >> (GFX_XAXIS - 1 - (x))) & 1)
+#define PERIOD_60HZ 16667
+#define GAME_START_ADDRESS 0x200
+#define USEC_PER_SEC 1000000
+// Granularity of memory dirty tracking. 64 pages of 64 bytes fit one uint64_t mask
+#define DIRTY_PAGE_SIZE 64
+// RND seed used until chip8_seed() is called
+#define DEFAULT_SEED 0
+// CPU speed in instructions per second until chip8_set_speed() is called. Most ROMs expect roughly 500-1000 IPS
+#define DEFAULT_IPS 700
+// Longest straight-line run the block cache will predecode
+#define MAX_BLOCK_LENGTH 32
+
+// Built-in 4x5 hex digit sprites, loaded at OFFSET_FONT
+extern const uint8_t chip8_fontset[FONTSET_SIZE];
+
+// Predecoded basic blocks, see create_block_cache()
+typedef struct block_cache_t block_cache_t;
+// Native code translations, see jit.h
+typedef struct jit_t jit_t;
+// Binary execution trace, see trace.h
+typedef struct trace_writer_t trace_writer_t;
+// Guest profiler, see profile.h
+typedef struct profile_t profile_t;
+
+// CPU Specifications
+typedef struct chip8_t
+{
+	/* Memory map:
+ 	0x000-0x1FF - Chip 8 interpreter (contains font set in emu)
+	0x050-0x0A0 - Used for the built in 4x5 pixel font set (0-F)
+	0x200-0xFFF - Program ROM and work RAM */
+
+	uint8_t memory[SIZE_MEMORY];
+	// Chip 8 has 15 general registers while the 16th is used for the carry flag
+	uint8_t v[NUM_GENERAL_PURPOSE_REGISTERS];
+	// Chip 8 aspect ratio is 64x32
+	// One 64-bit word per row, bit 63 is the leftmost pixel
+	uint64_t gfx[GFX_YAXIS];
+	// Chip 8 has 2 timers @ 60Hz. Count down to 0 when set above 0
+	uint8_t delay_timer;
+	// Sound timer buzzes upon reaching 0
+	uint8_t sound_timer;
+	// Hex keypad (0x0 - 0xF). Bit n is set while key n is down
+	uint16_t keys;
+	// Keys seen down while waiting in FX0A. The wait ends when one of them is released
+	uint16_t key_wait;
+	// Current opcode (2 bytes)
+	uint16_t opcode;
+	// Index register I
+	uint16_t i;
+	// Program counter
+	uint16_t pc;
+	// Some operations allow the CPU to jump. Stack saves return address
+	uint16_t stack[SIZE_STACK];
+	// Stack pointer to keep track of where we are in stack
+	uint16_t sp;
+	// Flag which specifies screen needs to be updated
+	bool draw_flag;
+	// xorshift64* state for RND. Never zero, see chip8_seed()
+	uint64_t rng_state;
+	// Note: Chip 8 does not have any interrupts or hardware registers
+
+	// Emulator state, not part of the machine. NULL unless the block, JIT, trace or profile engine is in use
+	block_cache_t* cache;
+	jit_t* jit;
+	trace_writer_t* trace;
+	profile_t* profile;
+	// Hash of the loaded ROM, so save states can't be restored into the wrong game
+	uint64_t rom_hash;
+	// Memory pages (DIRTY_PAGE_SIZE bytes) and display rows written since the rewind buffer last 
+	// cleared them
+	uint64_t dirty_pages;
+	uint32_t dirty_rows;
+	// Address of the last unknown opcode reported (-1 for none). A machine parked on one logs it once
+	int32_t unknown_pc;
+	// Speed for chip8_run(): instructions per second, the fractional carry between frames (see 
+	// chip8_frame_cycles()) and instructions left before the next timer tick
+	uint32_t ips;
+	uint32_t frame_remainder;
+	uint32_t frame_cycles_left;
+	// Instructions accounted for by chip8_run(), skipped ones included
+	uint64_t cycles;
+} chip8_t;
+
+// Instruction classes, one per handler. Indexes opcode_handlers[] and the threaded interpreter's jump table
+typedef enum opcode_class_t
+{
+	OP_UNKNOWN,
+	OP_00E0,
+	OP_00EE,
+	OP_1NNN,
+	OP_2NNN,
+	OP_3XKK,
+	OP_4XKK,
+	OP_5XY0,
+	OP_6XKK,
+	OP_7XKK,
+	OP_8XY0,
+	OP_8XY1,
+	OP_8XY2,
+	OP_8XY3,
+	OP_8XY4,
+	OP_8XY5,
+	OP_8XY6,
+	OP_8XY7,
+	OP_8XYE,
+	OP_9XY0,
+	OP_ANNN,
+	OP_BNNN,
+	OP_CXKK,
+	OP_DXYN,
+	OP_EX9E,
+	OP_EXA1,
+	OP_FX07,
+	OP_FX0A,
+	OP_FX15,
+	OP_FX18,
+	OP_FX1E,
+	OP_FX29,
+	OP_FX33,
+	OP_FX55,
+	OP_FX65,
+	NUM_OPCODE_CLASSES
+} opcode_class_t;
+
+// Every 16-bit opcode decoded ahead of time: the handler to run plus its operand fields
+typedef struct decoded_opcode_t decoded_opcode_t;
+typedef void (*opcode_handler_t)(chip8_t* chip, const decoded_opcode_t* op);
+struct decoded_opcode_t
+{
+	opcode_handler_t handler;
+	// Raw opcode and its operands: 0x_NNN, 0x_X__, 0x__Y_, 0x___N and 0x__KK
+	uint16_t opcode;
+	uint16_t nnn;
+	uint8_t x;
+	uint8_t y;
+	uint8_t n;
+	uint8_t kk;
+	// opcode_class_t
+	uint8_t op_class;
+};
+
+#define SIZE_DECODE_TABLE 0x10000
+extern decoded_opcode_t decode_table[SIZE_DECODE_TABLE];
+extern const opcode_handler_t opcode_handlers[NUM_OPCODE_CLASSES];
+
+// A straight-line run of instructions ending at the first jump, skip, call, return or memory write
+typedef struct code_block_t
+{
+	// Address of the first instruction
+	uint16_t start;
+	// Number of instructions, including the terminating one
+	uint8_t length;
+	const decoded_opcode_t* ops[MAX_BLOCK_LENGTH];
+} code_block_t;
+
+struct block_cache_t
+{
+	// Block starting at each address, or NULL if it hasn't been decoded yet
+	code_block_t* blocks[SIZE_MEMORY];
+	// Bytes of memory some block was decoded from. Writes anywhere else can't touch a block
+	bool code_map[SIZE_MEMORY];
+};
+
+// How instructions are dispatched
+typedef enum engine_t
+{
+	// Fetch and decode every instruction through emulate_cycle()
+	ENGINE_STEP,
+	// Run predecoded basic blocks from the block cache
+	ENGINE_BLOCK,
+	// Run x86-64 translations of basic blocks (see jit.h)
+	ENGINE_JIT,
+	// Threaded interpreter using computed goto (GCC/Clang), see run_threaded()
+	ENGINE_THREADED,
+	// Step and record every instruction to chip->trace, see run_traced()
+	ENGINE_TRACE,
+	// Step and count every instruction in chip->profile, see run_profiled()
+	ENGINE_PROFILE,
+	// Lockstep batches of machines in the --instances runner (see batch.h). Never passed to run_cycles()
+	ENGINE_BATCH
+} engine_t;
+
+// Why chip8_run() returned
+typedef enum chip8_stop_t
+{
+	// A 60Hz frame's worth of instructions ran and the timers ticked
+	CHIP8_STOP_FRAME,
+	// FX0A is waiting and no key has changed since it started. Calling again lets the frame run out
+	CHIP8_STOP_KEY_WAIT,
+	// 00E0 or DXYN changed the display
+	CHIP8_STOP_DRAW,
+	// max_cycles instructions ran
+	CHIP8_STOP_BUDGET
+} chip8_stop_t;
+
+// Opcode execution prototypes:
+// Any opcode the CHIP-8 doesn't define
+void execute_opcode_unknown(chip8_t* chip, const decoded_opcode_t* op);
+// 0x0000 (CLS): Clear screen
+void execute_opcode_0x00E0(chip8_t* chip, const decoded_opcode_t* op);
+// 0x00EE: Return from subroutine
+void execute_opcode_0x00EE(chip8_t* chip, const decoded_opcode_t* op);
+// 0x1NNN (JP): Jump to subroutine @ NNN 
+void execute_opcode_0x1NNN(chip8_t* chip, const decoded_opcode_t* op);
+// 0x2NNN (CALL): Call subroutine @ NNN 
+void execute_opcode_0x2NNN(chip8_t* chip, const decoded_opcode_t* op);
+// 0x3XKK (SE): Skip next instruction if Vx = KK
+void execute_opcode_0x3XKK(chip8_t* chip, const decoded_opcode_t* op);
+// 0x4XKK (SNE): Skip next instruction if Vx != KK
+void execute_opcode_0x4XKK(chip8_t* chip, const decoded_opcode_t* op);
+// 0x5XY0 (SE): Skip next instruction if Vx = Vy
+void execute_opcode_0x5XY0(chip8_t* chip, const decoded_opcode_t* op);
+// 0x6XKK (LD): Places the value KK into register Vx
+void execute_opcode_0x6XKK(chip8_t* chip, const decoded_opcode_t* op);
+// 0x7XKK (ADD): Adds the value kk to the value of register Vx, then stores the result in Vx. (Vx = Vx + kk)
+void execute_opcode_0x7XKK(chip8_t* chip, const decoded_opcode_t* op);
+// 0x8XY0 (LD): Stores the value of register Vy in register Vx (Vx = Vy)
+void execute_opcode_0x8XY0(chip8_t* chip, const decoded_opcode_t* op);
+// 0x8XY1 (OR): OR operation with Vx and Vy. Result stored in Vx (Vx = Vx OR Vy)
+void execute_opcode_0x8XY1(chip8_t* chip, const decoded_opcode_t* op);
+// 0x8XY2 (AND): AND operation with Vx and Vy. Result stored in Vx (Vx = Vx AND Vy)
+void execute_opcode_0x8XY2(chip8_t* chip, const decoded_opcode_t* op);
+// 0x8XY3 (XOR): XOR operation with Vx and Vy. Result stored in Vx (Vx = Vx XOR Vy)
+void execute_opcode_0x8XY3(chip8_t* chip, const decoded_opcode_t* op);
+// 0x8XY4 (ADD): Add Vy to Vx. If sum is greater than 255, VF is set 1 (0 otherwise). Sum stored in Vx 
+void execute_opcode_0x8XY4(chip8_t* chip, const decoded_opcode_t* op);
+// 0x8XY5 (SUB): Then Vy is subtracted from Vx, and the results stored in Vx.
+void execute_opcode_0x8XY5(chip8_t* chip, const decoded_opcode_t* op);
+// 0x8XY6 (SHR): If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2.
+void execute_opcode_0x8XY6(chip8_t* chip, const decoded_opcode_t* op);
+// 0x8XY7 (SUBN): If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
+void execute_opcode_0x8XY7(chip8_t* chip, const decoded_opcode_t* op);
+// 0x8XYE (SHL): If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2.
+void execute_opcode_0x8XYE(chip8_t* chip, const decoded_opcode_t* op);
+// 0x9XY0 (SNE): The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.
+void execute_opcode_0x9XY0(chip8_t* chip, const decoded_opcode_t* op);
+// 0xANNN (LD): The value of register I is set to NNN
+void execute_opcode_0xANNN(chip8_t* chip, const decoded_opcode_t* op);
+// 0xBNNN (JP): The program counter is set to nnn plus the value of V0
+void execute_opcode_0xBNNN(chip8_t* chip, const decoded_opcode_t* op);
+// 0xCXKK (RND): Set Vx = random byte AND kk.
+void execute_opcode_0xCXKK(chip8_t* chip, const decoded_opcode_t* op);
+// 0xDXYN (DRW): Draw a sprite at coordinate (value @ Vx, value @ Vy) with a height of n pixels (rows)
+void execute_opcode_0xDXYN(chip8_t* chip, const decoded_opcode_t* op);
+// 0xEX9E (SKP): Skip next instruction if key with the value of Vx is pressed
+void execute_opcode_0xEX9E(chip8_t* chip, const decoded_opcode_t* op);
+// 0xEXA1 (SKNP): Skip next instruction if key with the value of Vx is not pressed
+void execute_opcode_0xEXA1(chip8_t* chip, const decoded_opcode_t* op);
+// 0xFX07 (LD): The value of DT is placed into Vx.
+void execute_opcode_0xFX07(chip8_t* chip, const decoded_opcode_t* op);
+// 0xFX0A (LD): Wait for a key press and release, store the value of the key in Vx.
+void execute_opcode_0xFX0A(chip8_t* chip, const decoded_opcode_t* op);
+// 0xFX15 (LD): DT is set equal to the value of Vx.
+void execute_opcode_0xFX15(chip8_t* chip, const decoded_opcode_t* op);
+// 0xFX18 (LD): ST is set equal to the value of Vx.
+void execute_opcode_0xFX18(chip8_t* chip, const decoded_opcode_t* op);
+// 0xFX1E (ADD): The values of I and Vx are added, and the results are stored in I.
+void execute_opcode_0xFX1E(chip8_t* chip, const decoded_opcode_t* op);
+// 0xFX29 (LD): The value of I is set to the location for the hexadecimal sprite corresponding to the value of Vx. See section 2.4, Display, for more information on the Chip-8 hexadecimal font.
+void execute_opcode_0xFX29(chip8_t* chip, const decoded_opcode_t* op);
+// 0xFX33 (LD): Store BCD representation of Vx in memory locations I, I+1, and I+2
+void execute_opcode_0xFX33(chip8_t* chip, const decoded_opcode_t* op);
+// 0xFX55 (LD): Store registers V0 through Vx in memory starting at location I.
+void execute_opcode_0xFX55(chip8_t* chip, const decoded_opcode_t* op);
+// 0xFX65 (LD): Read registers V0 through Vx from memory starting at location I.
+void execute_opcode_0xFX65(chip8_t* chip, const decoded_opcode_t* op);
+
+// Emulator operations prototypes:
+void build_decode_table(void);
+uint64_t hash_bytes(const void* data, size_t length);
+uint64_t hash_gfx(const chip8_t* chip);
+opcode_class_t decode_opcode(uint16_t opcode);
+void emulate_cycle(chip8_t* c);
+void run_cycles(chip8_t* chip, engine_t engine, uint32_t cycles);
+void initialize_chip(chip8_t* chip);
+void chip8_seed(chip8_t* chip, uint64_t seed);
+// Copy a ROM to GAME_START_ADDRESS. Returns 0 on success, -1 if it doesn't fit in memory
+int chip8_load_rom(chip8_t* chip, const uint8_t* rom, size_t size);
+void chip8_set_speed(chip8_t* chip, uint32_t ips);
+// Instructions in the next 60Hz frame at ips, carrying the fraction in remainder
+uint32_t chip8_frame_cycles(uint32_t ips, uint32_t* remainder);
+// Run up to max_cycles instructions, stopping early at the end of a frame, a draw or a key wait
+chip8_stop_t chip8_run(chip8_t* chip, uint64_t max_cycles);
+block_cache_t* create_block_cache(void);
+void destroy_block_cache(block_cache_t* cache);
+code_block_t* build_block(chip8_t* chip, uint16_t start);
+bool ends_block(opcode_class_t op_class);
+void run_threaded(chip8_t* chip, uint32_t cycles);
+void run_traced(chip8_t* chip, uint32_t cycles);
+void run_profiled(chip8_t* chip, uint32_t cycles);
+void invalidate_code(chip8_t* chip, uint16_t address, uint16_t length);
+bool key_wait_idle(const chip8_t* chip);
+// The machine is spinning in a loop that only a timer tick or key change can end
+bool in_idle_loop(const chip8_t* chip);
+void handle_delay_timer(chip8_t* chip);
+void handle_sound_timer(chip8_t* chip);
+
+#endif
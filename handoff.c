@@ -0,0 +1,39 @@
+#include <string.h>
+#include "handoff.h"
+
+void handoff_init(frame_handoff_t* handoff)
+{
+	memset(handoff->buffers, 0, sizeof(handoff->buffers));
+	handoff->back = 0;
+	handoff->front = 2;
+	atomic_init(&handoff->middle, 1);
+}
+
+bool handoff_publish(frame_handoff_t* handoff, const uint64_t* gfx)
+{
+	unsigned int previous;
+
+	memcpy(handoff->buffers[handoff->back], gfx, sizeof(handoff->buffers[0]));
+	// Release makes the rows visible before the index, acquire gets the rows the SDL thread let go of
+	previous = atomic_exchange_explicit(&handoff->middle, handoff->back | HANDOFF_FRESH, memory_order_acq_rel);
+	handoff->back = previous & ~HANDOFF_FRESH;
+	return (previous & HANDOFF_FRESH) == 0;
+}
+
+bool handoff_take(frame_handoff_t* handoff)
+{
+	unsigned int middle;
+
+	if((atomic_load_explicit(&handoff->middle, memory_order_relaxed) & HANDOFF_FRESH) == 0)
+	{
+		return false;
+	}
+	middle = atomic_exchange_explicit(&handoff->middle, handoff->front, memory_order_acq_rel);
+	handoff->front = middle & ~HANDOFF_FRESH;
+	return true;
+}
+
+const uint64_t* handoff_front(const frame_handoff_t* handoff)
+{
+	return handoff->buffers[handoff->front];
+}
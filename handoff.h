@@ -0,0 +1,38 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+/* Frame handoff from the emulation thread to the SDL thread, as a lock-free triple buffer. The
+ * emulation thread fills the back buffer and swaps it with the middle one, the SDL thread swaps
+ * the middle one with the front buffer it draws from. Each side only ever touches its own buffer,
+ * and one atomic exchange per frame moves buffers between them, so neither waits for the other:
+ * a slow present just means the frames published meanwhile are replaced by newer ones unseen */
+
+// Set in middle while it holds a frame the SDL thread hasn't taken
+#define HANDOFF_FRESH 4
+
+typedef struct frame_handoff_t
+{
+	uint64_t buffers[3][GFX_YAXIS];
+	// Emulation thread only
+	uint8_t back;
+	// SDL thread only
+	uint8_t front;
+	// Index of the middle buffer, plus HANDOFF_FRESH
+	atomic_uint middle;
+} frame_handoff_t;
+
+void handoff_init(frame_handoff_t* handoff);
+// Copy a finished display into the back buffer and publish it. Returns true if the SDL thread
+// had taken the previous frame, so it may be waiting to be told about this one
+bool handoff_publish(frame_handoff_t* handoff, const uint64_t* gfx);
+// Take the newest published frame, if there is one the SDL thread hasn't seen
+bool handoff_take(frame_handoff_t* handoff);
+// The frame last taken
+const uint64_t* handoff_front(const frame_handoff_t* handoff);
+
+#endif
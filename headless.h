@@ -0,0 +1,118 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8.h"
+
+/* Command line options and the headless run loop. Nothing here uses SDL, so the parallel runner 
+ * (runner.h) and movies (movie.h) can use them without pulling in the window front end (main.h) */
+
+// Frames run per displayed frame while fast-forwarding, unless --turbo says otherwise. TURBO_UNCAPPED
+// runs as many as fit in each displayed frame
+#define DEFAULT_TURBO 4
+#define TURBO_UNCAPPED 0
+// Sentinel for "no limit" on headless stop conditions
+#define RUN_FOREVER UINT64_MAX
+#define NO_STOP_PC -1
+// Engine used when --engine isn't given. Override at build time, e.g. -DDEFAULT_ENGINE=ENGINE_THREADED
+#ifndef DEFAULT_ENGINE
+#define DEFAULT_ENGINE ENGINE_BLOCK
+#endif
+
+// Command line options
+typedef struct options_t
+{
+	// Path to .rom or .ch8 file
+	const char* rom_path;
+	// Instructions executed per second. Ignored when uncapped is set
+	uint32_t ips;
+	// Run as many instructions as possible within each 60Hz frame
+	bool uncapped;
+	// Run without SDL for regression runs and ROM screening
+	bool headless;
+	// Headless stop conditions: cycle count, frame count, or program counter reached
+	uint64_t max_cycles;
+	uint64_t max_frames;
+	int32_t until_pc;
+	// Scripted key input for headless runs (NULL for none)
+	const char* key_script_path;
+	// Keyboard key (SDL_Keycode) for each keypad key, and the file it was changed from (NULL for the
+	// default layout)
+	int32_t keymap[NUM_KEYS];
+	const char* keymap_path;
+	// Instruction dispatch engine
+	engine_t engine;
+	// Present in step with the display refresh
+	bool vsync;
+	// Frames per displayed frame when fast-forwarding (or TURBO_UNCAPPED), and whether to fast-forward
+	// all the time rather than only while Tab is held
+	uint32_t turbo;
+	bool fast_forward;
+	// Audio buffer size in samples, and whether to leave audio off
+	uint16_t audio_samples;
+	bool mute;
+	// Log file (NULL for stderr)
+	const char* log_path;
+	// Binary execution trace output (NULL for none)
+	const char* trace_path;
+	// Profile report output, plus (path).folded (NULL for none)
+	const char* profile_path;
+	// RND seed. Without --seed, headless runs use DEFAULT_SEED and windowed runs the clock
+	uint64_t seed;
+	bool seeded;
+	// Input movie to record from the keyboard, or to play back in place of it (NULL for none)
+	const char* record_path;
+	const char* play_path;
+	// Headless machines run side by side, and worker threads to run them on (0 for one per core)
+	uint32_t instances;
+	uint32_t threads;
+} options_t;
+
+// One scripted key transition, applied at the start of the given frame
+typedef struct key_event_t
+{
+	uint64_t frame;
+	uint8_t key;
+	uint8_t state;
+} key_event_t;
+
+typedef struct key_script_t
+{
+	key_event_t* events;
+	uint32_t count;
+	// Index of the next event to apply
+	uint32_t next;
+} key_script_t;
+
+// Recorded input, see movie.h
+typedef struct movie_t movie_t;
+
+// Progress of one headless machine towards its stop conditions
+typedef struct headless_t
+{
+	chip8_t* chip;
+	key_script_t script;
+	// Fractional cycle carry, see cycles_for_frame()
+	uint32_t cycle_remainder;
+	uint64_t cycles;
+	uint64_t frames;
+	// Frames skipped while waiting in FX0A for a scripted key
+	uint64_t parked_frames;
+} headless_t;
+
+int parse_options(int argc, char** argv, options_t* opts);
+// Create the cache or JIT an engine needs. Returns the engine actually usable
+engine_t attach_engine(chip8_t* chip, engine_t engine);
+// Keys come from the --keys script, or from movie if it isn't NULL (and the final state is checked)
+int run_headless(chip8_t* chip, const options_t* opts, const movie_t* movie);
+// Run one frame, or skip over frames spent waiting for a key. Returns false at a stop condition
+bool run_headless_frame(headless_t* run, const options_t* opts);
+int load_key_script(key_script_t* script, const char* path);
+void apply_key_script(chip8_t* chip, key_script_t* script, uint64_t frame);
+//void load_game(chip8_t* chip, char* game_rom);
+// Returns 0 on success, -1 (with a message printed) if the ROM can't be loaded
+int load_game(chip8_t* chip, const char* game_rom);
+uint32_t cycles_for_frame(const options_t* opts, uint32_t* remainder);
+
+#endif
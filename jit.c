@@ -0,0 +1,935 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jit.h"
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE (8 * 1024 * 1024)
+// Worst case size of one translated block (32 x FX65 is ~16KB). The buffer is flushed when less is left
+#define JIT_MAX_BLOCK_BYTES (32 * 1024)
+// Pending jumps between blocks, waiting for their target to be translated
+#define JIT_MAX_PATCHES 4096
+// Number of host registers available for caching V registers within a block
+#define JIT_NUM_CACHED_V 9
+
+// Offsets into chip8_t used by generated code (always addressed as [rbx + disp32])
+#define OFF_MEMORY offsetof(chip8_t, memory)
+#define OFF_V offsetof(chip8_t, v)
+#define OFF_DELAY offsetof(chip8_t, delay_timer)
+#define OFF_SOUND offsetof(chip8_t, sound_timer)
+#define OFF_KEYS offsetof(chip8_t, keys)
+#define OFF_OPCODE offsetof(chip8_t, opcode)
+#define OFF_I offsetof(chip8_t, i)
+#define OFF_PC offsetof(chip8_t, pc)
+#define OFF_STACK offsetof(chip8_t, stack)
+#define OFF_SP offsetof(chip8_t, sp)
+
+/* Register use in generated code:
+ * rbx - chip8_t*           rbp - I (16-bit value, written back on exit)
+ * r15 - remaining cycles   rax, rcx, rdx - scratch
+ * rsi, rdi, r8-r14 - V registers cached for the current block */
+enum
+{
+	RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+static const uint8_t cache_registers[JIT_NUM_CACHED_V] = {RSI, RDI, R8, R9, R10, R11, R12, R13, R14};
+
+// Two-operand ALU opcodes, "op r/m32, r32" form
+#define X86_ADD 0x01
+#define X86_OR 0x09
+#define X86_AND 0x21
+#define X86_SUB 0x29
+#define X86_XOR 0x31
+#define X86_CMP 0x39
+#define X86_MOV 0x89
+// ModRM reg field for "op r/m32, imm32" (0x81) and shifts (0xC1)
+#define X86_EXT_ADD 0
+#define X86_EXT_AND 4
+#define X86_EXT_SUB 5
+#define X86_EXT_CMP 7
+#define X86_EXT_SHL 4
+#define X86_EXT_SHR 5
+// Condition codes for Jcc/SETcc
+#define X86_CC_B 0x2
+#define X86_CC_AE 0x3
+#define X86_CC_E 0x4
+#define X86_CC_NE 0x5
+
+// How the translator handles each instruction
+typedef enum jit_kind_t
+{
+	// Not translated: ends the block and runs in the interpreter
+	JIT_UNSUPPORTED,
+	// Translated, execution continues with the next instruction
+	JIT_STRAIGHT,
+	// Translated and ends the block (jumps, skips, calls, returns)
+	JIT_TERMINATOR
+} jit_kind_t;
+
+typedef struct chain_patch_t
+{
+	// rel32 field of a jump to the epilogue that should go to the target's translation instead
+	uint8_t* site;
+	uint16_t target;
+} chain_patch_t;
+
+typedef uint32_t (*jit_enter_t)(chip8_t* chip, uint32_t cycles, const void* entry);
+
+struct jit_t
+{
+	uint8_t* code;
+	size_t used;
+	// Size of the prologue/epilogue at the start of the buffer, kept across flushes
+	size_t stub_size;
+	jit_enter_t enter;
+	uint8_t* epilogue;
+	// Translation starting at each address (NULL if none)
+	void* entry[SIZE_MEMORY];
+	// Addresses whose first instruction can't be translated
+	bool untranslatable[SIZE_MEMORY];
+	// Bytes of CHIP-8 memory that some translation was built from
+	bool code_map[SIZE_MEMORY];
+	chain_patch_t patches[JIT_MAX_PATCHES];
+	uint32_t num_patches;
+
+	// Per-translation state: host register holding each V register (-1 if not cached)
+	int8_t vreg[NUM_GENERAL_PURPOSE_REGISTERS];
+	// Cached V registers written by the block, stored back before every exit
+	uint16_t dirty;
+};
+
+static void emit8(jit_t* jit, uint8_t byte)
+{
+	jit->code[jit->used++] = byte;
+}
+
+static void emit16(jit_t* jit, uint16_t value)
+{
+	memcpy(jit->code + jit->used, &value, sizeof(value));
+	jit->used += sizeof(value);
+}
+
+static void emit32(jit_t* jit, uint32_t value)
+{
+	memcpy(jit->code + jit->used, &value, sizeof(value));
+	jit->used += sizeof(value);
+}
+
+static void emit64(jit_t* jit, uint64_t value)
+{
+	memcpy(jit->code + jit->used, &value, sizeof(value));
+	jit->used += sizeof(value);
+}
+
+// REX prefix for 32-bit operations. Only emitted when an extended register is involved, or when
+// force is set (needed to address sil/dil as byte registers)
+static void emit_rex(jit_t* jit, int reg, int rm, bool force)
+{
+	uint8_t rex = 0x40 | ((reg >> 3) & 1) << 2 | ((rm >> 3) & 1);
+	if(rex != 0x40 || force)
+	{
+		emit8(jit, rex);
+	}
+}
+
+static void emit_modrm(jit_t* jit, int mod, int reg, int rm)
+{
+	emit8(jit, (mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+// [rbx + disp32]
+static void emit_chip_operand(jit_t* jit, int reg, uint32_t disp)
+{
+	emit_modrm(jit, 2, reg, RBX);
+	emit32(jit, disp);
+}
+
+// op dst, src (32-bit)
+static void emit_alu_rr(jit_t* jit, uint8_t opcode, int dst, int src)
+{
+	emit_rex(jit, src, dst, false);
+	emit8(jit, opcode);
+	emit_modrm(jit, 3, src, dst);
+}
+
+// op dst, imm32 (32-bit)
+static void emit_alu_ri(jit_t* jit, int ext, int dst, uint32_t imm)
+{
+	emit_rex(jit, 0, dst, false);
+	emit8(jit, 0x81);
+	emit_modrm(jit, 3, ext, dst);
+	emit32(jit, imm);
+}
+
+// mov dst, imm32
+static void emit_mov_ri(jit_t* jit, int dst, uint32_t imm)
+{
+	emit_rex(jit, 0, dst, false);
+	emit8(jit, 0xB8 + (dst & 7));
+	emit32(jit, imm);
+}
+
+// shl/shr dst, imm8
+static void emit_shift_ri(jit_t* jit, int ext, int dst, uint8_t amount)
+{
+	emit_rex(jit, 0, dst, false);
+	emit8(jit, 0xC1);
+	emit_modrm(jit, 3, ext, dst);
+	emit8(jit, amount);
+}
+
+// movzx dst, byte [rbx + disp]
+static void emit_load_byte(jit_t* jit, int dst, uint32_t disp)
+{
+	emit_rex(jit, dst, RBX, false);
+	emit8(jit, 0x0F);
+	emit8(jit, 0xB6);
+	emit_chip_operand(jit, dst, disp);
+}
+
+// movzx dst, word [rbx + disp]
+static void emit_load_word(jit_t* jit, int dst, uint32_t disp)
+{
+	emit_rex(jit, dst, RBX, false);
+	emit8(jit, 0x0F);
+	emit8(jit, 0xB7);
+	emit_chip_operand(jit, dst, disp);
+}
+
+// mov byte [rbx + disp], src8
+static void emit_store_byte(jit_t* jit, int src, uint32_t disp)
+{
+	emit_rex(jit, src, RBX, src >= RSP);
+	emit8(jit, 0x88);
+	emit_chip_operand(jit, src, disp);
+}
+
+// mov word [rbx + disp], src16
+static void emit_store_word(jit_t* jit, int src, uint32_t disp)
+{
+	emit8(jit, 0x66);
+	emit_rex(jit, src, RBX, false);
+	emit8(jit, 0x89);
+	emit_chip_operand(jit, src, disp);
+}
+
+// mov byte [rbx + disp], imm8
+static void emit_store_byte_imm(jit_t* jit, uint32_t disp, uint8_t imm)
+{
+	emit8(jit, 0xC6);
+	emit_chip_operand(jit, 0, disp);
+	emit8(jit, imm);
+}
+
+// mov word [rbx + disp], imm16
+static void emit_store_word_imm(jit_t* jit, uint32_t disp, uint16_t imm)
+{
+	emit8(jit, 0x66);
+	emit8(jit, 0xC7);
+	emit_chip_operand(jit, 0, disp);
+	emit16(jit, imm);
+}
+
+// jmp rel32 to target. Returns the address of the rel32 field so it can be patched later
+static uint8_t* emit_jmp(jit_t* jit, const uint8_t* target)
+{
+	emit8(jit, 0xE9);
+	uint8_t* site = jit->code + jit->used;
+	emit32(jit, (uint32_t)(target - (site + 4)));
+	return site;
+}
+
+// jcc rel32 to target (NULL to patch later). Returns the address of the rel32 field
+static uint8_t* emit_jcc(jit_t* jit, uint8_t cc, const uint8_t* target)
+{
+	emit8(jit, 0x0F);
+	emit8(jit, 0x80 | cc);
+	uint8_t* site = jit->code + jit->used;
+	emit32(jit, target ? (uint32_t)(target - (site + 4)) : 0);
+	return site;
+}
+
+// Point a rel32 field at target
+static void patch_rel32(uint8_t* site, const uint8_t* target)
+{
+	uint32_t rel = (uint32_t)(target - (site + 4));
+	memcpy(site, &rel, sizeof(rel));
+}
+
+// Load V[x] into a scratch register
+static void load_v(jit_t* jit, int dst, uint8_t x)
+{
+	if(jit->vreg[x] >= 0)
+	{
+		emit_alu_rr(jit, X86_MOV, dst, jit->vreg[x]);
+	}
+	else
+	{
+		emit_load_byte(jit, dst, OFF_V + x);
+	}
+}
+
+// Store a scratch register (holding a value 0-255) into V[x]
+static void store_v(jit_t* jit, uint8_t x, int src)
+{
+	if(jit->vreg[x] >= 0)
+	{
+		emit_alu_rr(jit, X86_MOV, jit->vreg[x], src);
+		jit->dirty |= 1 << x;
+	}
+	else
+	{
+		emit_store_byte(jit, src, OFF_V + x);
+	}
+}
+
+static void store_v_imm(jit_t* jit, uint8_t x, uint8_t value)
+{
+	if(jit->vreg[x] >= 0)
+	{
+		emit_mov_ri(jit, jit->vreg[x], value);
+		jit->dirty |= 1 << x;
+	}
+	else
+	{
+		emit_store_byte_imm(jit, OFF_V + x, value);
+	}
+}
+
+// Write every modified cached V register back to chip->v
+static void emit_flush_v(jit_t* jit)
+{
+	for(uint8_t x = 0; x < NUM_GENERAL_PURPOSE_REGISTERS; x++)
+	{
+		if(jit->dirty & (1 << x))
+		{
+			emit_store_byte(jit, jit->vreg[x], OFF_V + x);
+		}
+	}
+}
+
+static bool in_program(uint32_t address)
+{
+	return address >= GAME_START_ADDRESS && address < SIZE_MEMORY - 1;
+}
+
+// Leave the block for a known address: jump straight to its translation if there is one,
+// otherwise return to jit_run() and remember to chain once the target is translated
+static void emit_exit(jit_t* jit, uint16_t last_opcode, uint16_t target)
+{
+	emit_store_word_imm(jit, OFF_OPCODE, last_opcode);
+
+	if(target < SIZE_MEMORY && jit->entry[target] != NULL)
+	{
+		emit_jmp(jit, jit->entry[target]);
+		return;
+	}
+
+	emit_store_word_imm(jit, OFF_PC, target);
+	uint8_t* site = emit_jmp(jit, jit->epilogue);
+	// An untranslatable target will never have an entry to chain to
+	if(in_program(target) && !jit->untranslatable[target] && jit->num_patches < JIT_MAX_PATCHES)
+	{
+		jit->patches[jit->num_patches].site = site;
+		jit->patches[jit->num_patches].target = target;
+		jit->num_patches++;
+	}
+}
+
+// Leave the block for the address in eax (returns, BNNN) through the entry table
+static void emit_exit_indirect(jit_t* jit, uint16_t last_opcode)
+{
+	emit_store_word_imm(jit, OFF_OPCODE, last_opcode);
+	emit_store_word(jit, RAX, OFF_PC);
+	// cmp eax, SIZE_MEMORY / jae epilogue
+	emit_alu_ri(jit, X86_EXT_CMP, RAX, SIZE_MEMORY);
+	emit_jcc(jit, X86_CC_AE, jit->epilogue);
+	// mov rcx, &entry[0] / mov rcx, [rcx + rax * 8]
+	emit8(jit, 0x48);
+	emit8(jit, 0xB9);
+	emit64(jit, (uint64_t)(uintptr_t)jit->entry);
+	emit8(jit, 0x48);
+	emit8(jit, 0x8B);
+	emit8(jit, 0x0C);
+	emit8(jit, 0xC1);
+	// test rcx, rcx / jz epilogue / jmp rcx
+	emit8(jit, 0x48);
+	emit8(jit, 0x85);
+	emit8(jit, 0xC9);
+	emit_jcc(jit, X86_CC_E, jit->epilogue);
+	emit8(jit, 0xFF);
+	emit8(jit, 0xE1);
+}
+
+// Conditional skip: flags are already set, skip_cc is the condition under which the next
+// instruction is skipped
+static void emit_skip(jit_t* jit, const decoded_opcode_t* op, uint16_t address, uint8_t skip_cc)
+{
+	// Jump over the skip path when the condition is false (cc ^ 1 inverts an x86 condition)
+	uint8_t* no_skip = emit_jcc(jit, skip_cc ^ 1, NULL);
+	emit_exit(jit, op->opcode, address + 4);
+	patch_rel32(no_skip, jit->code + jit->used);
+	emit_exit(jit, op->opcode, address + 2);
+}
+
+static jit_kind_t classify(opcode_class_t op_class)
+{
+	if(op_class == OP_00EE || op_class == OP_1NNN ||
+		op_class == OP_2NNN || op_class == OP_3XKK ||
+		op_class == OP_4XKK || op_class == OP_5XY0 ||
+		op_class == OP_9XY0 || op_class == OP_BNNN ||
+		op_class == OP_EX9E || op_class == OP_EXA1)
+	{
+		return JIT_TERMINATOR;
+	}
+	if(op_class == OP_6XKK || op_class == OP_7XKK ||
+		op_class == OP_8XY0 || op_class == OP_8XY1 ||
+		op_class == OP_8XY2 || op_class == OP_8XY3 ||
+		op_class == OP_8XY4 || op_class == OP_8XY5 ||
+		op_class == OP_8XY6 || op_class == OP_8XY7 ||
+		op_class == OP_8XYE || op_class == OP_ANNN ||
+		op_class == OP_FX07 || op_class == OP_FX15 ||
+		op_class == OP_FX18 || op_class == OP_FX1E ||
+		op_class == OP_FX29 || op_class == OP_FX65)
+	{
+		return JIT_STRAIGHT;
+	}
+	// 00E0, CXKK, DXYN, FX0A, FX33, FX55 and unknown opcodes stay in the interpreter
+	return JIT_UNSUPPORTED;
+}
+
+// Count how often each V register is touched by an instruction
+static void count_v_uses(const decoded_opcode_t* op, uint32_t uses[NUM_GENERAL_PURPOSE_REGISTERS])
+{
+	opcode_class_t op_class = op->op_class;
+
+	if(op_class == OP_BNNN)
+	{
+		uses[0]++;
+	}
+	else if(op_class == OP_FX65)
+	{
+		for(uint8_t j = 0; j <= op->x; j++)
+		{
+			uses[j]++;
+		}
+	}
+	else if(op_class != OP_00EE && op_class != OP_1NNN &&
+		op_class != OP_2NNN && op_class != OP_ANNN)
+	{
+		uses[op->x]++;
+		// 8XYn and 5XY0/9XY0 also read Vy, and most 8XYn write VF
+		if((op->opcode & 0xF000) == 0x8000 || (op->opcode & 0xF000) == 0x5000 || (op->opcode & 0xF000) == 0x9000)
+		{
+			uses[op->y]++;
+		}
+		if((op->opcode & 0xF000) == 0x8000 && op->n != 0)
+		{
+			uses[0xF]++;
+		}
+	}
+}
+
+// Give the most used V registers of the block a host register each
+static void allocate_v(jit_t* jit, const decoded_opcode_t** ops, uint32_t count)
+{
+	uint32_t uses[NUM_GENERAL_PURPOSE_REGISTERS] = {0};
+
+	for(uint32_t k = 0; k < count; k++)
+	{
+		count_v_uses(ops[k], uses);
+	}
+
+	memset(jit->vreg, -1, sizeof(jit->vreg));
+	jit->dirty = 0;
+	for(uint32_t slot = 0; slot < JIT_NUM_CACHED_V; slot++)
+	{
+		int best = -1;
+		for(int x = 0; x < NUM_GENERAL_PURPOSE_REGISTERS; x++)
+		{
+			if(jit->vreg[x] < 0 && uses[x] >= 2 && (best < 0 || uses[x] > uses[best]))
+			{
+				best = x;
+			}
+		}
+		if(best < 0)
+		{
+			break;
+		}
+		jit->vreg[best] = cache_registers[slot];
+	}
+}
+
+static void translate_straight(jit_t* jit, const decoded_opcode_t* op)
+{
+	opcode_class_t op_class = op->op_class;
+	uint8_t x = op->x;
+	uint8_t y = op->y;
+
+	if(op_class == OP_6XKK)
+	{
+		store_v_imm(jit, x, op->kk);
+	}
+	else if(op_class == OP_7XKK)
+	{
+		load_v(jit, RAX, x);
+		emit_alu_ri(jit, X86_EXT_ADD, RAX, op->kk);
+		emit_alu_ri(jit, X86_EXT_AND, RAX, 0xFF);
+		store_v(jit, x, RAX);
+	}
+	else if(op_class == OP_8XY0)
+	{
+		load_v(jit, RAX, y);
+		store_v(jit, x, RAX);
+	}
+	else if(op_class == OP_8XY1 || op_class == OP_8XY2 || op_class == OP_8XY3)
+	{
+		uint8_t alu = op_class == OP_8XY1 ? X86_OR : op_class == OP_8XY2 ? X86_AND : X86_XOR;
+		load_v(jit, RAX, x);
+		load_v(jit, RCX, y);
+		emit_alu_rr(jit, alu, RAX, RCX);
+		store_v(jit, x, RAX);
+		store_v_imm(jit, 0xF, 0);
+	}
+	else if(op_class == OP_8XY4)
+	{
+		load_v(jit, RAX, x);
+		load_v(jit, RCX, y);
+		emit_alu_rr(jit, X86_ADD, RAX, RCX);
+		emit_alu_rr(jit, X86_MOV, RDX, RAX);
+		emit_alu_ri(jit, X86_EXT_AND, RAX, 0xFF);
+		store_v(jit, x, RAX);
+		// Carry is bit 8 of the 9-bit sum
+		emit_shift_ri(jit, X86_EXT_SHR, RDX, 8);
+		store_v(jit, 0xF, RDX);
+	}
+	else if(op_class == OP_8XY5 || op_class == OP_8XY7)
+	{
+		// 8XY5: Vx = Vx - Vy, 8XY7: Vx = Vy - Vx. VF = NOT borrow
+		int minuend = op_class == OP_8XY5 ? RAX : RCX;
+		int subtrahend = op_class == OP_8XY5 ? RCX : RAX;
+		load_v(jit, RAX, x);
+		load_v(jit, RCX, y);
+		emit_alu_rr(jit, X86_XOR, RDX, RDX);
+		emit_alu_rr(jit, X86_CMP, minuend, subtrahend);
+		// setae dl
+		emit8(jit, 0x0F);
+		emit8(jit, 0x90 | X86_CC_AE);
+		emit_modrm(jit, 3, 0, RDX);
+		emit_alu_rr(jit, X86_SUB, minuend, subtrahend);
+		emit_alu_ri(jit, X86_EXT_AND, minuend, 0xFF);
+		store_v(jit, x, minuend);
+		store_v(jit, 0xF, RDX);
+	}
+	else if(op_class == OP_8XY6)
+	{
+		load_v(jit, RAX, x);
+		emit_alu_rr(jit, X86_MOV, RDX, RAX);
+		emit_alu_ri(jit, X86_EXT_AND, RDX, 1);
+		emit_shift_ri(jit, X86_EXT_SHR, RAX, 1);
+		store_v(jit, x, RAX);
+		store_v(jit, 0xF, RDX);
+	}
+	else if(op_class == OP_8XYE)
+	{
+		load_v(jit, RAX, x);
+		emit_alu_rr(jit, X86_MOV, RDX, RAX);
+		emit_shift_ri(jit, X86_EXT_SHR, RDX, 7);
+		emit_shift_ri(jit, X86_EXT_SHL, RAX, 1);
+		emit_alu_ri(jit, X86_EXT_AND, RAX, 0xFF);
+		store_v(jit, x, RAX);
+		store_v(jit, 0xF, RDX);
+	}
+	else if(op_class == OP_ANNN)
+	{
+		emit_mov_ri(jit, RBP, op->nnn);
+	}
+	else if(op_class == OP_FX07)
+	{
+		emit_load_byte(jit, RAX, OFF_DELAY);
+		store_v(jit, x, RAX);
+	}
+	else if(op_class == OP_FX15 || op_class == OP_FX18)
+	{
+		load_v(jit, RAX, x);
+		emit_store_byte(jit, RAX, op_class == OP_FX15 ? OFF_DELAY : OFF_SOUND);
+	}
+	else if(op_class == OP_FX1E)
+	{
+		load_v(jit, RAX, x);
+		emit_alu_rr(jit, X86_ADD, RBP, RAX);
+		emit_alu_ri(jit, X86_EXT_AND, RBP, 0xFFFF);
+	}
+	else if(op_class == OP_FX29)
+	{
+		load_v(jit, RAX, x);
+		// imul eax, eax, SIZE_FONT_CHAR
+		emit8(jit, 0x69);
+		emit_modrm(jit, 3, RAX, RAX);
+		emit32(jit, SIZE_FONT_CHAR);
+		emit_alu_ri(jit, X86_EXT_ADD, RAX, OFFSET_FONT);
+		emit_alu_rr(jit, X86_MOV, RBP, RAX);
+	}
+	else if(op_class == OP_FX65)
+	{
+		for(uint8_t j = 0; j <= x; j++)
+		{
+			// Wraps at the end of memory like execute_opcode_0xFX65()
+			// eax = (rbp + j) & 0xFFF; movzx eax, byte [rbx + rax + memory]
+			emit_alu_rr(jit, X86_MOV, RAX, RBP);
+			emit_alu_ri(jit, X86_EXT_ADD, RAX, j);
+			emit_alu_ri(jit, X86_EXT_AND, RAX, SIZE_MEMORY - 1);
+			emit8(jit, 0x0F);
+			emit8(jit, 0xB6);
+			emit_modrm(jit, 2, RAX, RSP);
+			emit8(jit, (RAX << 3) | RBX);
+			emit32(jit, OFF_MEMORY);
+			store_v(jit, j, RAX);
+		}
+	}
+}
+
+static void translate_terminator(jit_t* jit, const decoded_opcode_t* op, uint16_t address)
+{
+	opcode_class_t op_class = op->op_class;
+
+	if(op_class == OP_1NNN)
+	{
+		emit_flush_v(jit);
+		emit_exit(jit, op->opcode, op->nnn);
+	}
+	else if(op_class == OP_2NNN)
+	{
+		// stack[sp] = pc, sp++
+		emit_load_word(jit, RCX, OFF_SP);
+		// mov word [rbx + rcx * 2 + stack], address
+		emit8(jit, 0x66);
+		emit8(jit, 0xC7);
+		emit_modrm(jit, 2, 0, RSP);
+		emit8(jit, (1 << 6) | (RCX << 3) | RBX);
+		emit32(jit, OFF_STACK);
+		emit16(jit, address);
+		emit_alu_ri(jit, X86_EXT_ADD, RCX, 1);
+		emit_alu_ri(jit, X86_EXT_AND, RCX, SIZE_STACK - 1);
+		emit_store_word(jit, RCX, OFF_SP);
+		emit_flush_v(jit);
+		emit_exit(jit, op->opcode, op->nnn);
+	}
+	else if(op_class == OP_00EE)
+	{
+		// sp--, pc = stack[sp] + 2
+		emit_load_word(jit, RCX, OFF_SP);
+		emit_alu_ri(jit, X86_EXT_SUB, RCX, 1);
+		emit_alu_ri(jit, X86_EXT_AND, RCX, SIZE_STACK - 1);
+		emit_store_word(jit, RCX, OFF_SP);
+		// movzx eax, word [rbx + rcx * 2 + stack]
+		emit8(jit, 0x0F);
+		emit8(jit, 0xB7);
+		emit_modrm(jit, 2, RAX, RSP);
+		emit8(jit, (1 << 6) | (RCX << 3) | RBX);
+		emit32(jit, OFF_STACK);
+		emit_alu_ri(jit, X86_EXT_ADD, RAX, 2);
+		emit_alu_ri(jit, X86_EXT_AND, RAX, 0xFFFF);
+		emit_flush_v(jit);
+		emit_exit_indirect(jit, op->opcode);
+	}
+	else if(op_class == OP_BNNN)
+	{
+		load_v(jit, RAX, 0);
+		emit_alu_ri(jit, X86_EXT_ADD, RAX, op->nnn);
+		emit_flush_v(jit);
+		emit_exit_indirect(jit, op->opcode);
+	}
+	else if(op_class == OP_3XKK || op_class == OP_4XKK)
+	{
+		load_v(jit, RAX, op->x);
+		emit_flush_v(jit);
+		emit_alu_ri(jit, X86_EXT_CMP, RAX, op->kk);
+		emit_skip(jit, op, address, op_class == OP_3XKK ? X86_CC_E : X86_CC_NE);
+	}
+	else if(op_class == OP_5XY0 || op_class == OP_9XY0)
+	{
+		load_v(jit, RAX, op->x);
+		load_v(jit, RCX, op->y);
+		emit_flush_v(jit);
+		emit_alu_rr(jit, X86_CMP, RAX, RCX);
+		emit_skip(jit, op, address, op_class == OP_5XY0 ? X86_CC_E : X86_CC_NE);
+	}
+	else if(op_class == OP_EX9E || op_class == OP_EXA1)
+	{
+		load_v(jit, RAX, op->x);
+		emit_load_word(jit, RCX, OFF_KEYS);
+		emit_flush_v(jit);
+		emit_alu_ri(jit, X86_EXT_AND, RAX, 0xF);
+		// bt ecx, eax: the key's bit lands in CF
+		emit8(jit, 0x0F);
+		emit8(jit, 0xA3);
+		emit_modrm(jit, 3, RAX, RCX);
+		emit_skip(jit, op, address, op_class == OP_EX9E ? X86_CC_B : X86_CC_AE);
+	}
+}
+
+// Generate the entry trampoline and the shared exit path at the start of the buffer
+static void emit_stubs(jit_t* jit)
+{
+	/* uint32_t enter(chip8_t* chip, uint32_t cycles, const void* entry)
+	 * Saves callee-saved registers, loads rbx/r15/rbp and jumps into the translation */
+	jit->enter = (jit_enter_t)(jit->code + jit->used);
+	emit8(jit, 0x53);               // push rbx
+	emit8(jit, 0x55);               // push rbp
+	emit8(jit, 0x41); emit8(jit, 0x54);  // push r12
+	emit8(jit, 0x41); emit8(jit, 0x55);  // push r13
+	emit8(jit, 0x41); emit8(jit, 0x56);  // push r14
+	emit8(jit, 0x41); emit8(jit, 0x57);  // push r15
+	emit8(jit, 0x48); emit8(jit, 0x83); emit8(jit, 0xEC); emit8(jit, 0x08);  // sub rsp, 8
+	emit8(jit, 0x48); emit_alu_rr(jit, X86_MOV, RBX, RDI);  // mov rbx, rdi
+	emit_alu_rr(jit, X86_MOV, R15, RSI);
+	emit_load_word(jit, RBP, OFF_I);
+	emit8(jit, 0xFF); emit8(jit, 0xE2);  // jmp rdx
+
+	// Epilogue: write I back and return the remaining cycle count
+	jit->epilogue = jit->code + jit->used;
+	emit_store_word(jit, RBP, OFF_I);
+	emit_alu_rr(jit, X86_MOV, RAX, R15);
+	emit8(jit, 0x48); emit8(jit, 0x83); emit8(jit, 0xC4); emit8(jit, 0x08);  // add rsp, 8
+	emit8(jit, 0x41); emit8(jit, 0x5F);  // pop r15
+	emit8(jit, 0x41); emit8(jit, 0x5E);  // pop r14
+	emit8(jit, 0x41); emit8(jit, 0x5D);  // pop r13
+	emit8(jit, 0x41); emit8(jit, 0x5C);  // pop r12
+	emit8(jit, 0x5D);               // pop rbp
+	emit8(jit, 0x5B);               // pop rbx
+	emit8(jit, 0xC3);               // ret
+
+	jit->stub_size = jit->used;
+}
+
+// Throw away every translation
+static void jit_flush(jit_t* jit)
+{
+	jit->used = jit->stub_size;
+	jit->num_patches = 0;
+	memset(jit->entry, 0, sizeof(jit->entry));
+	memset(jit->untranslatable, 0, sizeof(jit->untranslatable));
+	memset(jit->code_map, 0, sizeof(jit->code_map));
+}
+
+// Point every jump waiting for start at its translation. With entry NULL, start can't be translated 
+// and the jumps stay exits to jit_run() for good, so they're only dropped
+static void resolve_patches(jit_t* jit, uint16_t start, const uint8_t* entry)
+{
+	for(uint32_t p = 0; p < jit->num_patches; )
+	{
+		if(jit->patches[p].target == start)
+		{
+			if(entry != NULL)
+			{
+				patch_rel32(jit->patches[p].site, entry);
+			}
+			jit->patches[p] = jit->patches[--jit->num_patches];
+		}
+		else
+		{
+			p++;
+		}
+	}
+}
+
+// Translate the block starting at start. Returns its entry point, or NULL if the first
+// instruction has to be interpreted
+static void* translate(jit_t* jit, chip8_t* chip, uint16_t start)
+{
+	const decoded_opcode_t* ops[MAX_BLOCK_LENGTH];
+	uint32_t count = 0;
+	uint16_t address = start;
+	bool terminated = false;
+
+	if(JIT_CODE_SIZE - jit->used < JIT_MAX_BLOCK_BYTES)
+	{
+		jit_flush(jit);
+	}
+
+	while(count < MAX_BLOCK_LENGTH && address < SIZE_MEMORY - 1)
+	{
+		const decoded_opcode_t* op = &decode_table[(chip->memory[address] << 8) | chip->memory[address + 1]];
+		jit_kind_t kind = classify(op->op_class);
+
+		if(kind == JIT_UNSUPPORTED)
+		{
+			break;
+		}
+		ops[count++] = op;
+		address += 2;
+		if(kind == JIT_TERMINATOR)
+		{
+			terminated = true;
+			break;
+		}
+	}
+
+	// Translations (and the decision not to translate) depend on these bytes
+	for(uint16_t byte = start; byte < address || byte < start + 2; byte++)
+	{
+		jit->code_map[byte] = true;
+	}
+
+	if(count == 0)
+	{
+		jit->untranslatable[start] = true;
+		resolve_patches(jit, start, NULL);
+		return NULL;
+	}
+
+	uint8_t* entry = jit->code + jit->used;
+	// Registered before the body is emitted, so a loop back to the block start chains to itself
+	jit->entry[start] = entry;
+
+	// Run the whole block only if the budget covers it: cmp r15d, count / jae body
+	emit_alu_ri(jit, X86_EXT_CMP, R15, count);
+	uint8_t* body = emit_jcc(jit, X86_CC_AE, NULL);
+	emit_store_word_imm(jit, OFF_PC, start);
+	emit_jmp(jit, jit->epilogue);
+	patch_rel32(body, jit->code + jit->used);
+	emit_alu_ri(jit, X86_EXT_SUB, R15, count);
+
+	allocate_v(jit, ops, count);
+	for(uint8_t x = 0; x < NUM_GENERAL_PURPOSE_REGISTERS; x++)
+	{
+		if(jit->vreg[x] >= 0)
+		{
+			emit_load_byte(jit, jit->vreg[x], OFF_V + x);
+		}
+	}
+
+	uint32_t straight = terminated ? count - 1 : count;
+	for(uint32_t k = 0; k < straight; k++)
+	{
+		translate_straight(jit, ops[k]);
+	}
+
+	if(terminated)
+	{
+		translate_terminator(jit, ops[count - 1], address - 2);
+	}
+	else
+	{
+		// Fell off the end: continue at the next (interpreted or not yet translated) instruction
+		emit_flush_v(jit);
+		emit_exit(jit, ops[count - 1]->opcode, address);
+	}
+
+	// Blocks that were waiting for this one can now jump to it directly
+	resolve_patches(jit, start, entry);
+
+	return entry;
+}
+
+jit_t* jit_create(void)
+{
+	jit_t* jit = calloc(1, sizeof(jit_t));
+	if(jit == NULL)
+	{
+		return NULL;
+	}
+
+	jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(jit->code == MAP_FAILED)
+	{
+		free(jit);
+		return NULL;
+	}
+
+	emit_stubs(jit);
+	return jit;
+}
+
+void jit_destroy(jit_t* jit)
+{
+	munmap(jit->code, JIT_CODE_SIZE);
+	free(jit);
+}
+
+void jit_run(chip8_t* chip, uint32_t cycles)
+{
+	jit_t* jit = chip->jit;
+
+	while(cycles > 0)
+	{
+		uint16_t pc = chip->pc;
+		const void* entry = NULL;
+
+		if(in_program(pc) && !jit->untranslatable[pc])
+		{
+			entry = jit->entry[pc];
+			if(entry == NULL)
+			{
+				entry = translate(jit, chip, pc);
+			}
+		}
+
+		if(entry == NULL)
+		{
+			emulate_cycle(chip);
+			cycles--;
+			continue;
+		}
+
+		uint32_t remaining = jit->enter(chip, cycles, entry);
+		if(remaining == cycles)
+		{
+			// Fewer cycles left than the block at pc is long. Finish the budget in the interpreter
+			for(; cycles > 0; cycles--)
+			{
+				emulate_cycle(chip);
+			}
+			return;
+		}
+		cycles = remaining;
+	}
+}
+
+void jit_invalidate(jit_t* jit, uint16_t address, uint16_t length)
+{
+	// Writes into translated code are rare (self-modifying ROMs), so just start over
+	for(uint32_t byte = address; byte < (uint32_t)address + length && byte < SIZE_MEMORY; byte++)
+	{
+		if(jit->code_map[byte])
+		{
+			jit_flush(jit);
+			return;
+		}
+	}
+}
+
+#else
+
+// Generated code is x86-64 only. Other hosts get NULL and fall back to an interpreter
+jit_t* jit_create(void)
+{
+	return NULL;
+}
+
+void jit_destroy(jit_t* jit)
+{
+	(void)jit;
+}
+
+void jit_run(chip8_t* chip, uint32_t cycles)
+{
+	(void)chip;
+	(void)cycles;
+}
+
+void jit_invalidate(jit_t* jit, uint16_t address, uint16_t length)
+{
+	(void)jit;
+	(void)address;
+	(void)length;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "chip8.h"
+
+/* x86-64 dynamic recompiler. Basic blocks of CHIP-8 code are translated into native code on first
+ * use and chained together directly. Anything the translator doesn't cover (DXYN, FX0A, memory
+ * writes, RND...) ends the block and is run by emulate_cycle(). Machine state after every call to
+ * jit_run() is identical to what the interpreter would produce */
+
+// Allocate the code buffer. Returns NULL if this host can't run generated code
+jit_t* jit_create(void);
+void jit_destroy(jit_t* jit);
+// Execute exactly the given number of instructions. chip->jit must be set
+void jit_run(chip8_t* chip, uint32_t cycles);
+// Discard translations if any of the written bytes were translated code
+void jit_invalidate(jit_t* jit, uint16_t address, uint16_t length);
+
+#endif
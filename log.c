@@ -0,0 +1,195 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include "log.h"
+
+// How long the writer thread sleeps when the ring is empty
+#define LOG_IDLE_SLEEP_NSEC 1000000
+
+// One queued message. seq says whose turn it is: equal to the slot's position when free for a
+// producer, position + 1 once the message is ready for the writer
+typedef struct log_record_t
+{
+	atomic_uint seq;
+	uint8_t level;
+	const char* fmt;
+	int32_t args[LOG_MAX_ARGS];
+} log_record_t;
+
+// Bounded multi-producer queue with a sequence number per slot, so producers claim slots with a
+// single compare-and-swap and never wait on each other or on the writer. Positions and sequence
+// numbers are all 32-bit so they wrap together
+static log_record_t ring[LOG_RING_SIZE];
+static atomic_uint head;
+static unsigned int tail;
+static atomic_uint_fast32_t dropped;
+static atomic_bool ring_ready;
+
+static FILE* sink;
+static pthread_t writer;
+static atomic_bool running;
+
+static const char* const level_names[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR"};
+
+/* @brief: Set every slot's sequence number to its index. Done once, by whichever thread gets
+ * here first */
+static void init_ring(void)
+{
+	static atomic_flag claimed = ATOMIC_FLAG_INIT;
+
+	if(atomic_load_explicit(&ring_ready, memory_order_acquire))
+	{
+		return;
+	}
+	if(!atomic_flag_test_and_set(&claimed))
+	{
+		for(uint32_t n = 0; n < LOG_RING_SIZE; n++)
+		{
+			atomic_init(&ring[n].seq, n);
+		}
+		atomic_store_explicit(&ring_ready, true, memory_order_release);
+	}
+	// Another thread is initializing. Spin, this only happens on the very first messages
+	while(!atomic_load_explicit(&ring_ready, memory_order_acquire));
+}
+
+void log_write(uint8_t level, const char* fmt, int32_t a, int32_t b, int32_t c, int32_t d)
+{
+	unsigned int pos;
+	log_record_t* record;
+
+	init_ring();
+	pos = atomic_load_explicit(&head, memory_order_relaxed);
+	for(;;)
+	{
+		record = &ring[pos & (LOG_RING_SIZE - 1)];
+		unsigned int seq = atomic_load_explicit(&record->seq, memory_order_acquire);
+		int32_t diff = (int32_t)(seq - pos);
+
+		if(diff == 0)
+		{
+			// Slot is free, try to claim it. On failure pos is reloaded with the current head
+			if(atomic_compare_exchange_weak_explicit(&head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if(diff < 0)
+		{
+			// Writer hasn't caught up. Drop rather than stall the caller
+			atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+			return;
+		}
+		else
+		{
+			// Another producer took this slot first
+			pos = atomic_load_explicit(&head, memory_order_relaxed);
+		}
+	}
+
+	record->level = level;
+	record->fmt = fmt;
+	record->args[0] = a;
+	record->args[1] = b;
+	record->args[2] = c;
+	record->args[3] = d;
+	// Publish to the writer
+	atomic_store_explicit(&record->seq, pos + 1, memory_order_release);
+}
+
+/* @brief: Format and write every message that is ready
+ * @return: true if anything was written */
+static bool drain(void)
+{
+	bool wrote = false;
+	uint32_t lost;
+
+	for(;;)
+	{
+		log_record_t* record = &ring[tail & (LOG_RING_SIZE - 1)];
+
+		if(atomic_load_explicit(&record->seq, memory_order_acquire) != tail + 1)
+		{
+			break;
+		}
+		fprintf(sink, "[%s] ", level_names[record->level]);
+		// Unused trailing arguments are ignored by fprintf
+		fprintf(sink, record->fmt, record->args[0], record->args[1], record->args[2], record->args[3]);
+		fputc('\n', sink);
+		// Hand the slot back to producers for the next lap around the ring
+		atomic_store_explicit(&record->seq, tail + LOG_RING_SIZE, memory_order_release);
+		tail++;
+		wrote = true;
+	}
+
+	lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+	if(lost != 0)
+	{
+		fprintf(sink, "[WARN] %u log messages dropped\n", lost);
+		wrote = true;
+	}
+	if(wrote)
+	{
+		fflush(sink);
+	}
+	return wrote;
+}
+
+static void* writer_main(void* arg)
+{
+	const struct timespec idle = {0, LOG_IDLE_SLEEP_NSEC};
+
+	(void)arg;
+	while(atomic_load_explicit(&running, memory_order_acquire))
+	{
+		if(!drain())
+		{
+			nanosleep(&idle, NULL);
+		}
+	}
+	// Pick up anything queued between the last pass and shutdown
+	drain();
+	return NULL;
+}
+
+int log_init(const char* path)
+{
+	int retval = 0;
+
+	init_ring();
+	sink = stderr;
+	if(path != NULL)
+	{
+		sink = fopen(path, "w");
+		if(sink == NULL)
+		{
+			// Keep logging, just not where it was asked for
+			fprintf(stderr, "Could not open log file %s, logging to stderr\n", path);
+			sink = stderr;
+			retval = -1;
+		}
+	}
+
+	atomic_store(&running, true);
+	if(pthread_create(&writer, NULL, writer_main, NULL) != 0)
+	{
+		atomic_store(&running, false);
+		return -1;
+	}
+	return retval;
+}
+
+void log_shutdown(void)
+{
+	if(!atomic_exchange(&running, false))
+	{
+		return;
+	}
+	pthread_join(writer, NULL);
+	if(sink != stderr)
+	{
+		fclose(sink);
+	}
+	sink = NULL;
+}
@@ -0,0 +1,69 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Tracing layer. Messages below LOG_LEVEL are removed by the preprocessor, arguments included, so
+ * a release build does no work for them. Messages that remain are copied into a lock-free ring
+ * buffer as a format pointer plus up to 4 integer arguments, and a background thread formats them
+ * and writes them out. The emulation thread never formats, never does I/O and never waits: if the
+ * ring is full the message is dropped and counted.
+ *
+ * Because formatting happens later on another thread, the format must be a string literal and the
+ * arguments must be integers (no %s) */
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_NONE 5
+
+// Lowest level compiled in. Build with -DLOG_LEVEL=LOG_LEVEL_TRACE for the per-instruction trace
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Messages the ring can hold before new ones are dropped. Must be a power of 2
+#define LOG_RING_SIZE 4096
+#define LOG_MAX_ARGS 4
+
+// The trailing zeros fill in missing arguments, so every message passes exactly LOG_MAX_ARGS
+#define LOG_AT(level, fmt, a, b, c, d, ...) log_write(level, fmt, (int32_t)(a), (int32_t)(b), (int32_t)(c), (int32_t)(d))
+#define LOG_MESSAGE(level, ...) LOG_AT(level, __VA_ARGS__, 0, 0, 0, 0, 0)
+
+#if LOG_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) LOG_MESSAGE(LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_MESSAGE(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_MESSAGE(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_MESSAGE(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_MESSAGE(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+// Start the writer thread. path = NULL logs to stderr. Returns 0 on success
+int log_init(const char* path);
+// Write out everything still queued, stop the writer thread and close the sink
+void log_shutdown(void);
+// Queue a message. Safe to call from any thread, and before log_init() (messages wait in the ring)
+void log_write(uint8_t level, const char* fmt, int32_t a, int32_t b, int32_t c, int32_t d);
+
+#endif
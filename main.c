@@ -7,989 +7,1238 @@
 #include <unistd.h>
 #include <SDL2/SDL.h>
 #include "main.h"
+#include "jit.h"
+#include "log.h"
+#include "trace.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "runner.h"
+#include "movie.h"
+#include "profile.h"
+#include "pacer.h"
+#include "audio.h"
+
+// Trace being recorded, closed on exit so buffered records are written out
+static trace_writer_t* open_trace = NULL;
+
+static void close_open_trace(void)
+{
+	trace_close(open_trace);
+}
 
-void initialize_chip(chip8_t* c);
+// Profile being collected and the machine it profiles. Written out on exit
+static profile_t* open_profile = NULL;
+static const chip8_t* profile_chip = NULL;
 
-int main(int argc, char** argv)
+static void close_open_profile(void)
 {
-	chip8_t chip;
-	SDL_Event event;
-	SDL_Window* window = NULL;
-	SDL_Renderer* render = NULL;
+	profile_close(open_profile, profile_chip);
+}
 
-	// If no ROM file is provided, print usage and terminate
-	if(argc != 2)
-	{
-		printf("Usage: %s\n", argv[0]);
-		return 1;
-	}
+// Keyboard layout of the keypad in main.h, indexed by keypad key
+static const SDL_Keycode default_keymap[NUM_KEYS] =
+{
+	SDLK_x, SDLK_1, SDLK_2, SDLK_3,
+	SDLK_q, SDLK_w, SDLK_e, SDLK_a,
+	SDLK_s, SDLK_d, SDLK_z, SDLK_c,
+	SDLK_4, SDLK_r, SDLK_f, SDLK_v,
+};
 
-	setup_graphics(&window, &render);
-	initialize_chip(&chip);
-	load_game(&chip, argv[1]);
+// Frame pacing of the emulation thread. Its statistics are printed on exit, after the thread is joined
+static pacer_t pacer;
 
-	for(;;)
-	{
-		// Emulate 1 cycle	
-		emulate_cycle(&chip);
+static void report_pacer(void)
+{
+	pacer_report(&pacer);
+}
 
-		// Update screen if draw flag is set
-		if(chip.draw_flag)
-		{
-			draw_graphics(&window, &render, &chip);
-			chip.draw_flag = false;
-		}
-		
-		SDL_Delay(DELAY_SDL_60FPS);
-		// Store key press state (Press & release)
-		setup_input(&chip, &event);
-	}
+// Buzzer output. Closed on exit so the callback stops before the process goes away
+static audio_t audio;
 
-	return 0;	
+static void close_audio(void)
+{
+	audio_close(&audio);
 }
 
-void setup_input(chip8_t* chip, SDL_Event* event)
+// Movie being recorded and the machine it records. Finished on exit, which is how the window closes
+static movie_writer_t* open_movie = NULL;
+static const chip8_t* movie_chip = NULL;
+
+static void finish_open_movie(void)
 {
-	// Poll for currently pending events, grabbing next one from event queue if available. Returns 0 if there are none
-	// Automatically removes event in question from queue
-	while(SDL_PollEvent(event) != 0)
-	{
-		// Examines what type of event is being examined
-		switch(event->type)		
-		{
-			// Quit if escape key is press. Note: These macros are defined by the SDL SDK
-			//case SDLK_ESCAPE:
-			case SDL_QUIT:
-				exit(0);
-				break;
-			break;
-			// Take action if key is pressed down
-			case SDL_KEYDOWN:
-				printf("Key pressed down: ");
-				switch (event->key.keysym.sym)
-				{
-					case SDLK_1:
-						chip->key[0x1] = 1;
-						printf("1\r\n");
-						break;
-					case SDLK_2:
-						chip->key[0x2] = 1;
-						printf("2\r\n");
-						break;
-					case SDLK_3:
-						chip->key[0x3] = 1;
-						printf("3\r\n");
-						break;
-					case SDLK_4:
-						chip->key[0xC] = 1;
-						printf("4\r\n");
-						break;
-					case SDLK_q:
-						chip->key[0x4] = 1;
-						printf("q\r\n");
-						break;
-					case SDLK_w:
-						chip->key[0x5] = 1;
-						printf("w\r\n");
-						break;
-					case SDLK_e:
-						chip->key[0x6] = 1;
-						printf("e\r\n");
-						break;
-					case SDLK_r:
-						chip->key[0xD] = 1;
-						printf("r\r\n");
-						break;
-					case SDLK_a:
-						chip->key[0x7] = 1;
-						printf("a\r\n");
-						break;
-					case SDLK_s:
-						chip->key[0x8] = 1;
-						printf("s\r\n");
-						break;
-					case SDLK_d:
-						chip->key[0x9] = 1;
-						printf("d\r\n");
-						break;
-					case SDLK_f:
-						chip->key[0xE] = 1;
-						printf("f\r\n");
-						break;
-					case SDLK_z:
-						chip->key[0xA] = 1;
-						printf("z\r\n");
-						break;
-					case SDLK_x:
-						chip->key[0x0] = 1;
-						printf("x\r\n");
-						break;
-					case SDLK_c:
-						chip->key[0xB] = 1;
-						printf("c\r\n");
-						break;
-					case SDLK_v:
-						chip->key[0xF] = 1;
-						printf("v\r\n");
-						break;
-					break;
-				}
-				break;
-			// Take action if key is released 
-			case SDL_KEYUP:
-				printf("Key released: ");
-				switch (event->key.keysym.sym)
-				{
-					case SDLK_1:
-						chip->key[0x1] = 0;
-						printf("1\r\n");
-						break;
-					case SDLK_2:
-						chip->key[0x2] = 0;
-						printf("2\r\n");
-						break;
-					case SDLK_3:
-						chip->key[0x3] = 0;
-						printf("3\r\n");
-						break;
-					case SDLK_4:
-						chip->key[0xC] = 0;
-						printf("4\r\n");
-						break;
-					case SDLK_q:
-						chip->key[0x4] = 0;
-						printf("q\r\n");
-						break;
-					case SDLK_w:
-						chip->key[0x5] = 0;
-						printf("w\r\n");
-						break;
-					case SDLK_e:
-						chip->key[0x6] = 0;
-						printf("e\r\n");
-						break;
-					case SDLK_r:
-						chip->key[0xD] = 0;
-						printf("r\r\n");
-						break;
-					case SDLK_a:
-						chip->key[0x7] = 0;
-						printf("a\r\n");
-						break;
-					case SDLK_s:
-						chip->key[0x8] = 0;
-						printf("s\r\n");
-						break;
-					case SDLK_d:
-						chip->key[0x9] = 0;
-						printf("d\r\n");
-						break;
-					case SDLK_f:
-						chip->key[0xE] = 0;
-						printf("f\r\n");
-						break;
-					case SDLK_z:
-						chip->key[0xA] = 0;
-						printf("z\r\n");
-						break;
-					case SDLK_x:
-						chip->key[0x0] = 0;
-						printf("x\r\n");
-						break;
-					case SDLK_c:
-						chip->key[0xB] = 0;
-						printf("c\r\n");
-						break;
-					case SDLK_v:
-						chip->key[0xF] = 0;
-						printf("v\r\n");
-						break;
-					break;
-				}
-				break;
-		}
-	}
+	movie_finish(open_movie, movie_chip);
 }
 
-/* @brief: After initializing the system, load ROM into memory
- * @arg chip:
- * @arg game_rom:
- * @return: */
-void load_game(chip8_t* chip, const char* game_rom)
+/* @brief: Compare the state at the end of a movie with the recorded one
+ * @return: 0 if they match, 1 otherwise */
+static int check_movie(const chip8_t* chip, const movie_t* movie)
 {
-	// Open file in read-only/binary mode
-	FILE* file = fopen(game_rom, "rb");
-	uint32_t rom_size = 0;
+	uint64_t hash = chip8_state_hash(chip);
 
-	if(file == NULL)
+	if(hash != movie->state_hash)
 	{
-		printf("Could not open game file\n");
-		exit(1);
-	} 
-
-	// Move file pointer to end of file
-	fseek(file, 0, SEEK_END);
-	// Get the current position of the file pointer, which is file size
-	rom_size = ftell(file);
-	 // Reset file pointer to start. Note: Mandatory, otherwise we won't read from beginning of file
-    	fseek(file, 0, SEEK_SET);
-	
-	// Exit if ROM is too large to store in memory
-	if(rom_size > SIZE_MEMORY - GAME_START_ADDRESS)
-	{
-		printf("Game ROM is too large. Exiting...\n");
-		fclose(file);
-		exit(1);
+		printf("movie: state hash 0x%016llX differs from recorded 0x%016llX\n", (unsigned long long)hash,
+			(unsigned long long)movie->state_hash);
+		return 1;
 	}
-
-	// Copy game logic into memory, starting at memory address 0x200
-	fread(chip->memory + GAME_START_ADDRESS, sizeof(uint8_t), rom_size, file);
-	fclose(file);
+	printf("movie: state hash 0x%016llX matches after %llu frames\n", (unsigned long long)hash, (unsigned long long)movie->frames);
+	return 0;
 }
 
-int setup_graphics(SDL_Window** window, SDL_Renderer** renderer)
+/* @brief: A machine is parked when it sits on FX0A and no key has changed since the wait saw them.
+ * Until the key script changes something, every frame would only re-execute FX0A and tick the timers */
+static bool waiting_for_key(const chip8_t* chip)
 {
-	int retval = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
-	*window = SDL_CreateWindow("Felix's CHIP-8 Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 
-		GFX_XAXIS * GFX_SCALE, GFX_YAXIS * GFX_SCALE, SDL_WINDOW_SHOWN);
-	// Create render for var: window, initialize using first rendering driver available which supports requested features. Use hardware accel if possible
-	*renderer = SDL_CreateRenderer(*window, -1, SDL_RENDERER_ACCELERATED);
-	printf("SDL_Init completed with code: %d\n", retval);
-	return retval;
+	uint16_t opcode = (chip->memory[chip->pc & 0xFFF] << 8) | chip->memory[(chip->pc + 1) & 0xFFF];
+
+	return decode_table[opcode].op_class == OP_FX0A && key_wait_idle(chip);
 }
 
-int draw_graphics(SDL_Window** window, SDL_Renderer** renderer, chip8_t* chip)
+/* @brief: Whether the machine's frames can be skipped while it waits for a key. Traces and profiles
+ * count every FX0A executed, so those runs can't skip them */
+static bool machine_waiting(const chip8_t* chip, const options_t* opts)
 {
-	// Set color for clearing screen to black
-	SDL_SetRenderDrawColor(*renderer, 0, 0, 0, 255);
-	// Clear the renderer with the specified color
-	SDL_RenderClear(*renderer);
-	// Set color for clearing screen to white
-	SDL_SetRenderDrawColor(*renderer, 0, 255, 255, 255);
+	return opts->engine != ENGINE_TRACE && opts->engine != ENGINE_PROFILE && waiting_for_key(chip);
+}
 
-	// Loop through each pixel in the display
-	for(uint8_t y = 0; y < GFX_YAXIS; y++)
-	{
-		for(uint8_t x = 0; x < GFX_XAXIS; x++)
-		{
-			// If the rectangle is set, draw a white rectangle at its location
-			// display[y * 64 + x] != 0
-			if(chip->gfx[y * GFX_XAXIS + x])
-			{
-				// Define the rectangle representing the pixel. A pixel in CHIP-8 is set to 10 pixels
-				// {x coordinate, y coordinate, width, height}
-				SDL_Rect pixel = {x * PIXEL_WIDTH, y * PIXEL_HEIGHT, PIXEL_WIDTH, PIXEL_HEIGHT};	
-				// Draw the rectangle on the renderer
-				SDL_RenderFillRect(*renderer, &pixel);
-			}
-		}	
-	}	
+/* @brief: Whether the SDL thread has anything for an emulation thread parked in FX0A: a keypad
+ * change, a held hotkey or a request to stop */
+static bool input_pending(const emulator_t* emu)
+{
+	input_t* input = emu->input;
 
-	// Present the rendered display
-	SDL_RenderPresent(*renderer);
+	return atomic_load(&input->keys) != emu->chip->keys || atomic_load(&input->rewind) ||
+		atomic_load(&input->state_hotkey) != 0 || !atomic_load(&input->running);
 }
 
-void initialize_chip(chip8_t* chip)
+/* @brief: Sleep through the rest of a frame spent in FX0A, woken by the SDL thread as input arrives
+ * @return: true if input changed and the frame was ended early, false once the frame is nearly over */
+static bool wait_for_keys(emulator_t* emu)
 {
-	// Program counter begins @ 0x200
-	chip->pc = 0x200; 
-	// Reset opcode
-	chip->opcode = 0;
-	// Reset index register
-	chip->i = 0;
-	// Reset stack pointer
-	chip->sp = 0;
-	// Clear draw flag 
-	chip->draw_flag = false;
-	// Clear display
-	memset(chip->gfx, 0, sizeof(chip->gfx));	
-	// Clear stack
-	memset(chip->stack, 0, sizeof(chip->stack));	
-	// Clear registers V0 - VF 
-	memset(chip->v, 0, sizeof(chip->v));	
-	// Clear memory 
-	memset(chip->memory, 0, sizeof(chip->memory));	
-
-	// Load fontset. Should be loaded into memory address 0x50
-	for(int i = 0; i < FONTSET_SIZE; ++i)
+	input_t* input = emu->input;
+	struct timespec until;
+	uint32_t ms;
+	bool pending;
+
+	pthread_mutex_lock(&input->lock);
+	// Checked under the lock, which setup_input() takes to signal, so no change slips in unnoticed
+	while(!(pending = input_pending(emu)) && (ms = pacer_idle_ms(&pacer)) > 0)
 	{
-		chip->memory[i + OFFSET_FONT] = chip8_fontset[i];	
+		clock_gettime(CLOCK_MONOTONIC, &until);
+		until.tv_sec += ms / 1000;
+		until.tv_nsec += (ms % 1000) * 1000000L;
+		if(until.tv_nsec >= 1000000000L)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&input->changed, &input->lock, &until);
 	}
-
-	// Reset timers
-	chip->delay_timer = 0;
-	chip->sound_timer = 0;
+	pthread_mutex_unlock(&input->lock);
+	if(pending)
+	{
+		pacer_restart(&pacer);
+	}
+	return pending;
 }
 
-void emulate_cycle(chip8_t* chip)
+/* @brief: Emulation thread. Runs paced frames until the SDL thread clears input->running, taking
+ * its input from the atomics in input_t and publishing every frame that draws through the handoff
+ * @arg arg: emulator_t
+ * @return: NULL */
+void* run_emulator(void* arg)
 {
-	// Felix: Fetch
-	// Fetch opcode from memory pointed to by PC
-	// Note: Each address has only 1 byte of an opcode, but opcodes are 2 bytes long. Fetch 2 successive bytes and merge them
-	chip->opcode = (chip->memory[chip->pc] << 8) | chip->memory[chip->pc + 1];
-	printf("Fetched opcode 0x: %04X\n", chip->opcode);
-	printf("Program counter 0x: %04X\n", chip->pc);
-	
-	// Felix: Decode
-	// Decode opcode. Look at the most significant nibble
-	switch(chip->opcode & 0xF000)
-	{
-		case 0x0000:
-			switch(chip->opcode & 0x000F)
+	emulator_t* emu = arg;
+	chip8_t* chip = emu->chip;
+	input_t* input = emu->input;
+	SDL_Keycode hotkey;
+	bool rewinding;
+	bool fast_forward;
+	uint32_t frames_shown;
+
+	pacer_init(&pacer);
+	while(atomic_load(&input->running))
+	{
+		// Save states are taken and loaded between frames, never in the middle of one
+		hotkey = atomic_exchange(&input->state_hotkey, 0);
+		if(hotkey != 0)
+		{
+			handle_state_hotkey(chip, &emu->opts, hotkey);
+		}
+		rewinding = atomic_load(&input->rewind);
+		// Fast-forward runs several frames for every one shown: opts.turbo of them, or as many as fit before the deadline
+		fast_forward = (emu->opts.fast_forward || atomic_load(&input->fast_forward)) && !emu->opts.uncapped && !rewinding;
+		frames_shown = fast_forward ? emu->opts.turbo : 1;
+		for(uint32_t emulated = 0; emulated == 0 || emulated < frames_shown ||
+			(frames_shown == TURBO_UNCAPPED && SDL_GetPerformanceCounter() < pacer_deadline(&pacer)); emulated++)
+		{
+			// The movie owns the keypad until it ends
+			if(emu->playing)
 			{
-				// 0x00E0: Clear screen
-				case 0x0000:
-					execute_opcode_0x00E0(chip);
-					break;
-				// 0x00EE: Return from subroutine
-				case 0x000E:
-					execute_opcode_0x00EE(chip);
-					break;
-				default:
-					printf("Unknown opcode: 0x%04X\n", chip->opcode);
+				apply_key_script(chip, &emu->movie->script, emu->frame);
 			}
-		break;
-		// 0x1NNN (JP): Jump to subroutine @ NNN 
-		case 0x1000:
-			execute_opcode_0x1NNN(chip);
-			break;	
-		// 0x2NNN: Call subroutine @ NNN 
-		case 0x2000:
-			execute_opcode_0x2NNN(chip);
-			break;	
-		// 0x3XKK (SE): Skip next instruction if Vx = KK
-		case 0x3000:
-			execute_opcode_0x3XKK(chip);
-			break;	
-		// 0x4XKK (SNE): Skip next instruction if Vx != KK
-		case 0x4000:
-			execute_opcode_0x4XKK(chip);
-			break;	
-		// 0x5XY0 (SE): Skip next instruction if Vx = Vy
-		case 0x5000:
-			execute_opcode_0x5XY0(chip);
-			break;	
-		// 0x6XKK (LD): Places the value KK into register Vx
-		case 0x6000:
-			execute_opcode_0x6XKK(chip);
-			break;	
-		// 0x7XKK (ADD): Adds the value kk to the value of register Vx
-		case 0x7000:
-			execute_opcode_0x7XKK(chip);
-			break;	
-		case 0x8000:
-			switch(chip->opcode & 0x000F)
+			else
 			{
-				// 0x8XY0 (LD): Stores the value of register Vy in register Vx
-				case 0x0000:
-					execute_opcode_0x8XY0(chip);
-					break;
-				// 0x8XY1 (OR): OR operation with Vx and Vy. Result stored in Vx
-				case 0x0001:
-					execute_opcode_0x8XY1(chip);
-					break;
-				// 0x8XY2 (AND): AND operation with Vx and Vy. Result stored in Vx
-				case 0x0002:
-					execute_opcode_0x8XY2(chip);
-					break;
-				// 0x8XY3 (XOR): XOR operation with Vx and Vy. Result stored in Vx
-				case 0x0003:
-					execute_opcode_0x8XY3(chip);
-					break;
-				// 0x8XY4 (ADD): Vx = Vx + Vy 
-				case 0x0004:
-					execute_opcode_0x8XY4(chip);
-					break;
-				// 0x8XY5 (SUB): Vx = Vx - Vy 
-				case 0x0005:
-					execute_opcode_0x8XY5(chip);
-					break;
-				// 0x8XY6 (SHR): If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2.
-				case 0x0006:
-					execute_opcode_0x8XY6(chip);
-					break;
-				// 0x8XY7 (SUBN): If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
-				case 0x0007:
-					execute_opcode_0x8XY7(chip);
-					break;
-				// 0x8XYE (SHL): If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2.
-				case 0x000E:
-					execute_opcode_0x8XYE(chip);
-					break;
-				default:
-					printf("Unknown opcode: 0x%04X\n", chip->opcode);
+				chip->keys = atomic_load(&input->keys);
 			}
-			break;
-		// 0x9XY0 (SNE): The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.
-		case 0x9000:
-			execute_opcode_0x9XY0(chip);
-			break;
-		// 0xANNN (LD): The value of register I is set to NNN
-		case 0xA000:
-			execute_opcode_0xANNN(chip);
-			break;
-		// 0xBNNN (JMP): The program counter is set to nnn plus the value of V0
-		case 0xB000:
-			execute_opcode_0xBNNN(chip);
-			break;
-		// 0xCXKK (RND): Set Vx = random byte AND kk. 
-		case 0xC000:
-			execute_opcode_0xCXKK(chip);
-			break;
-		// 0xDXYN (DRW): Draw a sprite at coordinate (value @ Vx, value @ Vy) with a height of n pixels
-		case 0xD000:
-			execute_opcode_0xDXYN(chip);
-			break;
-		case 0xE000:
-			switch(chip->opcode & 0x00FF)
+			if(open_movie != NULL)
 			{
-				// 0xEX9E (SKP): Skip next instruction if key with the value of Vx is pressed
-				case 0x009E:
-					execute_opcode_0xEX9E(chip);
-					break;
-				// 0xEXA1 (SKNP): Skip next instruction if key with the value of Vx is not pressed
-				case 0x00A1:
-					execute_opcode_0xEXA1(chip);
-					break;
-				default:
-					printf("Unknown opcode: 0x%04X\n", chip->opcode);
+				movie_record(open_movie, chip);
 			}
-			break;
-		case 0xF000:
-			switch(chip->opcode & 0x00FF)
+
+			if(rewinding && emu->rewind != NULL)
 			{
-				// 0xFX07 (LD): The value of DT is placed into Vx.
-				case 0x0007:
-					execute_opcode_0xFX07(chip);
-					break;
-				// 0xFX0A (LD): Wait for a key press, store the value of the key in Vx.
-				case 0x000A:
-					execute_opcode_0xFX0A(chip);
-					break;
-				// 0xFX15 (LD): DT is set equal to the value of Vx.
-				case 0x0015:
-					execute_opcode_0xFX15(chip);
-					break;
-				// 0xFX18 (LD): ST is set equal to the value of Vx.
-				case 0x0018:
-					execute_opcode_0xFX18(chip);
-					break;
-				// 0xFX1E (ADD): The values of I and Vx are added, and the results are stored in I.
-				case 0x001E:
-					execute_opcode_0xFX1E(chip);
-					break;
-				// 0xFX29 (LD): Set I = location of sprite for digit Vx.
-				case 0x0029:
-					execute_opcode_0xFX29(chip);
-					break;
-				// 0xFX33 (LD): Store BCD representation of Vx in memory locations I, I+1, and I+2
-				case 0x0033:
-					execute_opcode_0xFX33(chip);
-					break;
-				// 0xFX55 (LD): Store registers V0 through Vx in memory starting at location I.
-				case 0x0055:
-					execute_opcode_0xFX55(chip);
-					break;
-				// 0xFX65 (LD): Read registers V0 through Vx from memory starting at location I.
-				case 0x0065:
-					execute_opcode_0xFX65(chip);
-					break;
-				default:
-					printf("Unknown opcode: 0x%04X\n", chip->opcode);
+				// Play history backwards. Stays on the oldest frame once it runs out
+				rewind_step_back(emu->rewind, chip);
+			}
+			else
+			{
+				// Run this frame's batch of instructions and tick the timers (@60Hz)
+				run_frame(chip, &emu->opts, &emu->cycle_remainder, pacer_deadline(&pacer));
+				if(emu->rewind != NULL)
+				{
+					rewind_capture(emu->rewind, chip);
+				}
+				emu->frame++;
+			}
+
+			// Hand the keyboard back once the movie is over
+			if(emu->playing && emu->frame == emu->movie->frames)
+			{
+				check_movie(chip, emu->movie);
+				movie_free(emu->movie);
+				emu->playing = false;
+				emu->opts.play_path = NULL;
 			}
+		}
+
+		// The buzzer sounds while the sound timer runs. Only the state at the frame shown is heard
+		audio_buzzer(&audio, chip->sound_timer > 0);
+
+		// Hand a drawn frame to the SDL thread. It only needs waking if it had taken the last one,
+		// otherwise it hasn't got round to that one yet and will find this one instead. Frames
+		// skipped while fast-forwarding are never published
+		if(chip->draw_flag)
+		{
+			if(handoff_publish(emu->handoff, chip->gfx))
+			{
+				SDL_Event event;
+
+				memset(&event, 0, sizeof(event));
+				event.type = emu->frame_event;
+				SDL_PushEvent(&event);
+			}
+			chip->draw_flag = false;
+		}
+
+		// Wait out the rest of the 16.67ms frame. A machine stuck in FX0A sleeps on the input
+		// instead and goes on as soon as the SDL thread reports a change
+		if(emu->playing || rewinding || fast_forward || !machine_waiting(chip, &emu->opts) || !wait_for_keys(emu))
+		{
+			pacer_wait(&pacer);
+		}
 	}
-	
-	// Update timers (@60Hz)
-	handle_delay_timer(chip);
-	//handle_sound_timer(chip);
+	return NULL;
 }
 
-void handle_delay_timer(chip8_t* chip)
+int main(int argc, char** argv)
 {
-	if(chip->delay_timer == 0)
+	// Static so the exit handlers below can still read it after main() returns
+	static chip8_t chip;
+	options_t opts;
+	SDL_Event event;
+	display_t display;
+	// Shared with the emulation thread
+	static input_t input;
+	static frame_handoff_t handoff;
+	emulator_t emu;
+	pthread_condattr_t condattr;
+	pthread_t thread;
+	movie_t movie;
+	bool playing = false;
+
+	// If no ROM file is provided, print usage and terminate
+	if(parse_options(argc, argv, &opts) != 0)
 	{
-		return;
+		printf("Usage: %s [--ips <instructions per second>|uncapped] [--engine step|block|jit|threaded|batch] [--vsync] [--audio-buffer <samples>|--mute] [--turbo <n>|uncapped] [--fast-forward] [--keymap <file>] [--log <file>] [--trace <file>|--profile <file>] [--seed <n>] [--record <movie>|--play <movie>] [--headless [--cycles <n>] [--frames <n>] "
+			"[--until-pc <addr>] [--keys <script>] [--instances <n> [--threads <n>]]] <rom>\n", argv[0]);
+		return 1;
 	}
-	--chip->delay_timer;
-}
 
-void handle_sound_timer(chip8_t* chip)
-{
-	if(chip->delay_timer == 0)
+	// Messages are written out by a background thread. Flush them on every way out, including exit()
+	log_init(opts.log_path);
+	atexit(log_shutdown);
+
+	build_decode_table();
+	// Several machines at once go to the parallel runner, which sets each one up itself
+	if(opts.instances > 1)
 	{
-		return;
+		return run_parallel(&opts);
 	}
-	if(chip->delay_timer == 1)
+	initialize_chip(&chip);
+	if(load_game(&chip, opts.rom_path) != 0)
 	{
-		printf("beep");
+		return 1;
 	}
-	--chip->sound_timer;
-}
+	// A movie replays with the seed and speed it was recorded with
+	if(opts.play_path != NULL)
+	{
+		if(movie_load(&movie, opts.play_path) != 0)
+		{
+			printf("%s is not a readable movie\n", opts.play_path);
+			return 1;
+		}
+		if(movie.rom_hash != chip.rom_hash)
+		{
+			printf("%s was recorded with a different ROM\n", opts.play_path);
+			return 1;
+		}
+		opts.seed = movie.seed;
+		opts.seeded = true;
+		opts.ips = movie.ips;
+		if(opts.max_frames == RUN_FOREVER)
+		{
+			opts.max_frames = movie.frames;
+		}
+		playing = true;
+	}
+	// Headless runs are reproducible by default. Interactive ones get a new sequence every time
+	if(!opts.seeded && !opts.headless)
+	{
+		opts.seed = time(NULL);
+	}
+	chip8_seed(&chip, opts.seed);
+	// Messages only carry 32-bit arguments, so the seed goes in two halves. --seed takes it back in hex
+	LOG_INFO("RND seed 0x%08X%08X", (uint32_t)(opts.seed >> 32), (uint32_t)opts.seed);
+	// Tracing replaces the chosen engine with the recording interpreter
+	if(opts.trace_path != NULL)
+	{
+		chip.trace = trace_open(opts.trace_path);
+		if(chip.trace == NULL)
+		{
+			printf("Could not create trace file %s\n", opts.trace_path);
+			return 1;
+		}
+		open_trace = chip.trace;
+		atexit(close_open_trace);
+		opts.engine = ENGINE_TRACE;
+	}
+	// So does profiling, with the counting interpreter
+	if(opts.profile_path != NULL)
+	{
+		chip.profile = profile_open(opts.profile_path);
+		if(chip.profile == NULL)
+		{
+			printf("Could not create profile files %s and %s.folded\n", opts.profile_path, opts.profile_path);
+			return 1;
+		}
+		open_profile = chip.profile;
+		profile_chip = &chip;
+		atexit(close_open_profile);
+		opts.engine = ENGINE_PROFILE;
+	}
+	opts.engine = attach_engine(&chip, opts.engine);
 
-// 0x0000 (CLS): Clear screen
-void execute_opcode_0x00E0(chip8_t* chip)
-{
-	memset(chip->gfx, 0, sizeof(chip->gfx));
-	chip->pc += 2;
-}
+	// Headless runs never touch SDL, so they work on machines without a display
+	if(opts.headless)
+	{
+		return run_headless(&chip, &opts, playing ? &movie : NULL);
+	}
 
-//Felix
-// 0x00EE (RET): Return from subroutine. The interpreter sets the program counter to the address at the top of the stack, 
-// then subtracts 1 from the stack pointer.
-void execute_opcode_0x00EE(chip8_t* chip)
-{
-	chip->sp--;
-	chip->pc = chip->stack[chip->sp];
-	chip->pc += 2;
-}
+	if(opts.keymap_path != NULL && load_keymap(opts.keymap, opts.keymap_path) != 0)
+	{
+		return 1;
+	}
+	setup_graphics(&display, opts.vsync);
+	// Without a sound device the emulator just runs silent
+	if(!opts.mute && audio_open(&audio, opts.audio_samples) == 0)
+	{
+		atexit(close_audio);
+	}
+	memset(&emu, 0, sizeof(emu));
+	emu.chip = &chip;
+	emu.opts = opts;
+	emu.input = &input;
+	emu.handoff = &handoff;
+	emu.movie = &movie;
+	emu.playing = playing;
+	// Rewind history is only useful to someone playing. It would also break a movie's timeline
+	if(opts.record_path == NULL && opts.play_path == NULL)
+	{
+		emu.rewind = rewind_create();
+	}
+	if(opts.record_path != NULL)
+	{
+		open_movie = movie_create(opts.record_path, &chip, opts.seed, opts.ips);
+		if(open_movie == NULL)
+		{
+			printf("Could not create movie file %s\n", opts.record_path);
+			return 1;
+		}
+		movie_chip = &chip;
+		atexit(finish_open_movie);
+	}
 
-// 0x1NNN (JP): Jump to subroutine @ NNN 
-// Note: Unlike CALL, this only changes PC without updating the stack
-void execute_opcode_0x1NNN(chip8_t* chip)
-{
-	chip->pc = chip->opcode & 0xFFF;
-}
+	atomic_init(&input.keys, 0);
+	atomic_init(&input.rewind, false);
+	atomic_init(&input.fast_forward, false);
+	atomic_init(&input.state_hotkey, 0);
+	atomic_init(&input.running, true);
+	pthread_mutex_init(&input.lock, NULL);
+	// wait_for_keys() times its waits on the same clock as clock_gettime(CLOCK_MONOTONIC)
+	pthread_condattr_init(&condattr);
+	pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&input.changed, &condattr);
+	pthread_condattr_destroy(&condattr);
+	handoff_init(&handoff);
+	emu.frame_event = SDL_RegisterEvents(1);
+
+	// Emulation runs on its own thread, so presenting (and vsync) never holds up a frame
+	atexit(report_pacer);
+	if(pthread_create(&thread, NULL, run_emulator, &emu) != 0)
+	{
+		printf("Could not start the emulation thread\n");
+		return 1;
+	}
+	// The SDL thread only reads input and presents the frames it's handed, sleeping in between
+	while(setup_input(&event, &opts, &input))
+	{
+		if(handoff_take(&handoff))
+		{
+			draw_graphics(&display, handoff_front(&handoff));
+		}
+		SDL_WaitEvent(NULL);
+	}
 
-// Felix: 
-// 0x2NNN (CALL): Call subroutine @ NNN 
-// Place current address of PC on stack, jump to subroutine, increment SP, and update PC
-void execute_opcode_0x2NNN(chip8_t* chip)
-{
-	chip->stack[chip->sp] = chip->pc;
-	chip->sp++;
-	chip->pc = chip->opcode & 0xFFF;
+	// The exit handlers run once main() returns, so the thread has to be done with the machine first
+	pthread_mutex_lock(&input.lock);
+	atomic_store(&input.running, false);
+	pthread_cond_signal(&input.changed);
+	pthread_mutex_unlock(&input.lock);
+	pthread_join(thread, NULL);
+	return 0;	
 }
 
-// 0x3XKK (SE): Skip next instruction if Vx = KK
-void execute_opcode_0x3XKK(chip8_t* chip)
+/* @brief: Give a machine the block cache or JIT its engine runs from
+ * @arg chip:
+ * @arg engine: Requested engine
+ * @return: The engine to run with, ENGINE_BLOCK if the JIT isn't available */
+engine_t attach_engine(chip8_t* chip, engine_t engine)
 {
-	uint8_t vx = chip->v[(chip->opcode & 0x0F00) >> 8];
-	uint8_t byte = chip->opcode & 0x00FF;
-
-	if(vx == byte)
+	// Blocks are decoded (or translated) lazily from the loaded ROM
+	if(engine == ENGINE_JIT)
 	{
-		chip->pc += 2;
+		chip->jit = jit_create();
+		if(chip->jit == NULL)
+		{
+			printf("JIT is not available on this host, using the block engine\n");
+			engine = ENGINE_BLOCK;
+		}
 	}
-	chip->pc += 2;
-}
-
-// 0x4XKK (SNE): Skip next instruction if Vx != KK
-void execute_opcode_0x4XKK(chip8_t* chip)
-{
-	uint8_t vx = chip->v[(chip->opcode & 0x0F00) >> 8];
-	uint8_t byte = chip->opcode & 0x00FF;
-
-	if(vx != byte)
+	if(engine == ENGINE_BLOCK)
 	{
-		chip->pc += 2;
+		chip->cache = create_block_cache();
 	}
-	chip->pc += 2;
+	return engine;
 }
 
-// 0x5XY0 (SE): Skip next instruction if Vx = Vy
-void execute_opcode_0x5XY0(chip8_t* chip)
+/* @brief: Parse command line arguments. The ROM path is always the last argument
+ * @arg argc: Argument count from main()
+ * @arg argv: Argument vector from main()
+ * @arg opts: Parsed options
+ * @return: 0 on success, -1 if the arguments are invalid */
+int parse_options(int argc, char** argv, options_t* opts)
 {
-	uint8_t vx = chip->v[(chip->opcode & 0x0F00) >> 8];
-	uint8_t vy = chip->v[(chip->opcode & 0x00F0) >> 4];
-	if(vx == vy)
+	opts->rom_path = NULL;
+	opts->ips = DEFAULT_IPS;
+	opts->uncapped = false;
+	opts->headless = false;
+	opts->max_cycles = RUN_FOREVER;
+	opts->max_frames = RUN_FOREVER;
+	opts->until_pc = NO_STOP_PC;
+	opts->key_script_path = NULL;
+	memcpy(opts->keymap, default_keymap, sizeof(opts->keymap));
+	opts->keymap_path = NULL;
+	opts->engine = DEFAULT_ENGINE;
+	opts->vsync = false;
+	opts->turbo = DEFAULT_TURBO;
+	opts->fast_forward = false;
+	opts->audio_samples = AUDIO_DEFAULT_SAMPLES;
+	opts->mute = false;
+	opts->log_path = NULL;
+	opts->trace_path = NULL;
+	opts->profile_path = NULL;
+	opts->seed = DEFAULT_SEED;
+	opts->seeded = false;
+	opts->record_path = NULL;
+	opts->play_path = NULL;
+	opts->instances = 1;
+	opts->threads = 0;
+
+	if(argc < 2)
 	{
-		chip->pc += 2;
+		return -1;
 	}
-	chip->pc += 2;
-}
 
-// 0x6XKK (LD): Places the value KK into register Vx
-void execute_opcode_0x6XKK(chip8_t* chip)
-{
-	uint8_t byte = chip->opcode & 0x00FF;
-	chip->v[(chip->opcode & 0x0F00) >> 8] = byte;
-	chip->pc += 2;
-}
-
-// 0x7XKK (ADD): Adds the value kk to the value of register Vx, then stores the result in Vx. (Vx = Vx + kk)
-void execute_opcode_0x7XKK(chip8_t* chip)
-{
-	uint8_t byte = chip->opcode & 0x00FF;
-	chip->v[(chip->opcode & 0x0F00) >> 8] += byte;
-	chip->pc += 2;
-}
+	for(int arg = 1; arg < argc - 1; arg++)
+	{
+		if(strcmp(argv[arg], "--ips") == 0 && arg + 1 < argc - 1)
+		{
+			arg++;
+			if(strcmp(argv[arg], "uncapped") == 0)
+			{
+				opts->uncapped = true;
+			}
+			else
+			{
+				opts->ips = strtoul(argv[arg], NULL, 0);
+				if(opts->ips == 0)
+				{
+					return -1;
+				}
+			}
+		}
+		else if(strcmp(argv[arg], "--engine") == 0 && arg + 1 < argc - 1)
+		{
+			arg++;
+			if(strcmp(argv[arg], "step") == 0)
+			{
+				opts->engine = ENGINE_STEP;
+			}
+			else if(strcmp(argv[arg], "block") == 0)
+			{
+				opts->engine = ENGINE_BLOCK;
+			}
+			else if(strcmp(argv[arg], "jit") == 0)
+			{
+				opts->engine = ENGINE_JIT;
+			}
+			else if(strcmp(argv[arg], "threaded") == 0)
+			{
+				opts->engine = ENGINE_THREADED;
+			}
+			else if(strcmp(argv[arg], "batch") == 0)
+			{
+				opts->engine = ENGINE_BATCH;
+			}
+			else
+			{
+				printf("Unknown engine: %s\n", argv[arg]);
+				return -1;
+			}
+		}
+		else if(strcmp(argv[arg], "--log") == 0 && arg + 1 < argc - 1)
+		{
+			opts->log_path = argv[++arg];
+		}
+		else if(strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc - 1)
+		{
+			opts->trace_path = argv[++arg];
+		}
+		else if(strcmp(argv[arg], "--profile") == 0 && arg + 1 < argc - 1)
+		{
+			opts->profile_path = argv[++arg];
+		}
+		else if(strcmp(argv[arg], "--seed") == 0 && arg + 1 < argc - 1)
+		{
+			opts->seed = strtoull(argv[++arg], NULL, 0);
+			opts->seeded = true;
+		}
+		else if(strcmp(argv[arg], "--vsync") == 0)
+		{
+			opts->vsync = true;
+		}
+		else if(strcmp(argv[arg], "--headless") == 0)
+		{
+			opts->headless = true;
+		}
+		else if(strcmp(argv[arg], "--cycles") == 0 && arg + 1 < argc - 1)
+		{
+			opts->max_cycles = strtoull(argv[++arg], NULL, 0);
+		}
+		else if(strcmp(argv[arg], "--frames") == 0 && arg + 1 < argc - 1)
+		{
+			opts->max_frames = strtoull(argv[++arg], NULL, 0);
+		}
+		else if(strcmp(argv[arg], "--until-pc") == 0 && arg + 1 < argc - 1)
+		{
+			opts->until_pc = strtol(argv[++arg], NULL, 0) & 0xFFFF;
+		}
+		else if(strcmp(argv[arg], "--keys") == 0 && arg + 1 < argc - 1)
+		{
+			opts->key_script_path = argv[++arg];
+		}
+		else if(strcmp(argv[arg], "--turbo") == 0 && arg + 1 < argc - 1)
+		{
+			arg++;
+			if(strcmp(argv[arg], "uncapped") == 0)
+			{
+				opts->turbo = TURBO_UNCAPPED;
+			}
+			else
+			{
+				opts->turbo = strtoul(argv[arg], NULL, 0);
+				if(opts->turbo == 0)
+				{
+					return -1;
+				}
+			}
+		}
+		else if(strcmp(argv[arg], "--audio-buffer") == 0 && arg + 1 < argc - 1)
+		{
+			unsigned long samples = strtoul(argv[++arg], NULL, 0);
 
-// 0x8XY0 (LD): Stores the value of register Vy in register Vx (Vx = Vy)
-void execute_opcode_0x8XY0(chip8_t* chip)
-{
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-	uint8_t vx = chip->v[x];
-	uint8_t vy = chip->v[(chip->opcode & 0x00F0) >> 4];
+			// SDL wants a power of two that fits in 16 bits
+			if(samples == 0 || samples > UINT16_MAX || (samples & (samples - 1)) != 0)
+			{
+				printf("--audio-buffer needs a power of two up to 32768\n");
+				return -1;
+			}
+			opts->audio_samples = samples;
+		}
+		else if(strcmp(argv[arg], "--mute") == 0)
+		{
+			opts->mute = true;
+		}
+		else if(strcmp(argv[arg], "--fast-forward") == 0)
+		{
+			opts->fast_forward = true;
+		}
+		else if(strcmp(argv[arg], "--keymap") == 0 && arg + 1 < argc - 1)
+		{
+			opts->keymap_path = argv[++arg];
+		}
+		else if(strcmp(argv[arg], "--record") == 0 && arg + 1 < argc - 1)
+		{
+			opts->record_path = argv[++arg];
+		}
+		else if(strcmp(argv[arg], "--play") == 0 && arg + 1 < argc - 1)
+		{
+			opts->play_path = argv[++arg];
+		}
+		else if(strcmp(argv[arg], "--instances") == 0 && arg + 1 < argc - 1)
+		{
+			opts->instances = strtoul(argv[++arg], NULL, 0);
+			if(opts->instances == 0)
+			{
+				return -1;
+			}
+		}
+		else if(strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc - 1)
+		{
+			opts->threads = strtoul(argv[++arg], NULL, 0);
+		}
+		else
+		{
+			printf("Unknown option: %s\n", argv[arg]);
+			return -1;
+		}
+	}
 
-	// Load Vy into Vx 
-	chip->v[x] = vy;
-	chip->pc += 2;
-}
+	if(opts->headless)
+	{
+		// Uncapped speed is defined by wall-clock frames, which headless runs don't have
+		if(opts->uncapped)
+		{
+			printf("--ips uncapped cannot be used with --headless\n");
+			return -1;
+		}
+		// A headless run needs at least one way to stop. A movie stops at its end
+		if(opts->max_cycles == RUN_FOREVER && opts->max_frames == RUN_FOREVER && opts->until_pc == NO_STOP_PC &&
+			opts->play_path == NULL)
+		{
+			printf("--headless needs --cycles, --frames, --until-pc or --play\n");
+			return -1;
+		}
+		// Headless frames already run as fast as they can
+		if(opts->fast_forward)
+		{
+			printf("--fast-forward cannot be used with --headless\n");
+			return -1;
+		}
+		// Headless input already comes from a script
+		if(opts->record_path != NULL)
+		{
+			printf("--record cannot be used with --headless\n");
+			return -1;
+		}
+	}
+	// Uncapped already runs the CPU flat out, and its frames take wall-clock time by definition
+	if(opts->uncapped && opts->fast_forward)
+	{
+		printf("--fast-forward cannot be used with --ips uncapped\n");
+		return -1;
+	}
+	if(opts->record_path != NULL || opts->play_path != NULL)
+	{
+		// Frames must hold the same number of instructions every time
+		if(opts->uncapped)
+		{
+			printf("--ips uncapped cannot be used with --record or --play\n");
+			return -1;
+		}
+		if(opts->record_path != NULL && opts->play_path != NULL)
+		{
+			printf("--record and --play cannot be used together\n");
+			return -1;
+		}
+		if(opts->instances > 1 || opts->key_script_path != NULL)
+		{
+			printf("--record and --play cannot be used with --instances or --keys\n");
+			return -1;
+		}
+	}
+	if(opts->instances > 1)
+	{
+		if(!opts->headless)
+		{
+			printf("--instances needs --headless\n");
+			return -1;
+		}
+		// Every instance would record into the same file
+		if(opts->trace_path != NULL || opts->profile_path != NULL)
+		{
+			printf("--trace and --profile cannot be used with --instances\n");
+			return -1;
+		}
+	}
+	// Each replaces the engine with its own interpreter
+	if(opts->trace_path != NULL && opts->profile_path != NULL)
+	{
+		printf("--trace and --profile cannot be used together\n");
+		return -1;
+	}
+	if(opts->engine == ENGINE_BATCH)
+	{
+		if(opts->instances < 2)
+		{
+			printf("--engine batch needs --instances\n");
+			return -1;
+		}
+		// Lanes in a batch only stop at frame boundaries
+		if(opts->until_pc != NO_STOP_PC)
+		{
+			printf("--until-pc cannot be used with --engine batch\n");
+			return -1;
+		}
+	}
 
-// 0x8XY1 (OR): OR operation with Vx and Vy. Result stored in Vx (Vx = Vx OR Vy)
-void execute_opcode_0x8XY1(chip8_t* chip)
-{
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-	uint8_t vx = chip->v[x];
-	uint8_t vy = chip->v[(chip->opcode & 0x00F0) >> 4];
-
-	// Perform OR operation and store in Vx
-	chip->v[x] = vx|vy;
-	// VF must be set to 0, or game quirks may occur 
-	chip->v[0xF] = 0;
-	chip->pc += 2;
+	opts->rom_path = argv[argc - 1];
+	return 0;
 }
 
-// 0x8XY2 (AND): AND operation with Vx and Vy. Result stored in Vx (Vx = Vx AND Vy)
-void execute_opcode_0x8XY2(chip8_t* chip)
+/* @brief: Skip the frames a parked machine would spend in FX0A, up to its next scripted key event.
+ * The cycle count and timers end up exactly where executing those frames would have left them
+ * @return: false once a stop condition is reached */
+static bool park_headless(headless_t* run, const options_t* opts)
 {
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-	uint8_t vx = chip->v[x];
-	uint8_t vy = chip->v[(chip->opcode & 0x00F0) >> 4];
-
-	// Perform AND operation and store in Vx
-	chip->v[x] = vx&vy;
-	// VF must be set to 0, or game quirks may occur 
-	chip->v[0xF] = 0;
-	chip->pc += 2;
-}
+	chip8_t* chip = run->chip;
+	uint64_t wake = run->script.next < run->script.count ? run->script.events[run->script.next].frame : RUN_FOREVER;
 
-// 0x8XY3 (XOR): XOR operation with Vx and Vy. Result stored in Vx (Vx = Vx XOR Vy)
-void execute_opcode_0x8XY3(chip8_t* chip)
-{
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-	uint8_t vx = chip->v[x];
-	uint8_t vy = chip->v[(chip->opcode & 0x00F0) >> 4];
-
-	// Perform XOR operation and store in Vx
-	chip->v[x] = vx^vy;
-	// VF must be set to 0, or game quirks may occur 
-	chip->v[0xF] = 0;
-	chip->pc += 2;
+	// Nothing will ever press a key and only --until-pc could stop it, which FX0A never reaches
+	if(wake == RUN_FOREVER && opts->max_frames == RUN_FOREVER && opts->max_cycles == RUN_FOREVER)
+	{
+		return false;
+	}
+	while(run->frames < wake && run->frames < opts->max_frames)
+	{
+		uint32_t frame_cycles = cycles_for_frame(opts, &run->cycle_remainder);
+		if(frame_cycles >= opts->max_cycles - run->cycles)
+		{
+			run->cycles = opts->max_cycles;
+			return false;
+		}
+		run->cycles += frame_cycles;
+		handle_delay_timer(chip);
+		handle_sound_timer(chip);
+		chip->draw_flag = false;
+		run->frames++;
+		run->parked_frames++;
+	}
+	return run->frames < opts->max_frames;
 }
 
-// 0x8XY4 (ADD): Add Vy to Vx. If sum is greater than 255, VF is set 1 (0 otherwise). Sum stored in Vx 
-void execute_opcode_0x8XY4(chip8_t* chip)
+bool run_headless_frame(headless_t* run, const options_t* opts)
 {
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-	uint8_t vx = chip->v[x];
-	uint8_t y = (chip->opcode & 0x00F0) >> 4;
-	uint8_t vy = chip->v[y];
-	uint16_t sum = vx + vy;
+	chip8_t* chip = run->chip;
 
-	// Perform mathemtical operation first, THEN set value v[0xF]
-	chip->v[x] = sum & 0xFF;
+	if(run->frames >= opts->max_frames)
+	{
+		return false;
+	}
+	apply_key_script(chip, &run->script, run->frames);
+	if(machine_waiting(chip, opts))
+	{
+		return park_headless(run, opts);
+	}
 
-	// Check if sum is greater than 255
-	if(sum > 255) 
+	uint32_t frame_cycles = cycles_for_frame(opts, &run->cycle_remainder);
+	if(opts->until_pc != NO_STOP_PC)
 	{
-		chip->v[0xF] = 1;	
-	} 
+		// The PC has to be checked between every instruction
+		for(uint32_t cycle = 0; cycle < frame_cycles; cycle++)
+		{
+			if(run->cycles == opts->max_cycles || chip->pc == opts->until_pc)
+			{
+				return false;
+			}
+			run_cycles(chip, opts->engine, 1);
+			run->cycles++;
+		}
+	}
 	else
 	{
-		chip->v[0xF] = 0;	
+		if(frame_cycles >= opts->max_cycles - run->cycles)
+		{
+			run_cycles(chip, opts->engine, opts->max_cycles - run->cycles);
+			run->cycles = opts->max_cycles;
+			return false;
+		}
+		run_cycles(chip, opts->engine, frame_cycles);
+		run->cycles += frame_cycles;
 	}
 
-	chip->pc += 2;
+	handle_delay_timer(chip);
+	handle_sound_timer(chip);
+	// Nothing is rendered, so just acknowledge the draw
+	chip->draw_flag = false;
+	run->frames++;
+	return true;
 }
 
-// 0x8XY5 (SUB): If Vx >= Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx.
-// Set Vx = Vx - Vy, set VF = NOT borrow.
-void execute_opcode_0x8XY5(chip8_t* chip)
+/* @brief: Run the ROM without SDL until a stop condition is met, then print a summary
+ * Frames are emulated (not paced), so timers still tick once every opts->ips / 60 cycles
+ * @arg chip: Initialized chip with the game loaded
+ * @arg opts: Speed, stop conditions and key script
+ * @arg movie: Movie to play and check at its end, or NULL
+ * @return: Process exit code */
+int run_headless(chip8_t* chip, const options_t* opts, const movie_t* movie)
 {
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-	uint8_t vx = chip->v[x];
-	uint8_t y = (chip->opcode & 0x00F0) >> 4;
-	uint8_t vy = chip->v[y];
-
-	chip->v[x] = vx - vy;
+	headless_t run = {chip, {NULL, 0, 0}, 0, 0, 0, 0};
+	struct timespec start, end;
+	int result = 0;
 
-	// Check if Vx is greater than Vy
-	if(vx >= vy) 
+	if(movie != NULL)
 	{
-		chip->v[0xF] = 1;	
-	} 
-	else
+		run.script = movie->script;
+	}
+	else if(opts->key_script_path != NULL && load_key_script(&run.script, opts->key_script_path) != 0)
 	{
-		chip->v[0xF] = 0;	
+		return 1;
 	}
 
-	chip->pc += 2;
-}
-
-// 0x8XY6 (SHR): If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. Then Vx is divided by 2.
-void execute_opcode_0x8XY6(chip8_t* chip)
-{
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-	uint8_t vx = chip->v[x];
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while(run_headless_frame(&run, opts))
+	{
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
 
-	// Divide Vx by 2
-	chip->v[x] /= 2;
+	printf("cycles: %llu\n", (unsigned long long)run.cycles);
+	printf("frames: %llu\n", (unsigned long long)run.frames);
+	if(run.parked_frames > 0)
+	{
+		printf("frames parked in FX0A: %llu\n", (unsigned long long)run.parked_frames);
+	}
+	printf("pc: 0x%03X\n", chip->pc);
+	printf("wall time: %.6f s\n", seconds);
+	printf("ips: %.0f\n", seconds > 0 ? run.cycles / seconds : 0.0);
+	printf("gfx hash: 0x%016llX\n", (unsigned long long)hash_gfx(chip));
 
-	// Set VF if appropriate 
-	chip->v[0xF] = (vx & 0x1) ? 1 : 0;
-	chip->pc += 2;
+	if(movie != NULL)
+	{
+		// Stopping anywhere else (--frames, --cycles, --until-pc) has nothing to compare against
+		if(run.frames == movie->frames && run.cycles < opts->max_cycles)
+		{
+			result = check_movie(chip, movie);
+		}
+		return result;
+	}
+	free(run.script.events);
+	return result;
 }
 
-// 0x8XY7 (SUBN): If Vy >= Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
-// Set Vx = Vy - Vx, set VF = NOT borrow.
-void execute_opcode_0x8XY7(chip8_t* chip)
+/* @brief: Load a key script. Each line is "<frame> <key> <state>", e.g. "120 5 1" presses key 5 at frame 120
+ * Key is a hex digit (0-F), state is 1 for down and 0 for up. Lines starting with # are comments.
+ * Events must be in frame order
+ * @arg script: Script to fill. Events are heap allocated
+ * @arg path: Script file
+ * @return: 0 on success, -1 on error */
+int load_key_script(key_script_t* script, const char* path)
 {
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-	uint8_t vx = chip->v[x];
-	uint8_t vy = chip->v[(chip->opcode & 0x00F0) >> 4];
+	FILE* file = fopen(path, "r");
+	char line[128];
+	uint32_t capacity = 0;
 
-	// Subtract Vy from Vx
-	chip->v[x] = vy - vx;
+	if(file == NULL)
+	{
+		printf("Could not open key script %s\n", path);
+		return -1;
+	}
 
-	// Set VF if appropriate 
-	chip->v[0xF] = (vy >= vx) ? 1 : 0;
-	chip->pc += 2;
-}
+	while(fgets(line, sizeof(line), file) != NULL)
+	{
+		unsigned long long frame;
+		unsigned int key, state;
 
-// 0x8XYE (SHL): If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to 0. Then Vx is multiplied by 2.
-// Set Vx = Vx SHL 1.
-void execute_opcode_0x8XYE(chip8_t* chip)
-{
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-	uint8_t vx = chip->v[x];
+		if(line[0] == '#' || line[0] == '\n')
+		{
+			continue;
+		}
+		if(sscanf(line, "%llu %x %u", &frame, &key, &state) != 3 || key >= NUM_KEYS || state > 1)
+		{
+			printf("Bad key script line: %s", line);
+			fclose(file);
+			return -1;
+		}
 
-	// Multiply Vx by 2 by shifting left
-	chip->v[x] <<= 1;
+		if(script->count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 64;
+			script->events = realloc(script->events, capacity * sizeof(key_event_t));
+		}
+		script->events[script->count].frame = frame;
+		script->events[script->count].key = key;
+		script->events[script->count].state = state;
+		script->count++;
+	}
 
-	// Set VF if MSB is set
-	chip->v[0xF] = (vx & 0x80) >> 7;
-	chip->pc += 2;
+	fclose(file);
+	return 0;
 }
 
-// 0x9XY0 (SNE): The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.
-// Skip next instruction if Vx != Vy.
-void execute_opcode_0x9XY0(chip8_t* chip)
+/* @brief: Apply every scripted key event due at or before this frame
+ * @arg chip:
+ * @arg script:
+ * @arg frame: Current frame number */
+void apply_key_script(chip8_t* chip, key_script_t* script, uint64_t frame)
 {
-	uint8_t vx = chip->v[(chip->opcode & 0x0F00) >> 8];
-	uint8_t vy = chip->v[(chip->opcode & 0x00F0) >> 4];
-
-	// Skip next instruction if Vx and Vy are not equal
-	if(vx != vy)
+	while(script->next < script->count && script->events[script->next].frame <= frame)
 	{
-		chip->pc += 2;
+		const key_event_t* event = &script->events[script->next];
+
+		chip->keys = event->state ? chip->keys | (1 << event->key) : chip->keys & ~(1 << event->key);
+		script->next++;
 	}
-	chip->pc += 2;
 }
 
-// 0xANNN (LD): The value of register I is set to NNN
-// Set I = nnn.
-void execute_opcode_0xANNN(chip8_t* chip)
+/* @brief: Change keys of a keymap. Each line is "<key> <keyboard key>", e.g. "5 Up" puts keypad key 5
+ * on the up arrow. Key is a hex digit (0-F) and the keyboard key is an SDL key name. Lines starting with #
+ * are comments, keys not listed keep their mapping
+ * @arg keymap: Keymap to change
+ * @arg path: Keymap file
+ * @return: 0 on success, -1 on error */
+int load_keymap(SDL_Keycode* keymap, const char* path)
 {
-	chip->i = chip->opcode & 0xFFF;
-	chip->pc += 2;
-}
+	FILE* file = fopen(path, "r");
+	char line[128];
 
-// 0xBNNN (JP): The program counter is set to nnn plus the value of V0
-// Jump to location nnn + V0
-void execute_opcode_0xBNNN(chip8_t* chip)
-{
-	uint16_t nibbles = chip->opcode & 0xFFF;
-	chip->pc = nibbles + chip->v[0];
-}
+	if(file == NULL)
+	{
+		printf("Could not open keymap %s\n", path);
+		return -1;
+	}
 
-// 0xCXKK (RND): The interpreter generates a random number from 0 to 255, which is then ANDed with the value kk. The results are stored in Vx. 
-// Set Vx = random byte AND kk.
-void execute_opcode_0xCXKK(chip8_t* chip)
-{
-	srand(time(NULL));	
-	uint8_t random = rand() % 255;
-	uint8_t byte = chip->opcode & 0xFF;	
-	uint8_t x = (chip->opcode & 0xF00) >> 8;
-
-	// AND random number w/ kk
-	chip->v[x] = random & byte;
-	chip->pc += 2;
-}
+	while(fgets(line, sizeof(line), file) != NULL)
+	{
+		unsigned int key;
+		char name[64];
+		SDL_Keycode sym;
 
-// 0xDXYN (DRW): Draw a sprite at coordinate (value @ Vx, value @ Vy) with a height of n pixels (rows). Width locked at 8 pixels. 
-// Each row of 8 pixels read as bit coded starting from memory location I 
-// This function does not change value of I. Current state of pixel XOR'd with current value in memory. 
-// If pixels changed from 1 to 0, VF = 1 (collision detection)
-// In other words, set VF if a new sprite collides with what's already on screen
-void execute_opcode_0xDXYN(chip8_t* chip)
-{
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-	uint8_t y = (chip->opcode & 0x00F0) >> 4;
-	uint8_t height = chip->opcode & 0x000F;	
-
-	uint8_t sprite_byte;
-	uint8_t sprite_pixel;
-	uint32_t screen_pixel;
-	// Wrap around if attempting to draw off-screen per specification
-	uint8_t x_coor = chip->v[x] % GFX_XAXIS;
-	uint8_t y_coor = chip->v[y] % GFX_YAXIS;
-
-	// Reset VF
-	chip->v[0xF] = 0;
-
-	// Loop over each row
-	for(uint8_t row = 0; row < height; row++)
-	{
-		// Fetch pixel value starting from memory location i.
-		sprite_byte = chip->memory[chip->i + row];
-
-		// Loop over 8 bits of one row. Sprites are always 8 pixels wide
-		for(uint8_t column = 0; column < SPRITE_MAX_WIDTH; column++)
-		{
-			// Target each individual bit/pixel of sprite_byte for an AND operation
-			sprite_pixel = sprite_byte & (0x80 >> column);
-			// Determine where on screen we will draw the sprite
-			// x_coor, y_coor = starting positions / row/column = current sprite offset
-			// We multiply by VIDEO_WIDTH to properly convert 2D screen to 1D array. (i.e. first pixel of second row is index 64)
-			screen_pixel = (y_coor + row) * GFX_XAXIS + (x_coor + column);
-			
-			// Check if isolated bit/pixel is set
-			if (sprite_pixel != 0)
-			{
-				// 0xFFFFFFFF = white pixel. If newly-calculated sprite and current state of pixel are both on, a collision has occurred
-				if(chip->gfx[screen_pixel] == 0xFFFFFFFF)
-				{
-					chip->v[0xF] = 1;	
-				}
-				// If pixel is white, turn it black and vice versa. Specification indicates toggling pixel if collision occurs
-				chip->gfx[screen_pixel] ^= 0xFFFFFFFF;
-			}
+		if(line[0] == '#' || line[0] == '\n')
+		{
+			continue;
+		}
+		// Names can have spaces in them ("Left Shift"), so take the rest of the line
+		if(sscanf(line, "%x %63[^\n]", &key, name) != 2 || key >= NUM_KEYS ||
+			(sym = SDL_GetKeyFromName(name)) == SDLK_UNKNOWN)
+		{
+			printf("Bad keymap line: %s", line);
+			fclose(file);
+			return -1;
 		}
+		keymap[key] = sym;
 	}
 
-	// We changed our gfx[] array and thus need to update the screen
-	chip->draw_flag = true;
-	chip->pc += 2;
+	fclose(file);
+	return 0;
 }
 
-// 0xEX9E (SKP): Skip next instruction if key with the value of Vx is pressed.
-// Checks the keyboard, and if the key corresponding to the value of Vx is currently in the down position, PC is increased by 2
-void execute_opcode_0xEX9E(chip8_t* chip)
-{	
-	chip->pc += 2;
-	if(chip->key[chip->v[(chip->opcode & 0x0F00) >> 8]])
+int find_key(const SDL_Keycode* keymap, SDL_Keycode sym)
+{
+	for(int key = 0; key < NUM_KEYS; key++)
 	{
-		chip->pc += 2;
+		if(keymap[key] == sym)
+		{
+			return key;
+		}
 	}
+	return -1;
 }
 
-// 0xEXA1 (SKNP): Skip next instruction if key with the value of Vx is not pressed.
-// Checks the keyboard, and if the key corresponding to the value of Vx is currently in the up position, PC is increased by 2.
-void execute_opcode_0xEXA1(chip8_t* chip)
+/* @brief: Save or load a state slot. F1-F4 save to slots 1-4, F5-F8 load them back. Slots are 
+ * files next to the ROM named <rom>.state<slot>
+ * @arg chip:
+ * @arg opts: For the ROM path
+ * @arg sym: Key pressed
+ * @return: true if the key was a save state hotkey */
+bool handle_state_hotkey(chip8_t* chip, const options_t* opts, SDL_Keycode sym)
 {
-	chip->pc += 2;
-	if(!chip->key[chip->v[(chip->opcode & 0x0F00) >> 8]])
+	char path[FILENAME_MAX];
+	savestate_error_t result;
+	bool save;
+	int slot;
+
+	if(sym >= SDLK_F1 && sym < SDLK_F1 + NUM_SAVE_SLOTS)
 	{
-		chip->pc += 2;
+		save = true;
+		slot = sym - SDLK_F1 + 1;
+	}
+	else if(sym >= SDLK_F1 + NUM_SAVE_SLOTS && sym < SDLK_F1 + 2 * NUM_SAVE_SLOTS)
+	{
+		save = false;
+		slot = sym - SDLK_F1 - NUM_SAVE_SLOTS + 1;
+	}
+	else
+	{
+		return false;
 	}
-}
-
-// 0xFX07 (LD): The value of DT is placed into Vx.
-// Set Vx = delay timer value.
-void execute_opcode_0xFX07(chip8_t* chip)
-{
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
 
-	chip->v[x] = chip->delay_timer;
-	chip->pc += 2;
+	// A movie only replays if the machine runs straight through
+	if(!save && (opts->record_path != NULL || opts->play_path != NULL))
+	{
+		printf("Loading states is disabled while a movie is recording or playing\n");
+		return true;
+	}
+	snprintf(path, sizeof(path), "%s.state%d", opts->rom_path, slot);
+	result = save ? chip8_save_state(chip, path) : chip8_load_state(chip, path);
+	if(result != SAVESTATE_OK)
+	{
+		printf("Could not %s slot %d: %s\n", save ? "save" : "load", slot, savestate_error_string(result));
+	}
+	else
+	{
+		LOG_INFO(save ? "Saved state slot %d" : "Loaded state slot %d", slot);
+	}
+	return true;
 }
 
-// 0xFX0A (LD): Wait for a key press, store the value of the key in Vx.
-// All execution stops until a key is pressed, then the value of that key is stored in Vx.
-void execute_opcode_0xFX0A(chip8_t* chip)
+/* @brief: Handle every pending event on the SDL thread. Keypad and hotkey state goes into input for
+ * the emulation thread, which is woken if it's sleeping in FX0A
+ * @arg event: Scratch event
+ * @arg opts: For the keymap
+ * @arg input: Input shared with the emulation thread
+ * @return: false once the window is closed */
+bool setup_input(SDL_Event* event, const options_t* opts, input_t* input)
 {
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-	uint8_t key_press;
+	bool changed = false;
+	bool running = true;
+	int key;
 
-	// Check all 15 keys for a key press
-	for(uint8_t i = 0; i < NUM_KEYS; i++)
+	// Poll for currently pending events, grabbing next one from event queue if available. Returns 0 if there are none
+	// Automatically removes event in question from queue
+	while(SDL_PollEvent(event) != 0)
 	{
-		key_press = chip->key[i];
-		if(key_press)
+		// Examines what type of event is being examined
+		switch(event->type)		
 		{
-			chip->v[x] = key_press;
-			// Only increment once a key has been pressed to simulate waiting 
-			chip->pc += 2;
-			return;
+			// Quit if escape key is press. Note: These macros are defined by the SDL SDK
+			//case SDLK_ESCAPE:
+			case SDL_QUIT:
+				running = false;
+				break;
+			// Take action if key is pressed down
+			case SDL_KEYDOWN:
+				LOG_DEBUG("Key pressed down: %d", event->key.keysym.sym);
+				changed = true;
+				// Save state hotkeys (F1-F8) are handled by the emulation thread between frames
+				if(event->key.keysym.sym >= SDLK_F1 && event->key.keysym.sym < SDLK_F1 + 2 * NUM_SAVE_SLOTS)
+				{
+					atomic_store(&input->state_hotkey, event->key.keysym.sym);
+					break;
+				}
+				if(event->key.keysym.sym == SDLK_BACKSPACE)
+				{
+					atomic_store(&input->rewind, true);
+					break;
+				}
+				if(event->key.keysym.sym == SDLK_TAB)
+				{
+					atomic_store(&input->fast_forward, true);
+					break;
+				}
+				key = find_key(opts->keymap, event->key.keysym.sym);
+				if(key >= 0)
+				{
+					atomic_fetch_or(&input->keys, 1 << key);
+				}
+				break;
+			// Take action if key is released 
+			case SDL_KEYUP:
+				LOG_DEBUG("Key released: %d", event->key.keysym.sym);
+				changed = true;
+				if(event->key.keysym.sym == SDLK_BACKSPACE)
+				{
+					atomic_store(&input->rewind, false);
+					break;
+				}
+				if(event->key.keysym.sym == SDLK_TAB)
+				{
+					atomic_store(&input->fast_forward, false);
+					break;
+				}
+				key = find_key(opts->keymap, event->key.keysym.sym);
+				if(key >= 0)
+				{
+					atomic_fetch_and(&input->keys, ~(1u << key));
+				}
+				break;
 		}
 	}
+
+	if(changed)
+	{
+		pthread_mutex_lock(&input->lock);
+		pthread_cond_signal(&input->changed);
+		pthread_mutex_unlock(&input->lock);
+	}
+	return running;
 }
 
-// 0xFX15 (LD): DT is set equal to the value of Vx.
-// Set delay timer = Vx.
-void execute_opcode_0xFX15(chip8_t* chip)
+/* @brief: After initializing the system, load ROM into memory
+ * @arg chip:
+ * @arg game_rom:
+ * @return: 0 on success, -1 if the file can't be read or doesn't fit */
+int load_game(chip8_t* chip, const char* game_rom)
 {
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
+	// Open file in read-only/binary mode
+	FILE* file = fopen(game_rom, "rb");
+	uint8_t rom[SIZE_MEMORY - GAME_START_ADDRESS + 1];
+	size_t rom_size;
 
-	chip->delay_timer = chip->v[x];
-	chip->pc += 2;
-}
+	if(file == NULL)
+	{
+		printf("Could not open game file\n");
+		return -1;
+	} 
 
-// 0xFX18 (LD): ST is set equal to the value of Vx.
-// Set sound timer = Vx.
-void execute_opcode_0xFX18(chip8_t* chip)
-{
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
+	// Read one byte more than fits, so an oversized ROM shows up as a short copy
+	rom_size = fread(rom, sizeof(uint8_t), sizeof(rom), file);
+	fclose(file);
 
-	chip->sound_timer = chip->v[x];
-	chip->pc += 2;
+	// Refuse the ROM if it's too large to store in memory
+	if(chip8_load_rom(chip, rom, rom_size) != 0)
+	{
+		printf("Game ROM is too large\n");
+		return -1;
+	}
+	return 0;
 }
 
-// 0xFX1E (ADD): The values of I and Vx are added, and the results are stored in I.
-// Set I = I + Vx.
-void execute_opcode_0xFX1E(chip8_t* chip)
+/* @brief: Open the window and create the streaming texture the display is drawn into
+ * @arg display: Window state to fill in
+ * @arg vsync: Synchronise SDL_RenderPresent() with the display refresh
+ * @return: 0 on success, negative SDL error code otherwise */
+int setup_graphics(display_t* display, bool vsync)
 {
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
+	uint32_t flags = SDL_RENDERER_ACCELERATED;
 
-	chip->i += chip->v[x];
-	chip->pc += 2;
+	int retval = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+	display->window = SDL_CreateWindow("Felix's CHIP-8 Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 
+		GFX_XAXIS * GFX_SCALE, GFX_YAXIS * GFX_SCALE, SDL_WINDOW_SHOWN);
+	if(vsync)
+	{
+		flags |= SDL_RENDERER_PRESENTVSYNC;
+	}
+	// Create render for var: window, initialize using first rendering driver available which supports requested features. Use hardware accel if possible
+	display->renderer = SDL_CreateRenderer(display->window, -1, flags);
+	// Scale the texture up with nearest-neighbour filtering so pixels stay sharp
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+	// One texel per CHIP-8 pixel. Streaming textures are meant to be rewritten often through SDL_LockTexture()
+	display->texture = SDL_CreateTexture(display->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 
+		GFX_XAXIS, GFX_YAXIS);
+	if(display->window == NULL || display->renderer == NULL || display->texture == NULL)
+	{
+		printf("SDL setup failed: %s\n", SDL_GetError());
+		retval = -1;
+	}
+	// Force the first draw_graphics() call to upload
+	memset(display->shown, 0xFF, sizeof(display->shown));
+	LOG_INFO("SDL_Init completed with code: %d", retval);
+	return retval;
 }
 
-// 0xFX29 (LD): The value of I is set to the location for the hexadecimal sprite corresponding to the value of Vx. See section 2.4, Display, for more information on the Chip-8 hexadecimal font.
-// Set I = location of sprite for digit Vx.
-void execute_opcode_0xFX29(chip8_t* chip)
+/* @brief: Upload a framebuffer to the texture if it changed since the last upload and present it 
+ * as one scaled copy
+ * @arg display:
+ * @arg gfx: Rows of the frame, as in chip8_t.gfx */
+void draw_graphics(display_t* display, const uint64_t* gfx)
 {
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-	uint8_t digit = chip->v[x];
+	uint32_t* pixels;
+	int pitch;
 
-	// Fontset begins @ Memory address 0x50, starting with 0. Each individual digit is 5 bytes in size
-	chip->i = (digit * SIZE_FONT_CHAR) + OFFSET_FONT;
-	chip->pc += 2;
+	// Sprites drawn twice in a frame (flicker) set draw_flag without changing anything
+	if(memcmp(display->shown, gfx, sizeof(display->shown)) == 0)
+	{
+		return;
+	}
+	if(SDL_LockTexture(display->texture, NULL, (void**)&pixels, &pitch) == 0)
+	{
+		for(uint8_t y = 0; y < GFX_YAXIS; y++)
+		{
+			// pitch is in bytes and may be wider than the texture
+			uint32_t* line = (uint32_t*)((uint8_t*)pixels + y * pitch);
+			for(uint8_t x = 0; x < GFX_XAXIS; x++)
+			{
+				line[x] = (gfx[y] >> (GFX_XAXIS - 1 - x)) & 1 ? COLOR_PIXEL_ON : COLOR_PIXEL_OFF;
+			}
+		}
+		SDL_UnlockTexture(display->texture);
+		memcpy(display->shown, gfx, sizeof(display->shown));
+	}
+
+	// The texture covers the whole window, so there's no need to clear first. With vsync the present
+	// waits for the refresh, which only holds up this thread
+	SDL_RenderCopy(display->renderer, display->texture, NULL, NULL);
+	SDL_RenderPresent(display->renderer);
 }
 
-// 0xFX33 (LD): Store BCD representation of Vx in memory locations I, I+1, and I+2
-// Example: Integer = 143.  memory[i] = 1, memory[i+1] = 4, memory[i+2] = 3
-void execute_opcode_0xFX33(chip8_t* chip)
+/* @brief: Number of instructions to run in the next 60Hz frame for a capped speed
+ * @arg opts: Options holding the requested instructions per second
+ * @arg remainder: Fractional cycles (in units of 1/USEC_PER_SEC) carried between frames
+ * @return: Cycle count for this frame */
+uint32_t cycles_for_frame(const options_t* opts, uint32_t* remainder)
 {
-	chip->memory[chip->i] = chip->v[(chip->opcode & 0x0F00) >> 8] / 100;
-	chip->memory[chip->i + 1] = (chip->v[(chip->opcode & 0x0F00) >> 8] / 10) % 10;
-	chip->memory[chip->i + 2] = chip->v[(chip->opcode & 0x0F00) >> 8] % 10;
-	chip->pc += 2;
+	return chip8_frame_cycles(opts->ips, remainder);
 }
 
-// 0xFX55 (LD): Store registers V0 through Vx in memory starting at location I.
-// The interpreter copies the values of registers V0 through Vx into memory, starting at the address in I.
-void execute_opcode_0xFX55(chip8_t* chip)
+/* @brief: Emulate one 60Hz frame: a batch of instructions followed by a single timer tick
+ * @arg chip: 
+ * @arg opts: Speed settings
+ * @arg remainder: Fractional cycle carry, see cycles_for_frame()
+ * @arg deadline: SDL_GetPerformanceCounter() value the frame should end at. Used when uncapped */
+void run_frame(chip8_t* chip, const options_t* opts, uint32_t* remainder, uint64_t deadline)
 {
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-
-	for(uint8_t j = 0; j <= x; j++)
+	// Every instruction would be FX0A finding nothing new
+	if(machine_waiting(chip, opts))
 	{
-		chip->memory[chip->i + j] = chip->v[j];
+		cycles_for_frame(opts, remainder);
 	}
-	chip->pc += 2;
-}
-
-// 0xFX65 (LD): Read registers V0 through Vx from memory starting at location I.
-// The interpreter reads values from memory starting at location I into registers V0 through Vx.
-void execute_opcode_0xFX65(chip8_t* chip)
-{
-	uint8_t x = (chip->opcode & 0x0F00) >> 8;
-
-	for(uint8_t j = 0; j <= x; j++)
+	else if(opts->uncapped)
 	{
-		chip->v[j] = chip->memory[chip->i + j];
+		// Keep executing until the frame's time slice is used up, checking the clock once per batch.
+		// A machine in an idle loop would only spin until the timers tick, so leave the rest to the pacer's sleep
+		do
+		{
+			run_cycles(chip, opts->engine, UNCAPPED_BATCH_CYCLES);
+		} while(SDL_GetPerformanceCounter() < deadline && !in_idle_loop(chip));
 	}
-	chip->pc += 2;
+	else
+	{
+		run_cycles(chip, opts->engine, cycles_for_frame(opts, remainder));
+	}
+
+	// Timers count down at 60Hz regardless of CPU speed
+	handle_delay_timer(chip);
+	handle_sound_timer(chip);
 }
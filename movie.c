@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <string.h>
+#include "movie.h"
+#include "savestate.h"
+
+static void put_varint(FILE* file, uint64_t value)
+{
+	while(value >= 0x80)
+	{
+		fputc((uint8_t)(value | 0x80), file);
+		value >>= 7;
+	}
+	fputc((uint8_t)value, file);
+}
+
+static void put_bytes(FILE* file, uint64_t value, uint8_t length)
+{
+	for(uint8_t n = 0; n < length; n++)
+	{
+		fputc((uint8_t)(value >> (n * 8)), file);
+	}
+}
+
+static int get_varint(FILE* file, uint64_t* value)
+{
+	*value = 0;
+	for(uint8_t shift = 0; shift < 64; shift += 7)
+	{
+		int byte = fgetc(file);
+		if(byte == EOF)
+		{
+			return -1;
+		}
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if((byte & 0x80) == 0)
+		{
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int get_bytes(FILE* file, uint64_t* value, uint8_t length)
+{
+	*value = 0;
+	for(uint8_t n = 0; n < length; n++)
+	{
+		int byte = fgetc(file);
+		if(byte == EOF)
+		{
+			return -1;
+		}
+		*value |= (uint64_t)byte << (n * 8);
+	}
+	return 0;
+}
+
+movie_writer_t* movie_create(const char* path, const chip8_t* chip, uint64_t seed, uint32_t ips)
+{
+	movie_writer_t* movie = calloc(1, sizeof(movie_writer_t));
+
+	if(movie == NULL)
+	{
+		return NULL;
+	}
+	movie->file = fopen(path, "wb");
+	if(movie->file == NULL)
+	{
+		free(movie);
+		return NULL;
+	}
+
+	fwrite(MOVIE_MAGIC, 1, 4, movie->file);
+	put_bytes(movie->file, MOVIE_VERSION, 2);
+	put_bytes(movie->file, chip->rom_hash, 8);
+	put_bytes(movie->file, seed, 8);
+	put_bytes(movie->file, ips, 4);
+	return movie;
+}
+
+void movie_record(movie_writer_t* movie, const chip8_t* chip)
+{
+	uint16_t changed = chip->keys ^ movie->keys;
+
+	for(uint8_t key = 0; changed != 0; key++, changed >>= 1)
+	{
+		if(changed & 1)
+		{
+			put_varint(movie->file, movie->frames - movie->last_frame);
+			fputc(key | (((chip->keys >> key) & 1) << 4), movie->file);
+			movie->last_frame = movie->frames;
+		}
+	}
+	movie->keys = chip->keys;
+	movie->frames++;
+}
+
+void movie_finish(movie_writer_t* movie, const chip8_t* chip)
+{
+	put_varint(movie->file, movie->frames - movie->last_frame);
+	fputc(MOVIE_END, movie->file);
+	put_bytes(movie->file, chip8_state_hash(chip), 8);
+	fclose(movie->file);
+	free(movie);
+}
+
+int movie_load(movie_t* movie, const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	char magic[4];
+	uint64_t version, ips;
+	uint64_t frame = 0;
+	uint32_t capacity = 0;
+
+	memset(movie, 0, sizeof(movie_t));
+	if(file == NULL)
+	{
+		return -1;
+	}
+	if(fread(magic, 1, 4, file) != 4 || memcmp(magic, MOVIE_MAGIC, 4) != 0 || get_bytes(file, &version, 2) != 0 ||
+		version != MOVIE_VERSION || get_bytes(file, &movie->rom_hash, 8) != 0 || get_bytes(file, &movie->seed, 8) != 0 ||
+		get_bytes(file, &ips, 4) != 0 || ips == 0)
+	{
+		fclose(file);
+		return -1;
+	}
+	movie->ips = (uint32_t)ips;
+
+	for(;;)
+	{
+		uint64_t delta;
+		int event = EOF;
+
+		if(get_varint(file, &delta) != 0 || (event = fgetc(file)) == EOF)
+		{
+			break;
+		}
+		frame += delta;
+		if(event == MOVIE_END)
+		{
+			movie->frames = frame;
+			if(get_bytes(file, &movie->state_hash, 8) != 0)
+			{
+				break;
+			}
+			fclose(file);
+			return 0;
+		}
+		if((event & 0x0F) >= NUM_KEYS || (event >> 4) > 1)
+		{
+			break;
+		}
+
+		if(movie->script.count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 64;
+			movie->script.events = realloc(movie->script.events, capacity * sizeof(key_event_t));
+		}
+		movie->script.events[movie->script.count].frame = frame;
+		movie->script.events[movie->script.count].key = event & 0x0F;
+		movie->script.events[movie->script.count].state = event >> 4;
+		movie->script.count++;
+	}
+
+	// Truncated (the recording never finished) or corrupt
+	fclose(file);
+	movie_free(movie);
+	return -1;
+}
+
+void movie_free(movie_t* movie)
+{
+	free(movie->script.events);
+	movie->script.events = NULL;
+	movie->script.count = 0;
+}
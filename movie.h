@@ -0,0 +1,56 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "headless.h"
+
+/* Input movies. --record writes every change to the 16 keys, stamped with the frame it was applied
+ * at (keys are read once per frame, before the frame's instructions run). --play feeds the keys
+ * back from the file instead of the keyboard, windowed or headless, and at the last frame compares
+ * a hash of the whole machine state (see chip8_state_hash()) with the one recorded. Movies are
+ * tied to the ROM and store the RND seed and CPU speed they were made with, so playback is exact.
+ *
+ *   "C8MV", u16 version, u64 ROM hash, u64 RND seed, u32 instructions per second
+ *   per key change: varint frames since the previous change, u8 key | (state << 4)
+ *   end: varint frames since the last change, u8 MOVIE_END, u64 final state hash
+ *
+ * Multi-byte fields are little-endian */
+
+#define MOVIE_MAGIC "C8MV"
+// Version 1 movies were recorded before FX0A waited for a release and don't replay the same
+#define MOVIE_VERSION 2
+#define MOVIE_END 0xFF
+
+typedef struct movie_writer_t
+{
+	FILE* file;
+	// Frames recorded so far and the frame of the last change written
+	uint64_t frames;
+	uint64_t last_frame;
+	// Keys as of the last change written, one bit per key like chip8_t.keys
+	uint16_t keys;
+} movie_writer_t;
+
+struct movie_t
+{
+	uint64_t rom_hash;
+	uint64_t seed;
+	uint32_t ips;
+	// Length in frames and the state hash after the last one
+	uint64_t frames;
+	uint64_t state_hash;
+	key_script_t script;
+};
+
+// Create the file and write the header. Returns NULL on failure
+movie_writer_t* movie_create(const char* path, const chip8_t* chip, uint64_t seed, uint32_t ips);
+// Call once per frame, after input is read and before the frame runs
+void movie_record(movie_writer_t* movie, const chip8_t* chip);
+// Write the end of the movie with the state hash of chip, close the file and free the writer
+void movie_finish(movie_writer_t* movie, const chip8_t* chip);
+// Returns 0 on success, -1 if the file can't be read or isn't a valid movie
+int movie_load(movie_t* movie, const char* path);
+void movie_free(movie_t* movie);
+
+#endif
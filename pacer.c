@@ -0,0 +1,111 @@
+#include <math.h>
+#include <stdio.h>
+#include "pacer.h"
+#include "log.h"
+
+void pacer_init(pacer_t* pacer)
+{
+	pacer->frequency = SDL_GetPerformanceFrequency();
+	pacer->start = SDL_GetPerformanceCounter();
+	pacer->frame = 0;
+	pacer->last = pacer->start;
+	pacer->frames = 0;
+	pacer->sum = 0;
+	pacer->sum_squares = 0;
+	pacer->shortest = UINT64_MAX;
+	pacer->longest = 0;
+	pacer->late = 0;
+	pacer->resyncs = 0;
+}
+
+uint64_t pacer_deadline(const pacer_t* pacer)
+{
+	// Multiplying before dividing keeps the fraction of a tick from piling up frame after frame
+	return pacer->start + (pacer->frame + 1) * pacer->frequency / PACER_FPS;
+}
+
+/* @brief: Add one frame's length to the statistics
+ * @arg pacer:
+ * @arg now: Counter value at the end of the frame */
+static void record_frame(pacer_t* pacer, uint64_t now)
+{
+	uint64_t length = now - pacer->last;
+
+	pacer->last = now;
+	pacer->frames++;
+	pacer->sum += length;
+	pacer->sum_squares += (double)length * length;
+	pacer->shortest = length < pacer->shortest ? length : pacer->shortest;
+	pacer->longest = length > pacer->longest ? length : pacer->longest;
+	if(length > PACER_LATE_FACTOR * pacer->frequency / PACER_FPS)
+	{
+		pacer->late++;
+	}
+}
+
+void pacer_wait(pacer_t* pacer)
+{
+	uint64_t deadline = pacer_deadline(pacer);
+	uint64_t spin = pacer->frequency * PACER_SPIN_USEC / 1000000;
+	uint64_t now = SDL_GetPerformanceCounter();
+
+	// Sleep most of the way, then spin up to the deadline
+	if(now + spin < deadline)
+	{
+		SDL_Delay((uint32_t)((deadline - spin - now) * 1000 / pacer->frequency));
+		now = SDL_GetPerformanceCounter();
+	}
+	while(now < deadline)
+	{
+		now = SDL_GetPerformanceCounter();
+	}
+	record_frame(pacer, now);
+
+	pacer->frame++;
+	if(now > deadline + PACER_MAX_LAG_FRAMES * pacer->frequency / PACER_FPS)
+	{
+		pacer->resyncs++;
+		pacer->start = now;
+		pacer->frame = 0;
+	}
+}
+
+uint32_t pacer_idle_ms(const pacer_t* pacer)
+{
+	uint64_t deadline = pacer_deadline(pacer);
+	uint64_t spin = pacer->frequency * PACER_SPIN_USEC / 1000000;
+	uint64_t now = SDL_GetPerformanceCounter();
+
+	// Close to the deadline pacer_wait() has to spin
+	if(now + spin >= deadline)
+	{
+		return 0;
+	}
+	return (uint32_t)((deadline - spin - now) * 1000 / pacer->frequency);
+}
+
+void pacer_restart(pacer_t* pacer)
+{
+	uint64_t now = SDL_GetPerformanceCounter();
+
+	record_frame(pacer, now);
+	pacer->start = now;
+	pacer->frame = 0;
+}
+
+void pacer_report(const pacer_t* pacer)
+{
+	double ms_per_tick = 1000.0 / pacer->frequency;
+	double mean;
+
+	if(pacer->frames == 0)
+	{
+		return;
+	}
+	mean = pacer->sum / pacer->frames;
+	// Log messages only carry integers
+	printf("Frame pacing: %llu frames, mean %.3f ms, jitter %.3f ms, shortest %.3f ms, longest %.3f ms, %llu late, "
+		"%llu resyncs\n", (unsigned long long)pacer->frames, mean * ms_per_tick,
+		sqrt(fmax(pacer->sum_squares / pacer->frames - mean * mean, 0)) * ms_per_tick, pacer->shortest * ms_per_tick,
+		pacer->longest * ms_per_tick, (unsigned long long)pacer->late, (unsigned long long)pacer->resyncs);
+}
@@ -0,0 +1,58 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+/* Frame pacing for the emulation thread. Frame n is due at start + n / 60 s on SDL's performance
+ * counter, so rounding and late frames never accumulate into drift: a frame that overruns is followed
+ * by shorter waits until the schedule is met again. Waiting sleeps in whole milliseconds until
+ * PACER_SPIN_USEC before the deadline (SDL_Delay() can oversleep by about a millisecond), then
+ * spins the rest. A machine that falls more than PACER_MAX_LAG_FRAMES behind (a debugger stop, a
+ * suspended laptop) restarts the schedule from now instead of racing to catch up.
+ *
+ * Presenting happens on the SDL thread, so vsync and compositor stalls never reach this clock.
+ *
+ * A machine waiting for a key can sleep on its input instead for up to pacer_idle_ms(), and start
+ * the next frame as soon as the keys change (pacer_restart()) rather than at the next deadline.
+ *
+ * Every frame's length is recorded, and pacer_report() prints the mean, jitter (standard deviation),
+ * extremes and number of late frames */
+
+#define PACER_FPS 60
+#define PACER_SPIN_USEC 1500
+#define PACER_MAX_LAG_FRAMES 6
+// Frames longer than this many periods count as late in the report
+#define PACER_LATE_FACTOR 1.5
+
+typedef struct pacer_t
+{
+	uint64_t frequency;
+	// Counter value of frame 0 of the current schedule, and frames since then
+	uint64_t start;
+	uint64_t frame;
+	// Frame length statistics, in counter ticks
+	uint64_t last;
+	uint64_t frames;
+	double sum;
+	double sum_squares;
+	uint64_t shortest;
+	uint64_t longest;
+	uint64_t late;
+	uint64_t resyncs;
+} pacer_t;
+
+void pacer_init(pacer_t* pacer);
+// Counter value at which the current frame should end
+uint64_t pacer_deadline(const pacer_t* pacer);
+// Wait for the end of the current frame and start the next one
+void pacer_wait(pacer_t* pacer);
+// Milliseconds the caller can sleep before pacer_wait() has to take over the current frame
+uint32_t pacer_idle_ms(const pacer_t* pacer);
+// End the current frame now and start the schedule again from here
+void pacer_restart(pacer_t* pacer);
+// Print the frame length statistics
+void pacer_report(const pacer_t* pacer);
+
+#endif
@@ -0,0 +1,315 @@
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+// Deepest call path: the top level plus one frame per stack entry
+#define PROFILE_MAX_DEPTH (SIZE_STACK + 1)
+
+static const char* const class_names[NUM_OPCODE_CLASSES] =
+{
+	[OP_UNKNOWN] = "unknown",
+	[OP_00E0] = "00E0",
+	[OP_00EE] = "00EE",
+	[OP_1NNN] = "1NNN",
+	[OP_2NNN] = "2NNN",
+	[OP_3XKK] = "3XKK",
+	[OP_4XKK] = "4XKK",
+	[OP_5XY0] = "5XY0",
+	[OP_6XKK] = "6XKK",
+	[OP_7XKK] = "7XKK",
+	[OP_8XY0] = "8XY0",
+	[OP_8XY1] = "8XY1",
+	[OP_8XY2] = "8XY2",
+	[OP_8XY3] = "8XY3",
+	[OP_8XY4] = "8XY4",
+	[OP_8XY5] = "8XY5",
+	[OP_8XY6] = "8XY6",
+	[OP_8XY7] = "8XY7",
+	[OP_8XYE] = "8XYE",
+	[OP_9XY0] = "9XY0",
+	[OP_ANNN] = "ANNN",
+	[OP_BNNN] = "BNNN",
+	[OP_CXKK] = "CXKK",
+	[OP_DXYN] = "DXYN",
+	[OP_EX9E] = "EX9E",
+	[OP_EXA1] = "EXA1",
+	[OP_FX07] = "FX07",
+	[OP_FX0A] = "FX0A",
+	[OP_FX15] = "FX15",
+	[OP_FX18] = "FX18",
+	[OP_FX1E] = "FX1E",
+	[OP_FX29] = "FX29",
+	[OP_FX33] = "FX33",
+	[OP_FX55] = "FX55",
+	[OP_FX65] = "FX65",
+};
+
+// A count and what it belongs to, for sorting report tables
+typedef struct ranked_t
+{
+	uint32_t key;
+	uint64_t count;
+} ranked_t;
+
+// Instructions charged to one subroutine over all its call paths
+typedef struct subroutine_t
+{
+	uint64_t calls;
+	uint64_t self;
+	uint64_t inclusive;
+} subroutine_t;
+
+profile_t* profile_open(const char* path)
+{
+	char folded_path[FILENAME_MAX];
+	profile_t* profile = calloc(1, sizeof(profile_t));
+
+	if(profile == NULL)
+	{
+		return NULL;
+	}
+	snprintf(folded_path, sizeof(folded_path), "%s.folded", path);
+	profile->report = fopen(path, "w");
+	profile->folded = fopen(folded_path, "w");
+	if(profile->report == NULL || profile->folded == NULL)
+	{
+		if(profile->report != NULL)
+		{
+			fclose(profile->report);
+		}
+		if(profile->folded != NULL)
+		{
+			fclose(profile->folded);
+		}
+		free(profile);
+		return NULL;
+	}
+	// The top level is its own node so everything has somewhere to be charged
+	profile->node_count = 1;
+	return profile;
+}
+
+void profile_count(profile_t* profile, uint16_t pc, opcode_class_t op_class)
+{
+	profile->cycles++;
+	profile->class_counts[op_class]++;
+	profile->address_counts[pc & (SIZE_MEMORY - 1)]++;
+	profile->nodes[profile->current].self++;
+}
+
+void profile_call(profile_t* profile, uint16_t address)
+{
+	uint32_t slot = ((profile->current * 0x9E3779B1u) ^ address) & (PROFILE_HASH_SIZE - 1);
+
+	// Deeper calls than the stack holds wrap its pointer around. The tree stops following them there
+	if(profile->lost_depth > 0 || profile->nodes[profile->current].depth == PROFILE_MAX_DEPTH)
+	{
+		profile->lost_depth++;
+		return;
+	}
+	// Open addressing. The table is twice the node limit, so there's always an empty slot
+	while(profile->children[slot] != 0)
+	{
+		profile_node_t* node = &profile->nodes[profile->children[slot] - 1];
+		if(node->parent == profile->current && node->address == address)
+		{
+			profile->current = profile->children[slot] - 1;
+			node->calls++;
+			return;
+		}
+		slot = (slot + 1) & (PROFILE_HASH_SIZE - 1);
+	}
+	if(profile->node_count == PROFILE_MAX_NODES)
+	{
+		profile->lost_depth = 1;
+		return;
+	}
+
+	profile_node_t* node = &profile->nodes[profile->node_count];
+	node->address = address;
+	node->depth = profile->nodes[profile->current].depth + 1;
+	node->parent = profile->current;
+	node->calls = 1;
+	node->self = 0;
+	profile->children[slot] = ++profile->node_count;
+	profile->current = profile->node_count - 1;
+}
+
+void profile_return(profile_t* profile)
+{
+	if(profile->lost_depth > 0)
+	{
+		profile->lost_depth--;
+	}
+	// A return at the top level is the ROM's bug, there's nothing to unwind
+	else if(profile->current != 0)
+	{
+		profile->current = profile->nodes[profile->current].parent;
+	}
+}
+
+static int compare_ranked(const void* a, const void* b)
+{
+	const ranked_t* x = a;
+	const ranked_t* y = b;
+
+	if(x->count != y->count)
+	{
+		return x->count < y->count ? 1 : -1;
+	}
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static double percent(uint64_t count, uint64_t total)
+{
+	return total > 0 ? 100.0 * count / total : 0.0;
+}
+
+/* @brief: Write one folded-stack line per call path that executed anything itself
+ * @arg profile: */
+static void write_folded(const profile_t* profile)
+{
+	for(uint32_t n = 0; n < profile->node_count; n++)
+	{
+		uint16_t path[PROFILE_MAX_DEPTH + 1];
+		uint32_t depth = 0;
+
+		if(profile->nodes[n].self == 0)
+		{
+			continue;
+		}
+		// Walk up to the top level, then print from there down
+		for(uint32_t node = n; node != 0; node = profile->nodes[node].parent)
+		{
+			path[depth++] = profile->nodes[node].address;
+		}
+		fprintf(profile->folded, "main");
+		while(depth > 0)
+		{
+			fprintf(profile->folded, ";0x%03X", path[--depth]);
+		}
+		fprintf(profile->folded, " %llu\n", (unsigned long long)profile->nodes[n].self);
+	}
+}
+
+/* @brief: Combine every call path of each subroutine. Inclusive counts include callees, but a
+ * recursive subroutine only counts once per path
+ * @arg profile:
+ * @arg subroutines: SIZE_MEMORY entries, zeroed */
+static void sum_subroutines(const profile_t* profile, subroutine_t* subroutines)
+{
+	for(uint32_t n = 1; n < profile->node_count; n++)
+	{
+		const profile_node_t* node = &profile->nodes[n];
+		uint16_t seen[PROFILE_MAX_DEPTH + 1];
+		uint32_t seen_count = 0;
+
+		subroutines[node->address].calls += node->calls;
+		subroutines[node->address].self += node->self;
+		for(uint32_t up = n; up != 0; up = profile->nodes[up].parent)
+		{
+			uint16_t address = profile->nodes[up].address;
+			bool repeat = false;
+
+			for(uint32_t k = 0; k < seen_count; k++)
+			{
+				repeat |= seen[k] == address;
+			}
+			if(!repeat)
+			{
+				seen[seen_count++] = address;
+				subroutines[address].inclusive += node->self;
+			}
+		}
+	}
+}
+
+static void write_report(const profile_t* profile, const chip8_t* chip)
+{
+	FILE* out = profile->report;
+	uint64_t total = profile->cycles;
+	ranked_t* ranked = malloc(SIZE_MEMORY * sizeof(ranked_t));
+	subroutine_t* subroutines = calloc(SIZE_MEMORY, sizeof(subroutine_t));
+	uint32_t count = 0;
+
+	if(ranked == NULL || subroutines == NULL)
+	{
+		free(ranked);
+		free(subroutines);
+		return;
+	}
+	fprintf(out, "Instructions executed: %llu\n", (unsigned long long)total);
+
+	fprintf(out, "\nBy opcode class:\n");
+	for(uint32_t n = 0; n < NUM_OPCODE_CLASSES; n++)
+	{
+		if(profile->class_counts[n] > 0)
+		{
+			ranked[count++] = (ranked_t){n, profile->class_counts[n]};
+		}
+	}
+	qsort(ranked, count, sizeof(ranked_t), compare_ranked);
+	for(uint32_t n = 0; n < count; n++)
+	{
+		fprintf(out, "  %-8s %14llu %6.2f%%\n", class_names[ranked[n].key], (unsigned long long)ranked[n].count,
+			percent(ranked[n].count, total));
+	}
+
+	count = 0;
+	for(uint32_t address = 0; address < SIZE_MEMORY; address++)
+	{
+		if(profile->address_counts[address] > 0)
+		{
+			ranked[count++] = (ranked_t){address, profile->address_counts[address]};
+		}
+	}
+	qsort(ranked, count, sizeof(ranked_t), compare_ranked);
+	fprintf(out, "\nHottest addresses (%u executed):\n", count);
+	for(uint32_t n = 0; n < count && n < PROFILE_TOP_ADDRESSES; n++)
+	{
+		uint16_t address = ranked[n].key;
+		uint16_t opcode = address < SIZE_MEMORY - 1 ? (chip->memory[address] << 8) | chip->memory[address + 1] : 0;
+
+		fprintf(out, "  0x%03X  %04X %14llu %6.2f%%\n", address, opcode, (unsigned long long)ranked[n].count,
+			percent(ranked[n].count, total));
+	}
+
+	sum_subroutines(profile, subroutines);
+	count = 0;
+	for(uint32_t address = 0; address < SIZE_MEMORY; address++)
+	{
+		if(subroutines[address].calls > 0)
+		{
+			ranked[count++] = (ranked_t){address, subroutines[address].inclusive};
+		}
+	}
+	qsort(ranked, count, sizeof(ranked_t), compare_ranked);
+	fprintf(out, "\nSubroutines by instructions including callees:\n");
+	fprintf(out, "  %-6s %12s %14s %8s %14s %8s\n", "addr", "calls", "inclusive", "", "self", "");
+	fprintf(out, "  %-6s %12s %14s %8s %14llu %7.2f%%\n", "main", "", "", "", (unsigned long long)profile->nodes[0].self,
+		percent(profile->nodes[0].self, total));
+	for(uint32_t n = 0; n < count; n++)
+	{
+		const subroutine_t* sub = &subroutines[ranked[n].key];
+
+		fprintf(out, "  0x%03X  %12llu %14llu %7.2f%% %14llu %7.2f%%\n", ranked[n].key, (unsigned long long)sub->calls,
+			(unsigned long long)sub->inclusive, percent(sub->inclusive, total), (unsigned long long)sub->self,
+			percent(sub->self, total));
+	}
+	if(profile->node_count == PROFILE_MAX_NODES)
+	{
+		fprintf(out, "\nMore than %d call paths, later new paths were charged to their callers\n", PROFILE_MAX_NODES);
+	}
+
+	free(ranked);
+	free(subroutines);
+}
+
+void profile_close(profile_t* profile, const chip8_t* chip)
+{
+	write_report(profile, chip);
+	write_folded(profile);
+	fclose(profile->report);
+	fclose(profile->folded);
+	free(profile);
+}
@@ -0,0 +1,64 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "chip8.h"
+
+/* Guest profiler. With --profile (file) every instruction runs through run_profiled(), which counts
+ * it by opcode class and by address, and charges it to the subroutine it ran in. Subroutines are
+ * followed through 2NNN/00EE as a tree of call paths, so the same routine called from two places
+ * shows up under both callers. On exit two files are written:
+ *
+ *   (file)         report: instructions per opcode class, the hottest addresses, and instructions
+ *                  spent in each subroutine (inclusive and self)
+ *   (file).folded  one "main;0x2A4;0x31C count" line per call path, for flamegraph.pl and the like
+ *
+ * Counts are instructions, which at a fixed --ips are also time. Other engines don't profile, so they
+ * pay nothing when it's off */
+
+// Distinct call paths tracked. Calls beyond this are charged to the caller
+#define PROFILE_MAX_NODES 4096
+#define PROFILE_HASH_SIZE (2 * PROFILE_MAX_NODES)
+// Addresses listed in the report
+#define PROFILE_TOP_ADDRESSES 32
+
+// One call path: the subroutine at address, called through the path of parent
+typedef struct profile_node_t
+{
+	uint16_t address;
+	uint16_t depth;
+	uint32_t parent;
+	uint64_t calls;
+	// Instructions executed in this subroutine on this path, not counting its callees
+	uint64_t self;
+} profile_node_t;
+
+typedef struct profile_t
+{
+	FILE* report;
+	FILE* folded;
+	uint64_t cycles;
+	uint64_t class_counts[NUM_OPCODE_CLASSES];
+	uint64_t address_counts[SIZE_MEMORY];
+	// Node 0 is the top level (code not in any subroutine)
+	profile_node_t nodes[PROFILE_MAX_NODES];
+	uint32_t node_count;
+	uint32_t current;
+	// Calls made while the node table was full. Their returns are matched against these first
+	uint32_t lost_depth;
+	// Child lookup: (parent, address) hashed to a node index + 1, 0 when empty
+	uint32_t children[PROFILE_HASH_SIZE];
+} profile_t;
+
+// Create the report and folded-stack files. Returns NULL on failure
+profile_t* profile_open(const char* path);
+// Write both files, close them and free the profile. chip supplies the opcodes shown in the report
+void profile_close(profile_t* profile, const chip8_t* chip);
+// Call before executing the instruction at pc
+void profile_count(profile_t* profile, uint16_t pc, opcode_class_t op_class);
+// Call after a 2NNN or 00EE has executed
+void profile_call(profile_t* profile, uint16_t address);
+void profile_return(profile_t* profile);
+
+#endif
@@ -0,0 +1,299 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+
+#define NUM_DIRTY_PAGES (SIZE_MEMORY / DIRTY_PAGE_SIZE)
+// Page mask, row mask, encoded register size
+#define DELTA_HEADER_SIZE (sizeof(uint64_t) + sizeof(uint32_t) + 1)
+
+/* @brief: Pack everything small that changes from frame to frame
+ * @arg regs: REWIND_REGS_SIZE bytes */
+static void pack_regs(uint8_t* regs, const chip8_t* chip)
+{
+	memcpy(regs, chip->v, NUM_GENERAL_PURPOSE_REGISTERS);
+	regs += NUM_GENERAL_PURPOSE_REGISTERS;
+	memcpy(regs, &chip->i, 2);
+	memcpy(regs + 2, &chip->pc, 2);
+	memcpy(regs + 4, &chip->sp, 2);
+	memcpy(regs + 6, chip->stack, 2 * SIZE_STACK);
+	regs += 6 + 2 * SIZE_STACK;
+	regs[0] = chip->delay_timer;
+	regs[1] = chip->sound_timer;
+	memcpy(regs + 2, &chip->rng_state, 8);
+	memcpy(regs + 10, &chip->key_wait, 2);
+}
+
+static void unpack_regs(chip8_state_t* state, const uint8_t* regs)
+{
+	memcpy(state->v, regs, NUM_GENERAL_PURPOSE_REGISTERS);
+	regs += NUM_GENERAL_PURPOSE_REGISTERS;
+	memcpy(&state->i, regs, 2);
+	memcpy(&state->pc, regs + 2, 2);
+	memcpy(&state->sp, regs + 4, 2);
+	memcpy(state->stack, regs + 6, 2 * SIZE_STACK);
+	regs += 6 + 2 * SIZE_STACK;
+	state->delay_timer = regs[0];
+	state->sound_timer = regs[1];
+	memcpy(&state->rng_state, regs + 2, 8);
+	memcpy(&state->key_wait, regs + 10, 2);
+}
+
+rewind_t* rewind_create(void)
+{
+	rewind_t* rewind = malloc(sizeof(rewind_t));
+
+	if(rewind != NULL)
+	{
+		rewind->first = 0;
+		rewind->count = 0;
+		rewind->since_keyframe = 0;
+		rewind->write = 0;
+	}
+	return rewind;
+}
+
+void rewind_destroy(rewind_t* rewind)
+{
+	free(rewind);
+}
+
+/* @brief: Keyframe layout: registers, display rows, run-length encoded memory
+ * @return: Encoded size */
+static uint32_t encode_keyframe(rewind_t* rewind, const chip8_t* chip, const uint8_t* regs)
+{
+	uint8_t* out = rewind->scratch;
+
+	memcpy(out, regs, REWIND_REGS_SIZE);
+	out += REWIND_REGS_SIZE;
+	memcpy(out, chip->gfx, sizeof(chip->gfx));
+	out += sizeof(chip->gfx);
+	out = rle_encode(out, chip->memory, SIZE_MEMORY);
+
+	chip8_snapshot(chip, &rewind->last);
+	return out - rewind->scratch;
+}
+
+/* @brief: Delta layout: mask of changed pages, mask of changed rows, size of the registers, the 
+ * run-length encoded XOR of the registers with the previous frame's, then the new contents of each 
+ * changed page and row. Only pages and rows marked dirty are compared. Updates rewind->last to the 
+ * current frame
+ * @return: Encoded size */
+static uint32_t encode_delta(rewind_t* rewind, const chip8_t* chip, const uint8_t* regs)
+{
+	uint8_t* out = rewind->scratch + DELTA_HEADER_SIZE;
+	uint8_t changed_regs[REWIND_REGS_SIZE];
+	uint64_t pages = 0;
+	uint32_t rows = 0;
+
+	// Unchanged registers XOR to zero, which the run-length coding squeezes down to a few bytes
+	for(uint32_t n = 0; n < REWIND_REGS_SIZE; n++)
+	{
+		changed_regs[n] = regs[n] ^ rewind->last_regs[n];
+	}
+	out = rle_encode(out, changed_regs, REWIND_REGS_SIZE);
+	rewind->scratch[DELTA_HEADER_SIZE - 1] = (uint8_t)(out - (rewind->scratch + DELTA_HEADER_SIZE));
+
+	// Written isn't the same as changed (sprites erased and redrawn, the same score stored again)
+	for(uint32_t page = 0; page < NUM_DIRTY_PAGES; page++)
+	{
+		const uint8_t* now = chip->memory + page * DIRTY_PAGE_SIZE;
+		uint8_t* before = rewind->last.memory + page * DIRTY_PAGE_SIZE;
+
+		if((chip->dirty_pages & (1ULL << page)) && memcmp(now, before, DIRTY_PAGE_SIZE) != 0)
+		{
+			pages |= 1ULL << page;
+			memcpy(out, now, DIRTY_PAGE_SIZE);
+			memcpy(before, now, DIRTY_PAGE_SIZE);
+			out += DIRTY_PAGE_SIZE;
+		}
+	}
+	for(uint32_t row = 0; row < GFX_YAXIS; row++)
+	{
+		if((chip->dirty_rows & (1U << row)) && chip->gfx[row] != rewind->last.gfx[row])
+		{
+			rows |= 1U << row;
+			memcpy(out, &chip->gfx[row], sizeof(uint64_t));
+			rewind->last.gfx[row] = chip->gfx[row];
+			out += sizeof(uint64_t);
+		}
+	}
+
+	memcpy(rewind->scratch, &pages, sizeof(pages));
+	memcpy(rewind->scratch + sizeof(pages), &rows, sizeof(rows));
+	unpack_regs(&rewind->last, regs);
+	return out - rewind->scratch;
+}
+
+/* @brief: Apply one stored frame to state
+ * @arg state: Frame before (ignored for keyframes), updated in place
+ * @arg regs: Packed registers of the frame before, updated in place
+ * @arg frame: */
+static void apply_frame(const rewind_t* rewind, const rewind_frame_t* frame, chip8_state_t* state, uint8_t* regs)
+{
+	const uint8_t* in = rewind->data + frame->offset;
+	const uint8_t* end = in + frame->size;
+
+	if(frame->keyframe)
+	{
+		memcpy(regs, in, REWIND_REGS_SIZE);
+		in += REWIND_REGS_SIZE;
+		memcpy(state->gfx, in, sizeof(state->gfx));
+		in += sizeof(state->gfx);
+		rle_decode(state->memory, SIZE_MEMORY, in, end);
+	}
+	else
+	{
+		uint8_t changed_regs[REWIND_REGS_SIZE];
+		uint64_t pages;
+		uint32_t rows;
+		const uint8_t* contents = in + DELTA_HEADER_SIZE + in[DELTA_HEADER_SIZE - 1];
+
+		memcpy(&pages, in, sizeof(pages));
+		memcpy(&rows, in + sizeof(pages), sizeof(rows));
+		rle_decode(changed_regs, REWIND_REGS_SIZE, in + DELTA_HEADER_SIZE, contents);
+		for(uint32_t n = 0; n < REWIND_REGS_SIZE; n++)
+		{
+			regs[n] ^= changed_regs[n];
+		}
+
+		for(uint32_t page = 0; page < NUM_DIRTY_PAGES; page++)
+		{
+			if(pages & (1ULL << page))
+			{
+				memcpy(state->memory + page * DIRTY_PAGE_SIZE, contents, DIRTY_PAGE_SIZE);
+				contents += DIRTY_PAGE_SIZE;
+			}
+		}
+		for(uint32_t row = 0; row < GFX_YAXIS; row++)
+		{
+			if(rows & (1U << row))
+			{
+				memcpy(&state->gfx[row], contents, sizeof(uint64_t));
+				contents += sizeof(uint64_t);
+			}
+		}
+	}
+	unpack_regs(state, regs);
+}
+
+/* @brief: Drop the oldest keyframe and the deltas that depend on it */
+static void drop_oldest_group(rewind_t* rewind)
+{
+	do
+	{
+		rewind->first = (rewind->first + 1) % REWIND_MAX_FRAMES;
+		rewind->count--;
+	} while(rewind->count > 0 && !rewind->frames[rewind->first].keyframe);
+}
+
+/* @brief: Make room for size bytes after the newest frame, dropping old history as needed. Frames 
+ * are stored contiguously, so one that doesn't fit before the end of the ring starts over at 0
+ * @return: Offset to store the frame at */
+static uint32_t reserve(rewind_t* rewind, uint32_t size)
+{
+	if(rewind->count == REWIND_MAX_FRAMES)
+	{
+		drop_oldest_group(rewind);
+	}
+	for(;;)
+	{
+		if(rewind->count == 0)
+		{
+			return rewind->write + size <= REWIND_BUFFER_SIZE ? rewind->write : 0;
+		}
+
+		uint32_t oldest = rewind->frames[rewind->first].offset;
+		uint32_t newest = (rewind->first + rewind->count - 1) % REWIND_MAX_FRAMES;
+
+		if(rewind->frames[newest].offset >= oldest)
+		{
+			// Held frames are in order. Free space is after the newest and before the oldest
+			if(rewind->write + size <= REWIND_BUFFER_SIZE)
+			{
+				return rewind->write;
+			}
+			if(size <= oldest)
+			{
+				return 0;
+			}
+		}
+		else if(rewind->write + size <= oldest)
+		{
+			// Newest frames have wrapped around. Free space is between them and the oldest
+			return rewind->write;
+		}
+		drop_oldest_group(rewind);
+	}
+}
+
+void rewind_capture(rewind_t* rewind, chip8_t* chip)
+{
+	uint8_t regs[REWIND_REGS_SIZE];
+	bool keyframe = rewind->count == 0 || rewind->since_keyframe >= REWIND_KEYFRAME_INTERVAL;
+	uint32_t size;
+	uint32_t offset;
+
+	pack_regs(regs, chip);
+	size = keyframe ? encode_keyframe(rewind, chip, regs) : encode_delta(rewind, chip, regs);
+	offset = reserve(rewind, size);
+	// Making room dropped the keyframe this delta was based on
+	if(!keyframe && rewind->count == 0)
+	{
+		keyframe = true;
+		size = encode_keyframe(rewind, chip, regs);
+		offset = reserve(rewind, size);
+	}
+	memcpy(rewind->data + offset, rewind->scratch, size);
+	memcpy(rewind->last_regs, regs, REWIND_REGS_SIZE);
+
+	rewind_frame_t* frame = &rewind->frames[(rewind->first + rewind->count) % REWIND_MAX_FRAMES];
+	frame->offset = offset;
+	frame->size = size;
+	frame->keyframe = keyframe;
+	rewind->count++;
+	rewind->write = offset + size;
+	rewind->since_keyframe = keyframe ? 1 : rewind->since_keyframe + 1;
+
+	chip->dirty_pages = 0;
+	chip->dirty_rows = 0;
+}
+
+bool rewind_step_back(rewind_t* rewind, chip8_t* chip)
+{
+	uint32_t newest;
+	uint32_t keyframe;
+
+	if(rewind->count < 2)
+	{
+		return false;
+	}
+	rewind->count--;
+	newest = (rewind->first + rewind->count - 1) % REWIND_MAX_FRAMES;
+	rewind->write = rewind->frames[newest].offset + rewind->frames[newest].size;
+
+	// Replay from the keyframe the new newest frame is based on
+	newest = rewind->count - 1;
+	keyframe = newest;
+	while(!rewind->frames[(rewind->first + keyframe) % REWIND_MAX_FRAMES].keyframe)
+	{
+		keyframe--;
+	}
+	for(uint32_t n = keyframe; n <= newest; n++)
+	{
+		apply_frame(rewind, &rewind->frames[(rewind->first + n) % REWIND_MAX_FRAMES], &rewind->last, rewind->last_regs);
+	}
+	rewind->since_keyframe = newest - keyframe + 1;
+
+	rewind->last.opcode = (rewind->last.memory[rewind->last.pc & (SIZE_MEMORY - 1)] << 8) |
+		rewind->last.memory[(rewind->last.pc + 1) & (SIZE_MEMORY - 1)];
+	chip8_restore(chip, &rewind->last);
+	// The next delta is taken against the restored frame, which is exactly what last holds
+	chip->dirty_pages = 0;
+	chip->dirty_rows = 0;
+	return true;
+}
+
+double rewind_seconds(const rewind_t* rewind)
+{
+	return (double)rewind->count / REWIND_FPS;
+}
@@ -0,0 +1,60 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "chip8.h"
+#include "savestate.h"
+
+/* Rewind buffer. rewind_capture() runs once per frame and appends the frame to a byte ring, either
+ * as a keyframe (full state, memory run-length encoded) every REWIND_KEYFRAME_INTERVAL frames or as
+ * a delta against the previous frame. Deltas only look at memory pages and display rows the
+ * emulator marked dirty (chip->dirty_pages, chip->dirty_rows), so a typical frame costs a few
+ * dozen bytes and almost no time. When the ring is full the oldest keyframe and its deltas are
+ * dropped. rewind_step_back() rebuilds the previous frame from its keyframe and restores it */
+
+#define REWIND_FPS 60
+#define REWIND_SECONDS 60
+#define REWIND_KEYFRAME_INTERVAL 120
+// Enough frames for REWIND_SECONDS of history even right after the oldest keyframe group is dropped
+#define REWIND_MAX_FRAMES (REWIND_SECONDS * REWIND_FPS + REWIND_KEYFRAME_INTERVAL)
+#define REWIND_BUFFER_SIZE (512 * 1024)
+// Registers, I, PC, SP, stack, timers, RND state and the keys an FX0A wait has seen, packed
+#define REWIND_REGS_SIZE (NUM_GENERAL_PURPOSE_REGISTERS + 2 * 3 + 2 * SIZE_STACK + 2 + 8 + 2)
+// Worst case size of one keyframe or delta
+#define REWIND_MAX_RECORD (8 + 4 + 1 + RLE_MAX_SIZE(REWIND_REGS_SIZE) + sizeof(uint64_t) * GFX_YAXIS + RLE_MAX_SIZE(SIZE_MEMORY))
+
+typedef struct rewind_frame_t
+{
+	// Location of the frame's data in the byte ring
+	uint32_t offset;
+	uint32_t size;
+	bool keyframe;
+} rewind_frame_t;
+
+typedef struct rewind_t
+{
+	rewind_frame_t frames[REWIND_MAX_FRAMES];
+	// Oldest frame in frames[] and number of frames held
+	uint32_t first;
+	uint32_t count;
+	// Frames captured since the newest keyframe
+	uint32_t since_keyframe;
+	// Where the next frame's data goes
+	uint32_t write;
+	// State at the newest frame, which the next delta is taken against
+	chip8_state_t last;
+	uint8_t last_regs[REWIND_REGS_SIZE];
+	// Encoding space for the frame being captured
+	uint8_t scratch[REWIND_MAX_RECORD];
+	uint8_t data[REWIND_BUFFER_SIZE];
+} rewind_t;
+
+rewind_t* rewind_create(void);
+void rewind_destroy(rewind_t* rewind);
+// Record the current frame and clear the chip's dirty marks
+void rewind_capture(rewind_t* rewind, chip8_t* chip);
+// Drop the newest frame and restore the one before it. Returns false if there's no history left
+bool rewind_step_back(rewind_t* rewind, chip8_t* chip);
+// Seconds of history currently held
+double rewind_seconds(const rewind_t* rewind);
+
+#endif
@@ -0,0 +1,430 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "runner.h"
+#include "jit.h"
+#include "batch.h"
+
+/* Work-stealing deque of work units (Chase-Lev). The owning worker pushes and pops at the bottom,
+ * thieves take from the top, and only the last item is ever contended. A unit is in at most one
+ * deque at a time, so capacity for every unit is enough and the ring never grows */
+typedef struct work_deque_t
+{
+	atomic_llong top;
+	// Keeps thieves' writes to top off the owner's cache line
+	char pad[64 - sizeof(atomic_llong)];
+	atomic_llong bottom;
+	int64_t mask;
+	atomic_uint* items;
+} work_deque_t;
+
+typedef struct runner_t
+{
+	const options_t* opts;
+	headless_t* runs;
+	// With --engine batch a unit of work is a batch of RUNNER_BATCH_LANES machines, otherwise one machine
+	batch_t** batches;
+	work_deque_t* deques;
+	uint32_t num_workers;
+	// Units that haven't reached a stop condition
+	atomic_uint remaining;
+} runner_t;
+
+typedef struct worker_t
+{
+	runner_t* runner;
+	pthread_t thread;
+	uint32_t index;
+	// Picks the first victim to steal from
+	uint32_t victim_seed;
+	uint64_t slices;
+	uint64_t steals;
+} worker_t;
+
+static void deque_push(work_deque_t* deque, uint32_t item)
+{
+	int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+
+	atomic_store_explicit(&deque->items[bottom & deque->mask], item, memory_order_relaxed);
+	// The machine's state and the item must be visible before a thief can see the new bottom
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+static bool deque_pop(work_deque_t* deque, uint32_t* item)
+{
+	int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+	int64_t top;
+	bool taken = true;
+
+	atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+	if(top > bottom)
+	{
+		atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+		return false;
+	}
+	*item = atomic_load_explicit(&deque->items[bottom & deque->mask], memory_order_relaxed);
+	if(top == bottom)
+	{
+		// Last item. A thief may be after it too, whoever moves top first gets it
+		taken = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+		atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+	}
+	return taken;
+}
+
+static bool deque_steal(work_deque_t* deque, uint32_t* item)
+{
+	int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+	if(top >= bottom)
+	{
+		return false;
+	}
+	*item = atomic_load_explicit(&deque->items[top & deque->mask], memory_order_relaxed);
+	return atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+/* @brief: Take a machine from another worker, trying each once starting from a random one */
+static bool steal_work(worker_t* worker, uint32_t* item)
+{
+	runner_t* runner = worker->runner;
+
+	worker->victim_seed = worker->victim_seed * 1103515245 + 12345;
+	for(uint32_t n = 0; n < runner->num_workers; n++)
+	{
+		uint32_t victim = (worker->victim_seed + n) % runner->num_workers;
+
+		if(victim != worker->index && deque_steal(&runner->deques[victim], item))
+		{
+			worker->steals++;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* @brief: Run one slice of a machine
+ * @return: false once the machine has stopped */
+static bool run_slice(runner_t* runner, headless_t* run)
+{
+	for(uint32_t frame = 0; frame < RUNNER_SLICE_FRAMES; frame++)
+	{
+		if(!run_headless_frame(run, runner->opts))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/* @brief: Run one slice of a batch. Its machines share the stop conditions and the frame clock, so
+ * the first one's counters stand for all of them
+ * @return: false once the batch has stopped */
+static bool run_batch_slice(runner_t* runner, uint32_t unit)
+{
+	const options_t* opts = runner->opts;
+	batch_t* batch = runner->batches[unit];
+	headless_t* runs = &runner->runs[unit * RUNNER_BATCH_LANES];
+	headless_t* lead = &runs[0];
+	bool running = true;
+
+	for(uint32_t frame = 0; frame < RUNNER_SLICE_FRAMES && running; frame++)
+	{
+		if(lead->frames >= opts->max_frames)
+		{
+			running = false;
+			break;
+		}
+		for(uint32_t lane = 0; lane < batch->count; lane++)
+		{
+			apply_key_script(&batch->chips[lane], &runs[lane].script, lead->frames);
+		}
+
+		uint32_t frame_cycles = cycles_for_frame(opts, &lead->cycle_remainder);
+		if(frame_cycles >= opts->max_cycles - lead->cycles)
+		{
+			batch_run(batch, opts->max_cycles - lead->cycles);
+			lead->cycles = opts->max_cycles;
+			running = false;
+			break;
+		}
+		batch_run(batch, frame_cycles);
+		batch_tick_timers(batch);
+		lead->cycles += frame_cycles;
+		lead->frames++;
+	}
+
+	for(uint32_t lane = 1; lane < batch->count; lane++)
+	{
+		runs[lane].cycles = lead->cycles;
+		runs[lane].frames = lead->frames;
+	}
+	if(!running)
+	{
+		batch_sync(batch);
+	}
+	return running;
+}
+
+static void* worker_main(void* arg)
+{
+	worker_t* worker = arg;
+	runner_t* runner = worker->runner;
+	work_deque_t* own = &runner->deques[worker->index];
+	const struct timespec idle = {0, RUNNER_IDLE_SLEEP_NSEC};
+	uint32_t item;
+
+	while(atomic_load_explicit(&runner->remaining, memory_order_acquire) > 0)
+	{
+		if(deque_pop(own, &item) || steal_work(worker, &item))
+		{
+			bool running;
+
+			worker->slices++;
+			if(runner->batches != NULL)
+			{
+				running = run_batch_slice(runner, item);
+			}
+			else
+			{
+				running = run_slice(runner, &runner->runs[item]);
+			}
+			if(running)
+			{
+				deque_push(own, item);
+			}
+			else
+			{
+				atomic_fetch_sub_explicit(&runner->remaining, 1, memory_order_release);
+			}
+		}
+		else
+		{
+			// Everything left is being run by other workers
+			nanosleep(&idle, NULL);
+		}
+	}
+	return NULL;
+}
+
+/* @brief: Free everything run_parallel() allocated, including the machines' engine state. Works on a
+ * runner that was only partly set up
+ * @arg runner:
+ * @arg num_units: Work units batches[] was sized for
+ * @arg chips: Machines when not batched (NULL otherwise)
+ * @arg workers: */
+static void free_runner(runner_t* runner, uint32_t num_units, chip8_t* chips, worker_t* workers)
+{
+	for(uint32_t n = 0; runner->runs != NULL && n < runner->opts->instances; n++)
+	{
+		chip8_t* chip = runner->runs[n].chip;
+
+		if(chip != NULL && chip->cache != NULL)
+		{
+			destroy_block_cache(chip->cache);
+		}
+		if(chip != NULL && chip->jit != NULL)
+		{
+			jit_destroy(chip->jit);
+		}
+	}
+	for(uint32_t n = 0; runner->deques != NULL && n < runner->num_workers; n++)
+	{
+		free(runner->deques[n].items);
+	}
+	for(uint32_t unit = 0; runner->batches != NULL && unit < num_units; unit++)
+	{
+		batch_destroy(runner->batches[unit]);
+	}
+	free(runner->batches);
+	free(workers);
+	free(runner->deques);
+	free(runner->runs);
+	free(chips);
+}
+
+int run_parallel(const options_t* opts)
+{
+	options_t run_opts = *opts;
+	uint32_t num_instances = opts->instances;
+	uint32_t num_units = num_instances;
+	uint32_t num_workers = opts->threads;
+	key_script_t script = {NULL, 0, 0};
+	chip8_t rom;
+	chip8_t* chips = NULL;
+	worker_t* workers;
+	runner_t runner;
+	uint32_t started;
+	int64_t capacity = 1;
+	uint64_t total_cycles = 0;
+	uint64_t total_parked = 0;
+	uint64_t total_steals = 0;
+	struct timespec start, end;
+
+	if(num_workers == 0)
+	{
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		num_workers = cores > 0 ? (uint32_t)cores : 1;
+	}
+	if(opts->engine == ENGINE_BATCH)
+	{
+		num_units = (num_instances + RUNNER_BATCH_LANES - 1) / RUNNER_BATCH_LANES;
+	}
+	if(num_workers > num_units)
+	{
+		num_workers = num_units;
+	}
+	if(opts->key_script_path != NULL && load_key_script(&script, opts->key_script_path) != 0)
+	{
+		free(script.events);
+		return 1;
+	}
+	while(capacity < num_units)
+	{
+		capacity *= 2;
+	}
+
+	// Read the ROM once and copy the loaded machine
+	initialize_chip(&rom);
+	if(load_game(&rom, opts->rom_path) != 0)
+	{
+		free(script.events);
+		return 1;
+	}
+
+	runner.opts = &run_opts;
+	runner.num_workers = num_workers;
+	runner.runs = calloc(num_instances, sizeof(headless_t));
+	runner.batches = NULL;
+	runner.deques = calloc(num_workers, sizeof(work_deque_t));
+	workers = calloc(num_workers, sizeof(worker_t));
+	// Batches hold their own machines
+	if(opts->engine == ENGINE_BATCH)
+	{
+		runner.batches = calloc(num_units, sizeof(batch_t*));
+	}
+	else
+	{
+		chips = malloc(num_instances * sizeof(chip8_t));
+	}
+	if((chips == NULL && runner.batches == NULL) || runner.runs == NULL || runner.deques == NULL || workers == NULL)
+	{
+		printf("Not enough memory for %u instances\n", num_instances);
+		free_runner(&runner, num_units, chips, workers);
+		free(script.events);
+		return 1;
+	}
+	atomic_init(&runner.remaining, num_units);
+
+	if(runner.batches != NULL)
+	{
+		for(uint32_t unit = 0; unit < num_units; unit++)
+		{
+			uint32_t first = unit * RUNNER_BATCH_LANES;
+			uint32_t count = num_instances - first < RUNNER_BATCH_LANES ? num_instances - first : RUNNER_BATCH_LANES;
+			batch_t* batch = batch_create(&rom, count);
+
+			if(batch == NULL)
+			{
+				printf("Not enough memory for %u instances\n", num_instances);
+				free_runner(&runner, num_units, chips, workers);
+				free(script.events);
+				return 1;
+			}
+			runner.batches[unit] = batch;
+			for(uint32_t lane = 0; lane < count; lane++)
+			{
+				chip8_seed(&batch->chips[lane], opts->seed + first + lane);
+				runner.runs[first + lane].chip = &batch->chips[lane];
+				runner.runs[first + lane].script = script;
+			}
+		}
+	}
+	for(uint32_t n = 0; n < num_instances && runner.batches == NULL; n++)
+	{
+		chips[n] = rom;
+		chip8_seed(&chips[n], opts->seed + n);
+		// If the JIT isn't available for the first machine it isn't for any of them
+		run_opts.engine = attach_engine(&chips[n], run_opts.engine);
+		runner.runs[n].chip = &chips[n];
+		// Events are shared, each machine keeps its own position in them
+		runner.runs[n].script = script;
+	}
+	for(uint32_t n = 0; n < num_workers; n++)
+	{
+		work_deque_t* deque = &runner.deques[n];
+
+		atomic_init(&deque->top, 0);
+		atomic_init(&deque->bottom, 0);
+		deque->mask = capacity - 1;
+		deque->items = calloc(capacity, sizeof(atomic_uint));
+		if(deque->items == NULL)
+		{
+			printf("Not enough memory for %u instances\n", num_instances);
+			free_runner(&runner, num_units, chips, workers);
+			free(script.events);
+			return 1;
+		}
+	}
+	// Deal the units out round-robin, stealing evens out the rest
+	for(uint32_t n = 0; n < num_units; n++)
+	{
+		deque_push(&runner.deques[n % num_workers], n);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(started = 0; started < num_workers; started++)
+	{
+		workers[started].runner = &runner;
+		workers[started].index = started;
+		workers[started].victim_seed = started;
+		if(pthread_create(&workers[started].thread, NULL, worker_main, &workers[started]) != 0)
+		{
+			printf("Could not start worker thread %u\n", started);
+			break;
+		}
+	}
+	// Workers steal from every deque, so the ones that did start still finish all the work
+	for(uint32_t n = 0; n < started; n++)
+	{
+		pthread_join(workers[n].thread, NULL);
+		total_steals += workers[n].steals;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if(started < num_workers)
+	{
+		free_runner(&runner, num_units, chips, workers);
+		free(script.events);
+		return 1;
+	}
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	for(uint32_t n = 0; n < num_instances; n++)
+	{
+		headless_t* run = &runner.runs[n];
+
+		printf("instance %u: cycles %llu frames %llu pc 0x%03X gfx hash 0x%016llX\n", n, (unsigned long long)run->cycles,
+			(unsigned long long)run->frames, run->chip->pc, (unsigned long long)hash_gfx(run->chip));
+		total_cycles += run->cycles;
+		total_parked += run->parked_frames;
+	}
+	printf("instances: %u\n", num_instances);
+	printf("threads: %u\n", num_workers);
+	printf("cycles: %llu\n", (unsigned long long)total_cycles);
+	printf("frames parked in FX0A: %llu\n", (unsigned long long)total_parked);
+	printf("steals: %llu\n", (unsigned long long)total_steals);
+	printf("wall time: %.6f s\n", seconds);
+	printf("ips: %.0f\n", seconds > 0 ? total_cycles / seconds : 0.0);
+
+	free_runner(&runner, num_units, chips, workers);
+	free(script.events);
+	return 0;
+}
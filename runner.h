@@ -0,0 +1,27 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include "headless.h"
+
+/* Parallel headless runner. --instances N loads the ROM into N machines (instance n is seeded with
+ * seed + n) and runs them all to the headless stop conditions on a pool of worker threads, one per
+ * core by default. The unit of work is a slice of RUNNER_SLICE_FRAMES frames of one machine. Each
+ * worker keeps its machines in its own deque and, when that runs dry, steals from the other end of
+ * someone else's, so machines that stop early don't leave cores idle. A machine waiting in FX0A for
+ * a key is parked (see run_headless_frame()) and costs next to nothing until its script presses one.
+ * With --engine batch the unit of work is instead a lockstep batch of up to RUNNER_BATCH_LANES
+ * machines, which all stop together (--until-pc isn't available).
+ *
+ * Machines share only read-only data (decode table, fontset), so workers never lock anything */
+
+// Frames a worker runs of one machine (or batch) before going back to its deque
+#define RUNNER_SLICE_FRAMES 60
+// Machines per lockstep batch with --engine batch (see batch.h)
+#define RUNNER_BATCH_LANES 256
+// How long a worker with nothing to run or steal sleeps before looking again
+#define RUNNER_IDLE_SLEEP_NSEC 100000
+
+// Prints one line per machine and the combined instructions per second. Returns the exit code
+int run_parallel(const options_t* opts);
+
+#endif
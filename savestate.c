@@ -0,0 +1,349 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "savestate.h"
+
+// Shortest repeat worth encoding as a run, and the longest run one control byte covers
+#define RLE_MIN_RUN 3
+#define RLE_MAX_RUN (0x7F + RLE_MIN_RUN)
+#define SAVESTATE_HEADER_SIZE (4 + 2 + 8)
+// Registers, stack, timers, flags, display and RND state
+#define SAVESTATE_REGS_SIZE (NUM_GENERAL_PURPOSE_REGISTERS + 2 * 3 + 2 * SIZE_STACK + 3 + 8 * GFX_YAXIS + 8)
+// Version 1 had no RND state
+#define SAVESTATE_V1_REGS_SIZE (SAVESTATE_REGS_SIZE - 8)
+#define SAVESTATE_MAX_SIZE (SAVESTATE_HEADER_SIZE + SAVESTATE_REGS_SIZE + RLE_MAX_SIZE(SIZE_MEMORY))
+
+void chip8_snapshot(const chip8_t* chip, chip8_state_t* state)
+{
+	memcpy(state->memory, chip->memory, sizeof(state->memory));
+	memcpy(state->v, chip->v, sizeof(state->v));
+	memcpy(state->gfx, chip->gfx, sizeof(state->gfx));
+	memcpy(state->stack, chip->stack, sizeof(state->stack));
+	state->delay_timer = chip->delay_timer;
+	state->sound_timer = chip->sound_timer;
+	state->opcode = chip->opcode;
+	state->i = chip->i;
+	state->pc = chip->pc;
+	state->sp = chip->sp;
+	state->draw_flag = chip->draw_flag;
+	state->rng_state = chip->rng_state;
+	state->key_wait = chip->key_wait;
+}
+
+void chip8_restore(chip8_t* chip, const chip8_state_t* state)
+{
+	int32_t first = -1;
+	int32_t last = -1;
+
+	// Only the range that actually changes needs its cached code thrown away. Usually that's
+	// nothing or a few bytes of game variables
+	for(int32_t address = 0; address < SIZE_MEMORY; address++)
+	{
+		if(chip->memory[address] != state->memory[address])
+		{
+			if(first < 0)
+			{
+				first = address;
+			}
+			last = address;
+			// The rewind buffer's next delta has to pick the change up
+			chip->dirty_pages |= 1ULL << (address / DIRTY_PAGE_SIZE);
+		}
+	}
+	if(first >= 0)
+	{
+		memcpy(chip->memory, state->memory, sizeof(chip->memory));
+		invalidate_code(chip, first, last - first + 1);
+	}
+
+	memcpy(chip->v, state->v, sizeof(chip->v));
+	memcpy(chip->gfx, state->gfx, sizeof(chip->gfx));
+	chip->dirty_rows = UINT32_MAX;
+	memcpy(chip->stack, state->stack, sizeof(chip->stack));
+	chip->delay_timer = state->delay_timer;
+	chip->sound_timer = state->sound_timer;
+	chip->opcode = state->opcode;
+	chip->i = state->i;
+	chip->pc = state->pc;
+	chip->sp = state->sp;
+	chip->rng_state = state->rng_state;
+	chip->key_wait = state->key_wait;
+	// Whatever was on screen before is stale
+	chip->draw_flag = true;
+}
+
+uint64_t chip8_state_hash(const chip8_t* chip)
+{
+	chip8_state_t state;
+
+	// Padding bytes are hashed too, so they must be zero
+	memset(&state, 0, sizeof(state));
+	chip8_snapshot(chip, &state);
+	// Windowed runs clear it when they draw and headless runs every frame
+	state.draw_flag = false;
+	// Left over from decoding, and engines that don't decode one instruction at a time never set it.
+	// State files don't keep it either
+	state.opcode = 0;
+	return hash_bytes(&state, sizeof(state));
+}
+
+static uint8_t* put_u16(uint8_t* out, uint16_t value)
+{
+	*out++ = value & 0xFF;
+	*out++ = value >> 8;
+	return out;
+}
+
+static uint8_t* put_u64(uint8_t* out, uint64_t value)
+{
+	for(uint8_t n = 0; n < 8; n++)
+	{
+		*out++ = (uint8_t)(value >> (n * 8));
+	}
+	return out;
+}
+
+static uint16_t get_u16(const uint8_t* in)
+{
+	return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+static uint64_t get_u64(const uint8_t* in)
+{
+	uint64_t value = 0;
+
+	for(uint8_t n = 0; n < 8; n++)
+	{
+		value |= (uint64_t)in[n] << (n * 8);
+	}
+	return value;
+}
+
+/* @brief: Run-length encode a buffer. A control byte below 0x80 is followed by (control + 1) literal
+ * bytes. 0x80 and above is followed by one byte repeated ((control & 0x7F) + 3) times. Most of
+ * memory is zeros (interpreter area, space after the ROM), which compresses to a handful of bytes
+ * @arg out: At least RLE_MAX_SIZE(length) bytes
+ * @arg memory: Data to encode
+ * @arg length: Size of memory in bytes
+ * @return: End of the encoded data */
+uint8_t* rle_encode(uint8_t* out, const uint8_t* memory, uint32_t length)
+{
+	uint32_t pos = 0;
+	uint32_t literal_start = 0;
+
+	while(pos < length)
+	{
+		uint32_t run = 1;
+		while(pos + run < length && run < RLE_MAX_RUN && memory[pos + run] == memory[pos])
+		{
+			run++;
+		}
+
+		// Flush pending literals before a run, or when they fill a control byte
+		if(run >= RLE_MIN_RUN || pos - literal_start == RLE_MAX_LITERAL)
+		{
+			if(pos > literal_start)
+			{
+				*out++ = (uint8_t)(pos - literal_start - 1);
+				memcpy(out, memory + literal_start, pos - literal_start);
+				out += pos - literal_start;
+			}
+			literal_start = pos;
+		}
+		if(run >= RLE_MIN_RUN)
+		{
+			*out++ = (uint8_t)(0x80 | (run - RLE_MIN_RUN));
+			*out++ = memory[pos];
+			pos += run;
+			literal_start = pos;
+		}
+		else
+		{
+			pos++;
+		}
+	}
+	if(pos > literal_start)
+	{
+		*out++ = (uint8_t)(pos - literal_start - 1);
+		memcpy(out, memory + literal_start, pos - literal_start);
+		out += pos - literal_start;
+	}
+	return out;
+}
+
+/* @brief: Inverse of rle_encode()
+ * @arg memory: Decoded data
+ * @arg length: Expected decoded size
+ * @arg in: Encoded data
+ * @arg end: End of the encoded data
+ * @return: 0 if exactly length bytes were decoded from the input, -1 otherwise */
+int rle_decode(uint8_t* memory, uint32_t length, const uint8_t* in, const uint8_t* end)
+{
+	uint32_t pos = 0;
+
+	while(in < end)
+	{
+		uint8_t control = *in++;
+		uint32_t count;
+
+		if(control & 0x80)
+		{
+			count = (control & 0x7F) + RLE_MIN_RUN;
+			if(in == end || pos + count > length)
+			{
+				return -1;
+			}
+			memset(memory + pos, *in++, count);
+		}
+		else
+		{
+			count = control + 1;
+			if(end - in < (ptrdiff_t)count || pos + count > length)
+			{
+				return -1;
+			}
+			memcpy(memory + pos, in, count);
+			in += count;
+		}
+		pos += count;
+	}
+	return pos == length ? 0 : -1;
+}
+
+savestate_error_t chip8_save_state(const chip8_t* chip, const char* path)
+{
+	uint8_t buffer[SAVESTATE_MAX_SIZE];
+	uint8_t* out = buffer;
+	FILE* file;
+	size_t size;
+
+	memcpy(out, SAVESTATE_MAGIC, 4);
+	out += 4;
+	out = put_u16(out, SAVESTATE_VERSION);
+	out = put_u64(out, chip->rom_hash);
+
+	memcpy(out, chip->v, NUM_GENERAL_PURPOSE_REGISTERS);
+	out += NUM_GENERAL_PURPOSE_REGISTERS;
+	out = put_u16(out, chip->i);
+	out = put_u16(out, chip->pc);
+	out = put_u16(out, chip->sp);
+	for(uint8_t n = 0; n < SIZE_STACK; n++)
+	{
+		out = put_u16(out, chip->stack[n]);
+	}
+	*out++ = chip->delay_timer;
+	*out++ = chip->sound_timer;
+	*out++ = chip->draw_flag;
+	for(uint8_t row = 0; row < GFX_YAXIS; row++)
+	{
+		out = put_u64(out, chip->gfx[row]);
+	}
+	out = put_u64(out, chip->rng_state);
+	out = rle_encode(out, chip->memory, SIZE_MEMORY);
+
+	file = fopen(path, "wb");
+	if(file == NULL)
+	{
+		return SAVESTATE_ERROR_IO;
+	}
+	size = out - buffer;
+	if(fwrite(buffer, 1, size, file) != size)
+	{
+		fclose(file);
+		return SAVESTATE_ERROR_IO;
+	}
+	return fclose(file) == 0 ? SAVESTATE_OK : SAVESTATE_ERROR_IO;
+}
+
+savestate_error_t chip8_load_state(chip8_t* chip, const char* path)
+{
+	uint8_t buffer[SAVESTATE_MAX_SIZE];
+	chip8_state_t state;
+	const uint8_t* in = buffer;
+	FILE* file;
+	size_t size;
+	uint16_t version;
+
+	file = fopen(path, "rb");
+	if(file == NULL)
+	{
+		return SAVESTATE_ERROR_IO;
+	}
+	size = fread(buffer, 1, sizeof(buffer), file);
+	fclose(file);
+
+	if(size < SAVESTATE_HEADER_SIZE + SAVESTATE_V1_REGS_SIZE || memcmp(in, SAVESTATE_MAGIC, 4) != 0)
+	{
+		return SAVESTATE_ERROR_FORMAT;
+	}
+	version = get_u16(in + 4);
+	if(version < 1 || version > SAVESTATE_VERSION)
+	{
+		return SAVESTATE_ERROR_VERSION;
+	}
+	if(version >= 2 && size < SAVESTATE_HEADER_SIZE + SAVESTATE_REGS_SIZE)
+	{
+		return SAVESTATE_ERROR_FORMAT;
+	}
+	if(get_u64(in + 6) != chip->rom_hash)
+	{
+		return SAVESTATE_ERROR_ROM;
+	}
+	in += SAVESTATE_HEADER_SIZE;
+
+	memcpy(state.v, in, NUM_GENERAL_PURPOSE_REGISTERS);
+	in += NUM_GENERAL_PURPOSE_REGISTERS;
+	state.i = get_u16(in);
+	state.pc = get_u16(in + 2);
+	state.sp = get_u16(in + 4);
+	in += 6;
+	for(uint8_t n = 0; n < SIZE_STACK; n++, in += 2)
+	{
+		state.stack[n] = get_u16(in);
+	}
+	state.delay_timer = *in++;
+	state.sound_timer = *in++;
+	state.draw_flag = *in++;
+	for(uint8_t row = 0; row < GFX_YAXIS; row++, in += 8)
+	{
+		state.gfx[row] = get_u64(in);
+	}
+	state.rng_state = chip->rng_state;
+	if(version >= 2)
+	{
+		state.rng_state = get_u64(in);
+		in += 8;
+	}
+	if(rle_decode(state.memory, SIZE_MEMORY, in, buffer + size) != 0)
+	{
+		return SAVESTATE_ERROR_FORMAT;
+	}
+	// Reject values the interpreter can't handle rather than crash later
+	if(state.sp >= SIZE_STACK || state.rng_state == 0)
+	{
+		return SAVESTATE_ERROR_FORMAT;
+	}
+	state.opcode = (state.memory[state.pc & (SIZE_MEMORY - 1)] << 8) | state.memory[(state.pc + 1) & (SIZE_MEMORY - 1)];
+	state.key_wait = 0;
+
+	chip8_restore(chip, &state);
+	return SAVESTATE_OK;
+}
+
+const char* savestate_error_string(savestate_error_t error)
+{
+	switch(error)
+	{
+		case SAVESTATE_OK:
+			return "ok";
+		case SAVESTATE_ERROR_IO:
+			return "could not read or write the file";
+		case SAVESTATE_ERROR_FORMAT:
+			return "not a valid save state";
+		case SAVESTATE_ERROR_VERSION:
+			return "saved by an incompatible version";
+		case SAVESTATE_ERROR_ROM:
+			return "saved from a different ROM";
+	}
+	return "unknown error";
+}
@@ -0,0 +1,68 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include "chip8.h"
+
+/* Save states. chip8_snapshot()/chip8_restore() copy the machine state to and from memory and are
+ * cheap enough to call every frame. chip8_save_state()/chip8_load_state() store the same state in
+ * a file:
+ *
+ *   "C8SS", u16 version, u64 hash of the ROM it was taken from
+ *   V0-VF, I, PC, SP, stack, delay timer, sound timer, draw flag, display rows
+ *   RND generator state (version 2 and later)
+ *   memory, run-length encoded (see rle_encode())
+ *
+ * Version 1 files still load and leave the RND generator as it is.
+ * Multi-byte fields are little-endian. Keys aren't saved, they belong to whoever is playing, and
+ * neither are the keys an FX0A wait has seen, so a loaded wait starts over */
+
+#define SAVESTATE_MAGIC "C8SS"
+#define SAVESTATE_VERSION 2
+// Hotkey save slots, F1-F4 save and F5-F8 load
+#define NUM_SAVE_SLOTS 4
+// Longest literal one RLE control byte covers, and the worst case encoded size of length bytes
+#define RLE_MAX_LITERAL 0x80
+#define RLE_MAX_SIZE(length) ((length) + ((length) + RLE_MAX_LITERAL - 1) / RLE_MAX_LITERAL)
+
+// Everything that makes up the running machine, without emulator state (caches, JIT, trace)
+typedef struct chip8_state_t
+{
+	uint8_t memory[SIZE_MEMORY];
+	uint8_t v[NUM_GENERAL_PURPOSE_REGISTERS];
+	uint64_t gfx[GFX_YAXIS];
+	uint8_t delay_timer;
+	uint8_t sound_timer;
+	uint16_t opcode;
+	uint16_t i;
+	uint16_t pc;
+	uint16_t stack[SIZE_STACK];
+	uint16_t sp;
+	bool draw_flag;
+	uint64_t rng_state;
+	uint16_t key_wait;
+} chip8_state_t;
+
+// Reasons chip8_load_state() can fail
+typedef enum savestate_error_t
+{
+	SAVESTATE_OK = 0,
+	SAVESTATE_ERROR_IO = -1,
+	SAVESTATE_ERROR_FORMAT = -2,
+	SAVESTATE_ERROR_VERSION = -3,
+	SAVESTATE_ERROR_ROM = -4
+} savestate_error_t;
+
+void chip8_snapshot(const chip8_t* chip, chip8_state_t* state);
+// Cached translations of any memory that differs are discarded
+void chip8_restore(chip8_t* chip, const chip8_state_t* state);
+savestate_error_t chip8_save_state(const chip8_t* chip, const char* path);
+// Refuses states taken from a different ROM (chip->rom_hash) or another format version
+savestate_error_t chip8_load_state(chip8_t* chip, const char* path);
+const char* savestate_error_string(savestate_error_t error);
+// Hash of everything chip8_snapshot() copies except the draw flag and opcode, for checking two runs ended the same
+uint64_t chip8_state_hash(const chip8_t* chip);
+// Run-length coding used for memory in state files, also used by the rewind buffer
+uint8_t* rle_encode(uint8_t* out, const uint8_t* memory, uint32_t length);
+int rle_decode(uint8_t* memory, uint32_t length, const uint8_t* in, const uint8_t* end);
+
+#endif
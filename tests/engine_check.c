@@ -0,0 +1,491 @@
+/* Differential engine check, run by make check. Random ROMs run on the block, threaded, JIT and
+ * batch engines have to leave every machine in the state the stepping interpreter does, frame by
+ * frame. Exits non-zero if any of them differ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "jit.h"
+#include "batch.h"
+#include "savestate.h"
+
+#define NUM_ROMS 2507
+#define NUM_FRAMES 12
+#define FRAME_CYCLES 97
+#define NUM_LANES 40
+// Batch lanes get this many different RND seeds, so CXKK splits them into groups
+#define NUM_LANE_SEEDS 8
+
+/* Layout of a generated ROM. Code is built from units of two instructions, and control only ever
+ * lands on the first of a unit: jumps and calls target unit starts and a skip is always the first
+ * instruction of its unit. Subroutine n only calls subroutines after it, so the stack never holds
+ * more than MAX_SUBROUTINES return addresses. I is set from ANNN or FX29 in the same unit as the
+ * instruction that uses it, so every memory access stays in the data area, the font or the
+ * immediate of a 6XKK/7XKK (self-modifying code) */
+#define UNIT_SIZE 4
+#define MAX_MAIN_UNITS 200
+#define MAX_SUBROUTINES 8
+#define MAX_SUBROUTINE_UNITS 24
+#define DATA_START 0xA00
+#define DATA_END 0xF00
+#define ROM_SIZE (DATA_END - GAME_START_ADDRESS)
+
+typedef struct generated_rom_t
+{
+	uint8_t bytes[ROM_SIZE];
+	uint64_t seed;
+	// Keys held down during each frame
+	uint16_t keys[NUM_FRAMES];
+} generated_rom_t;
+
+static int failures = 0;
+static uint64_t random_state;
+
+static uint32_t random_below(uint32_t bound)
+{
+	// xorshift64*
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return (uint32_t)((random_state * 0x2545F4914F6CDD1DULL) >> 32) % bound;
+}
+
+static void put_opcode(generated_rom_t* rom, uint16_t address, uint16_t opcode)
+{
+	rom->bytes[address - GAME_START_ADDRESS] = opcode >> 8;
+	rom->bytes[address - GAME_START_ADDRESS + 1] = opcode & 0xFF;
+}
+
+static uint16_t get_opcode(const generated_rom_t* rom, uint16_t address)
+{
+	return (rom->bytes[address - GAME_START_ADDRESS] << 8) | rom->bytes[address - GAME_START_ADDRESS + 1];
+}
+
+/* @brief: An instruction that always falls through to the next one and touches no memory */
+static uint16_t random_plain(void)
+{
+	uint16_t x = random_below(16) << 8;
+	uint16_t y = random_below(16) << 4;
+	uint16_t kk = random_below(256);
+	static const uint16_t alu[] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE};
+
+	switch(random_below(12))
+	{
+		case 0:
+			return random_below(8) == 0 ? 0x00E0 : 0x6000 | x | kk;
+		case 1:
+		case 2:
+			return 0x6000 | x | kk;
+		case 3:
+		case 4:
+			return 0x7000 | x | kk;
+		case 5:
+		case 6:
+		case 7:
+			return 0x8000 | x | y | alu[random_below(sizeof(alu) / sizeof(alu[0]))];
+		case 8:
+			return 0xC000 | x | kk;
+		case 9:
+			return 0xF007 | x;
+		case 10:
+			return random_below(2) ? 0xF015 | x : 0xF018 | x;
+		default:
+			// Rare, since it parks the machine until a key goes up
+			return random_below(16) == 0 ? 0xF00A | x : 0xF01E | x;
+	}
+}
+
+static uint16_t random_skip(void)
+{
+	uint16_t x = random_below(16) << 8;
+	uint16_t y = random_below(16) << 4;
+	uint16_t kk = random_below(4) == 0 ? random_below(256) : random_below(4);
+
+	switch(random_below(6))
+	{
+		case 0:
+			return 0x3000 | x | kk;
+		case 1:
+			return 0x4000 | x | kk;
+		case 2:
+			return 0x5000 | x | y;
+		case 3:
+			return 0x9000 | x | y;
+		case 4:
+			return 0xE09E | x;
+		default:
+			return 0xE0A1 | x;
+	}
+}
+
+/* @brief: A unit that sets I and uses it. Writes 0xF055 with I = 0 for the self-modifying kind,
+ * which is pointed at a real immediate once all the code is in place
+ * @return: true if the unit still needs its target */
+static bool put_memory_unit(generated_rom_t* rom, uint16_t address)
+{
+	uint16_t x = random_below(16) << 8;
+	uint16_t y = random_below(16) << 4;
+	// Leaves room for FX55/FX65 on all 16 registers and a 15 row sprite
+	uint16_t data = DATA_START + random_below(DATA_END - DATA_START - 16);
+
+	switch(random_below(6))
+	{
+		case 0:
+			put_opcode(rom, address, 0xA000 | data);
+			put_opcode(rom, address + 2, 0xF033 | x);
+			return false;
+		case 1:
+			put_opcode(rom, address, 0xA000 | data);
+			put_opcode(rom, address + 2, 0xF055 | x);
+			return false;
+		case 2:
+			put_opcode(rom, address, 0xA000 | data);
+			put_opcode(rom, address + 2, 0xF065 | x);
+			return false;
+		case 3:
+			put_opcode(rom, address, 0xA000 | data);
+			put_opcode(rom, address + 2, 0xD000 | x | y | random_below(16));
+			return false;
+		case 4:
+			put_opcode(rom, address, 0xF029 | x);
+			put_opcode(rom, address + 2, 0xD005 | x | y);
+			return false;
+		default:
+			put_opcode(rom, address, 0xA000);
+			put_opcode(rom, address + 2, 0xF055);
+			return true;
+	}
+}
+
+/* @brief: Fill in a random ROM and the keys pressed while it runs
+ * @arg rom:
+ * @arg index: Selects the ROM. The same index always gives the same ROM */
+static void generate_rom(generated_rom_t* rom, uint32_t index)
+{
+	uint16_t main_units;
+	uint16_t num_subroutines;
+	uint16_t subroutine_start[MAX_SUBROUTINES];
+	uint16_t subroutine_units[MAX_SUBROUTINES];
+	uint16_t patches[MAX_MAIN_UNITS + MAX_SUBROUTINES * MAX_SUBROUTINE_UNITS];
+	uint16_t immediates[MAX_MAIN_UNITS + MAX_SUBROUTINES * MAX_SUBROUTINE_UNITS];
+	uint32_t num_patches = 0;
+	uint32_t num_immediates = 0;
+	uint16_t address;
+
+	random_state = 0x9E3779B97F4A7C15ULL * (index + 1);
+	rom->seed = random_state ^ 0xD1B54A32D192ED03ULL;
+	for(uint32_t frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		rom->keys[frame] = random_below(3) == 0 ? random_below(0x10000) : 0;
+	}
+	// Random data everywhere, then the code on top
+	for(uint32_t n = 0; n < ROM_SIZE; n++)
+	{
+		rom->bytes[n] = random_below(256);
+	}
+
+	main_units = 2 + random_below(MAX_MAIN_UNITS - 1);
+	num_subroutines = random_below(MAX_SUBROUTINES + 1);
+	address = GAME_START_ADDRESS + main_units * UNIT_SIZE;
+	for(uint16_t sub = 0; sub < num_subroutines; sub++)
+	{
+		subroutine_start[sub] = address;
+		subroutine_units[sub] = 1 + random_below(MAX_SUBROUTINE_UNITS);
+		address += subroutine_units[sub] * UNIT_SIZE;
+	}
+
+	// Main loop. Its last unit jumps back to the start
+	for(uint16_t unit = 0; unit < main_units; unit++)
+	{
+		uint16_t at = GAME_START_ADDRESS + unit * UNIT_SIZE;
+		uint16_t target = GAME_START_ADDRESS + random_below(main_units) * UNIT_SIZE;
+		uint32_t kind = unit == main_units - 1 ? 0 : random_below(100);
+
+		if(kind == 0)
+		{
+			put_opcode(rom, at, random_plain());
+			put_opcode(rom, at + 2, 0x1000 | GAME_START_ADDRESS);
+		}
+		else if(kind < 45)
+		{
+			put_opcode(rom, at, random_plain());
+			put_opcode(rom, at + 2, random_plain());
+		}
+		else if(kind < 60)
+		{
+			put_opcode(rom, at, random_skip());
+			put_opcode(rom, at + 2, random_plain());
+		}
+		else if(kind < 72)
+		{
+			if(put_memory_unit(rom, at))
+			{
+				patches[num_patches++] = at;
+			}
+		}
+		else if(kind < 80)
+		{
+			put_opcode(rom, at, random_plain());
+			put_opcode(rom, at + 2, 0x1000 | target);
+		}
+		else if(kind < 85)
+		{
+			// V0 is loaded right before BNNN, so the target is still a unit start
+			uint16_t offset = random_below(128) * 2;
+			put_opcode(rom, at, 0x6000 | offset);
+			put_opcode(rom, at + 2, 0xB000 | (target - offset));
+		}
+		else if(num_subroutines > 0)
+		{
+			put_opcode(rom, at, random_plain());
+			put_opcode(rom, at + 2, 0x2000 | subroutine_start[random_below(num_subroutines)]);
+		}
+		else
+		{
+			put_opcode(rom, at, random_plain());
+			put_opcode(rom, at + 2, random_plain());
+		}
+	}
+
+	// Subroutines end in a return and only call the ones after them
+	for(uint16_t sub = 0; sub < num_subroutines; sub++)
+	{
+		for(uint16_t unit = 0; unit < subroutine_units[sub]; unit++)
+		{
+			uint16_t at = subroutine_start[sub] + unit * UNIT_SIZE;
+			uint32_t kind = unit == subroutine_units[sub] - 1 ? 0 : random_below(100);
+
+			if(kind == 0)
+			{
+				put_opcode(rom, at, random_plain());
+				put_opcode(rom, at + 2, 0x00EE);
+			}
+			else if(kind < 55)
+			{
+				put_opcode(rom, at, random_plain());
+				put_opcode(rom, at + 2, random_plain());
+			}
+			else if(kind < 75)
+			{
+				put_opcode(rom, at, random_skip());
+				put_opcode(rom, at + 2, random_plain());
+			}
+			else if(kind < 90 || sub == num_subroutines - 1)
+			{
+				if(put_memory_unit(rom, at))
+				{
+					patches[num_patches++] = at;
+				}
+			}
+			else
+			{
+				put_opcode(rom, at, random_plain());
+				put_opcode(rom, at + 2, 0x2000 | subroutine_start[sub + 1 + random_below(num_subroutines - sub - 1)]);
+			}
+		}
+	}
+
+	// Self-modifying units store V0 over the immediate of some 6XKK or 7XKK, which stays the same
+	// kind of instruction whatever the value
+	for(address = GAME_START_ADDRESS; address < GAME_START_ADDRESS + main_units * UNIT_SIZE; address += 2)
+	{
+		if((get_opcode(rom, address) >> 12) == 0x6 || (get_opcode(rom, address) >> 12) == 0x7)
+		{
+			immediates[num_immediates++] = address + 1;
+		}
+	}
+	for(uint32_t patch = 0; patch < num_patches; patch++)
+	{
+		uint16_t target = num_immediates > 0 ? immediates[random_below(num_immediates)] : DATA_START;
+		put_opcode(rom, patches[patch], 0xA000 | target);
+	}
+}
+
+/* @brief: First part of the machine state that differs
+ * @return: Its name, or NULL if the states are the same */
+static const char* state_difference(const chip8_state_t* a, const chip8_state_t* b)
+{
+	if(a->pc != b->pc)
+	{
+		return "pc";
+	}
+	if(a->opcode != b->opcode)
+	{
+		return "opcode";
+	}
+	if(memcmp(a->v, b->v, sizeof(a->v)) != 0)
+	{
+		return "registers";
+	}
+	if(a->i != b->i)
+	{
+		return "I";
+	}
+	if(a->sp != b->sp || memcmp(a->stack, b->stack, sizeof(a->stack)) != 0)
+	{
+		return "stack";
+	}
+	if(a->delay_timer != b->delay_timer || a->sound_timer != b->sound_timer)
+	{
+		return "timers";
+	}
+	if(a->rng_state != b->rng_state)
+	{
+		return "RND state";
+	}
+	if(a->key_wait != b->key_wait)
+	{
+		return "key wait";
+	}
+	if(a->draw_flag != b->draw_flag)
+	{
+		return "draw flag";
+	}
+	if(memcmp(a->gfx, b->gfx, sizeof(a->gfx)) != 0)
+	{
+		return "display";
+	}
+	if(memcmp(a->memory, b->memory, sizeof(a->memory)) != 0)
+	{
+		return "memory";
+	}
+	return NULL;
+}
+
+static void boot(chip8_t* chip, const generated_rom_t* rom, uint64_t seed)
+{
+	initialize_chip(chip);
+	chip8_load_rom(chip, rom->bytes, ROM_SIZE);
+	chip8_seed(chip, seed);
+}
+
+/* @brief: Run a machine for NUM_FRAMES frames, comparing it with the reference after each
+ * @arg reference: States after each frame. The step engine records them instead
+ * @return: false if it differed from the reference */
+static bool run_engine(chip8_t* chip, engine_t engine, const generated_rom_t* rom, chip8_state_t* reference,
+	const char* name, uint32_t index)
+{
+	static chip8_state_t state;
+
+	for(uint32_t frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		chip->keys = rom->keys[frame];
+		run_cycles(chip, engine, FRAME_CYCLES);
+		handle_delay_timer(chip);
+		handle_sound_timer(chip);
+
+		if(engine == ENGINE_STEP)
+		{
+			chip8_snapshot(chip, &reference[frame]);
+			continue;
+		}
+		chip8_snapshot(chip, &state);
+		const char* difference = state_difference(&reference[frame], &state);
+		if(difference != NULL)
+		{
+			printf("FAIL: ROM %u, %s engine: state differs from step in %s after frame %u\n", index, name, difference, frame);
+			failures++;
+			return false;
+		}
+	}
+	return true;
+}
+
+/* @brief: NUM_LANES copies of the ROM on the batch engine, lane n with the RND seed of reference
+ * n % NUM_LANE_SEEDS
+ * @return: false if any lane differed from its reference */
+static bool run_batch(const generated_rom_t* rom, chip8_state_t references[][NUM_FRAMES], uint32_t index)
+{
+	static chip8_t chip;
+	static chip8_state_t state;
+	batch_t* batch;
+
+	boot(&chip, rom, rom->seed);
+	batch = batch_create(&chip, NUM_LANES);
+	if(batch == NULL)
+	{
+		printf("FAIL: ROM %u, can't create a batch\n", index);
+		failures++;
+		return false;
+	}
+	for(uint32_t lane = 0; lane < NUM_LANES; lane++)
+	{
+		chip8_seed(&batch->chips[lane], rom->seed + lane % NUM_LANE_SEEDS);
+	}
+
+	for(uint32_t frame = 0; frame < NUM_FRAMES; frame++)
+	{
+		for(uint32_t lane = 0; lane < NUM_LANES; lane++)
+		{
+			batch->chips[lane].keys = rom->keys[frame];
+		}
+		batch_run(batch, FRAME_CYCLES);
+		batch_tick_timers(batch);
+		batch_sync(batch);
+
+		for(uint32_t lane = 0; lane < NUM_LANES; lane++)
+		{
+			chip8_snapshot(&batch->chips[lane], &state);
+			const char* difference = state_difference(&references[lane % NUM_LANE_SEEDS][frame], &state);
+			if(difference != NULL)
+			{
+				printf("FAIL: ROM %u, batch engine lane %u: state differs from step in %s after frame %u\n", index, lane,
+					difference, frame);
+				failures++;
+				batch_destroy(batch);
+				return false;
+			}
+		}
+	}
+	batch_destroy(batch);
+	return true;
+}
+
+static void check_rom(uint32_t index)
+{
+	static generated_rom_t rom;
+	static chip8_t chip;
+	static chip8_state_t references[NUM_LANE_SEEDS][NUM_FRAMES];
+
+	generate_rom(&rom, index);
+
+	// Reference states from the stepping interpreter, one run per lane seed
+	for(uint32_t seed = 0; seed < NUM_LANE_SEEDS; seed++)
+	{
+		boot(&chip, &rom, rom.seed + seed);
+		run_engine(&chip, ENGINE_STEP, &rom, references[seed], "step", index);
+	}
+
+	boot(&chip, &rom, rom.seed);
+	chip.cache = create_block_cache();
+	run_engine(&chip, ENGINE_BLOCK, &rom, references[0], "block", index);
+	destroy_block_cache(chip.cache);
+
+	boot(&chip, &rom, rom.seed);
+	run_engine(&chip, ENGINE_THREADED, &rom, references[0], "threaded", index);
+
+	// Only x86-64 hosts have a JIT
+	boot(&chip, &rom, rom.seed);
+	chip.jit = jit_create();
+	if(chip.jit != NULL)
+	{
+		run_engine(&chip, ENGINE_JIT, &rom, references[0], "JIT", index);
+		jit_destroy(chip.jit);
+	}
+
+	run_batch(&rom, references, index);
+}
+
+int main(void)
+{
+	build_decode_table();
+	for(uint32_t index = 0; index < NUM_ROMS; index++)
+	{
+		check_rom(index);
+	}
+	if(failures == 0)
+	{
+		printf("engine_check: ok\n");
+	}
+	return failures != 0;
+}
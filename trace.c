@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+static void flush_buffer(trace_writer_t* trace)
+{
+	fwrite(trace->buffer, 1, trace->used, trace->file);
+	trace->used = 0;
+}
+
+trace_writer_t* trace_open(const char* path)
+{
+	trace_writer_t* trace = malloc(sizeof(trace_writer_t));
+
+	if(trace == NULL)
+	{
+		return NULL;
+	}
+	trace->file = fopen(path, "wb");
+	if(trace->file == NULL)
+	{
+		free(trace);
+		return NULL;
+	}
+	trace->cycle = 0;
+	// The first record's cycle is stored relative to last_cycle + 1
+	trace->last_cycle = UINT64_MAX;
+
+	memcpy(trace->buffer, TRACE_MAGIC, 4);
+	trace->buffer[4] = TRACE_VERSION;
+	trace->used = 5;
+	return trace;
+}
+
+void trace_close(trace_writer_t* trace)
+{
+	flush_buffer(trace);
+	fclose(trace->file);
+	free(trace);
+}
+
+/* @brief: Encode one record into the buffer, flushing first if it might not fit
+ * @arg trace:
+ * @arg record: */
+void trace_write(trace_writer_t* trace, const trace_record_t* record)
+{
+	uint8_t* out;
+	uint64_t delta = record->cycle - (trace->last_cycle + 1);
+
+	if(trace->used > TRACE_BUFFER_SIZE - TRACE_MAX_RECORD)
+	{
+		flush_buffer(trace);
+	}
+	out = trace->buffer + trace->used;
+
+	// LEB128: 7 bits per byte, high bit set on all but the last
+	while(delta >= 0x80)
+	{
+		*out++ = (uint8_t)(delta | 0x80);
+		delta >>= 7;
+	}
+	*out++ = (uint8_t)delta;
+
+	*out++ = record->pc & 0xFF;
+	*out++ = record->pc >> 8;
+	*out++ = record->opcode & 0xFF;
+	*out++ = record->opcode >> 8;
+	*out++ = record->v_mask & 0xFF;
+	*out++ = record->v_mask >> 8;
+	*out++ = record->flags;
+	for(uint8_t n = 0; n < NUM_GENERAL_PURPOSE_REGISTERS; n++)
+	{
+		if(record->v_mask & (1 << n))
+		{
+			*out++ = record->v[n];
+		}
+	}
+	if(record->flags & TRACE_I)
+	{
+		*out++ = record->i & 0xFF;
+		*out++ = record->i >> 8;
+	}
+	if(record->flags & TRACE_DELAY_TIMER)
+	{
+		*out++ = record->delay_timer;
+	}
+	if(record->flags & TRACE_SOUND_TIMER)
+	{
+		*out++ = record->sound_timer;
+	}
+	if(record->flags & TRACE_MEMORY)
+	{
+		*out++ = record->write_address & 0xFF;
+		*out++ = record->write_address >> 8;
+		*out++ = record->write_length;
+		memcpy(out, record->write, record->write_length);
+		out += record->write_length;
+	}
+
+	trace->used = out - trace->buffer;
+	trace->last_cycle = record->cycle;
+}
+
+int trace_read_header(FILE* file)
+{
+	uint8_t header[5];
+
+	if(fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, TRACE_MAGIC, 4) != 0 ||
+		header[4] != TRACE_VERSION)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+// Little-endian 16-bit read. Sets *ok to false at end of file
+static uint16_t read_u16(FILE* file, bool* ok)
+{
+	int lo = getc(file);
+	int hi = getc(file);
+
+	if(hi == EOF)
+	{
+		*ok = false;
+		return 0;
+	}
+	return (uint16_t)(lo | (hi << 8));
+}
+
+static uint8_t read_u8(FILE* file, bool* ok)
+{
+	int byte = getc(file);
+
+	if(byte == EOF)
+	{
+		*ok = false;
+		return 0;
+	}
+	return (uint8_t)byte;
+}
+
+int trace_read(FILE* file, uint64_t previous_cycle, trace_record_t* record)
+{
+	bool ok = true;
+	uint64_t delta = 0;
+	int shift = 0;
+	int byte = getc(file);
+
+	// Clean end of trace
+	if(byte == EOF)
+	{
+		return 0;
+	}
+	for(;;)
+	{
+		delta |= (uint64_t)(byte & 0x7F) << shift;
+		if((byte & 0x80) == 0)
+		{
+			break;
+		}
+		shift += 7;
+		byte = getc(file);
+		if(byte == EOF || shift > 63)
+		{
+			return -1;
+		}
+	}
+	record->cycle = previous_cycle + 1 + delta;
+
+	record->pc = read_u16(file, &ok);
+	record->opcode = read_u16(file, &ok);
+	record->v_mask = read_u16(file, &ok);
+	record->flags = read_u8(file, &ok);
+	for(uint8_t n = 0; n < NUM_GENERAL_PURPOSE_REGISTERS; n++)
+	{
+		if(record->v_mask & (1 << n))
+		{
+			record->v[n] = read_u8(file, &ok);
+		}
+	}
+	if(record->flags & TRACE_I)
+	{
+		record->i = read_u16(file, &ok);
+	}
+	if(record->flags & TRACE_DELAY_TIMER)
+	{
+		record->delay_timer = read_u8(file, &ok);
+	}
+	if(record->flags & TRACE_SOUND_TIMER)
+	{
+		record->sound_timer = read_u8(file, &ok);
+	}
+	record->write_length = 0;
+	if(record->flags & TRACE_MEMORY)
+	{
+		record->write_address = read_u16(file, &ok);
+		record->write_length = read_u8(file, &ok);
+		if(record->write_length > TRACE_MAX_WRITE ||
+			fread(record->write, 1, record->write_length, file) != record->write_length)
+		{
+			return -1;
+		}
+	}
+	return ok ? 1 : -1;
+}
@@ -0,0 +1,77 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "chip8.h"
+
+/* Binary execution trace. The file starts with TRACE_MAGIC and TRACE_VERSION, followed by one
+ * record per executed instruction:
+ *
+ *   varint   cycle - (previous cycle + 1), normally 0
+ *   u16      pc
+ *   u16      opcode
+ *   u16      mask of V registers changed by the instruction
+ *   u8       TRACE_* flags
+ *   u8[]     new value of each changed V register, lowest index first
+ *   u16      new I                       (TRACE_I)
+ *   u8       new delay timer             (TRACE_DELAY_TIMER)
+ *   u8       new sound timer             (TRACE_SOUND_TIMER)
+ *   u16, u8  address and length of the memory write, then the bytes written (TRACE_MEMORY)
+ *
+ * Multi-byte fields are little-endian. A typical record is 8-9 bytes */
+
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 1
+// Writes are collected here and handed to stdio in large chunks
+#define TRACE_BUFFER_SIZE (64 * 1024)
+// FX55 writes at most 16 bytes
+#define TRACE_MAX_WRITE NUM_GENERAL_PURPOSE_REGISTERS
+// Worst case encoded size of one record
+#define TRACE_MAX_RECORD (10 + 7 + NUM_GENERAL_PURPOSE_REGISTERS + 4 + 3 + TRACE_MAX_WRITE)
+
+#define TRACE_I 0x01
+#define TRACE_DELAY_TIMER 0x02
+#define TRACE_SOUND_TIMER 0x04
+#define TRACE_MEMORY 0x08
+
+typedef struct trace_record_t
+{
+	uint64_t cycle;
+	uint16_t pc;
+	uint16_t opcode;
+	uint16_t v_mask;
+	uint8_t flags;
+	// Only the entries selected by v_mask and flags are meaningful
+	uint8_t v[NUM_GENERAL_PURPOSE_REGISTERS];
+	uint16_t i;
+	uint8_t delay_timer;
+	uint8_t sound_timer;
+	uint16_t write_address;
+	uint8_t write_length;
+	uint8_t write[TRACE_MAX_WRITE];
+} trace_record_t;
+
+typedef struct trace_writer_t
+{
+	FILE* file;
+	// Cycle number of the next instruction and of the last record written
+	uint64_t cycle;
+	uint64_t last_cycle;
+	uint32_t used;
+	uint8_t buffer[TRACE_BUFFER_SIZE];
+} trace_writer_t;
+
+// Create the file and write the header. Returns NULL on failure
+trace_writer_t* trace_open(const char* path);
+// Flush buffered records, close the file and free the writer
+void trace_close(trace_writer_t* trace);
+void trace_write(trace_writer_t* trace, const trace_record_t* record);
+
+// Check the header. Returns 0 if file is a trace this version can read
+int trace_read_header(FILE* file);
+// Read the next record. previous_cycle is the cycle of the last record read, or UINT64_MAX before
+// the first. Returns 1 on success, 0 at the end of the file, -1 if the record is truncated
+int trace_read(FILE* file, uint64_t previous_cycle, trace_record_t* record);
+
+#endif
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+/* Offline companion to --trace. Streams two trace files side by side and reports the first record
+ * where they disagree.
+ * Build: gcc -O2 trace_diff.c trace.c -o trace_diff
+ * Usage: ./trace_diff <a.trace> <b.trace>
+ * Exit code: 0 if the traces match, 1 at the first divergence, 2 if a file can't be read */
+
+static void print_record(const char* name, const trace_record_t* record)
+{
+	printf("%s: cycle %llu pc 0x%03X opcode 0x%04X", name, (unsigned long long)record->cycle, record->pc, record->opcode);
+	for(uint8_t n = 0; n < NUM_GENERAL_PURPOSE_REGISTERS; n++)
+	{
+		if(record->v_mask & (1 << n))
+		{
+			printf(" V%X=0x%02X", n, record->v[n]);
+		}
+	}
+	if(record->flags & TRACE_I)
+	{
+		printf(" I=0x%03X", record->i);
+	}
+	if(record->flags & TRACE_DELAY_TIMER)
+	{
+		printf(" DT=%u", record->delay_timer);
+	}
+	if(record->flags & TRACE_SOUND_TIMER)
+	{
+		printf(" ST=%u", record->sound_timer);
+	}
+	if(record->flags & TRACE_MEMORY)
+	{
+		printf(" [0x%03X]=", record->write_address);
+		for(uint8_t n = 0; n < record->write_length; n++)
+		{
+			printf("%02X", record->write[n]);
+		}
+	}
+	printf("\n");
+}
+
+/* @brief: Name the first field where two records differ
+ * @return: NULL if the records are identical */
+static const char* compare_records(const trace_record_t* a, const trace_record_t* b)
+{
+	if(a->cycle != b->cycle)
+	{
+		return "cycle";
+	}
+	if(a->pc != b->pc)
+	{
+		return "program counter";
+	}
+	if(a->opcode != b->opcode)
+	{
+		return "opcode";
+	}
+	if(a->v_mask != b->v_mask)
+	{
+		return "changed registers";
+	}
+	for(uint8_t n = 0; n < NUM_GENERAL_PURPOSE_REGISTERS; n++)
+	{
+		if((a->v_mask & (1 << n)) && a->v[n] != b->v[n])
+		{
+			return "register value";
+		}
+	}
+	if(a->flags != b->flags)
+	{
+		return "changed state";
+	}
+	if((a->flags & TRACE_I) && a->i != b->i)
+	{
+		return "I";
+	}
+	if((a->flags & TRACE_DELAY_TIMER) && a->delay_timer != b->delay_timer)
+	{
+		return "delay timer";
+	}
+	if((a->flags & TRACE_SOUND_TIMER) && a->sound_timer != b->sound_timer)
+	{
+		return "sound timer";
+	}
+	if((a->flags & TRACE_MEMORY) && (a->write_address != b->write_address || a->write_length != b->write_length ||
+		memcmp(a->write, b->write, a->write_length) != 0))
+	{
+		return "memory write";
+	}
+	return NULL;
+}
+
+int main(int argc, char** argv)
+{
+	FILE* files[2];
+	trace_record_t records[2];
+	uint64_t cycles[2] = {UINT64_MAX, UINT64_MAX};
+	uint64_t count = 0;
+
+	if(argc != 3)
+	{
+		printf("Usage: %s <a.trace> <b.trace>\n", argv[0]);
+		return 2;
+	}
+	for(int n = 0; n < 2; n++)
+	{
+		files[n] = fopen(argv[n + 1], "rb");
+		if(files[n] == NULL || trace_read_header(files[n]) != 0)
+		{
+			printf("%s is not a readable trace\n", argv[n + 1]);
+			return 2;
+		}
+	}
+
+	for(;;)
+	{
+		int status[2];
+
+		for(int n = 0; n < 2; n++)
+		{
+			status[n] = trace_read(files[n], cycles[n], &records[n]);
+			if(status[n] < 0)
+			{
+				printf("%s is truncated after %llu records\n", argv[n + 1], (unsigned long long)count);
+				return 2;
+			}
+			cycles[n] = records[n].cycle;
+		}
+
+		if(status[0] == 0 && status[1] == 0)
+		{
+			printf("traces match (%llu records)\n", (unsigned long long)count);
+			return 0;
+		}
+		if(status[0] == 0 || status[1] == 0)
+		{
+			int longer = status[0] == 0 ? 1 : 0;
+			printf("%s ends after %llu records, %s continues with:\n", argv[2 - longer], (unsigned long long)count,
+				argv[longer + 1]);
+			print_record(longer == 0 ? "a" : "b", &records[longer]);
+			return 1;
+		}
+
+		const char* field = compare_records(&records[0], &records[1]);
+		if(field != NULL)
+		{
+			printf("first divergence at record %llu (%s differs)\n", (unsigned long long)count, field);
+			print_record("a", &records[0]);
+			print_record("b", &records[1]);
+			return 1;
+		}
+		count++;
+	}
+}